@@ -0,0 +1,89 @@
+#include "arena.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct Block {
+    Block *next;
+    uint64_t size, used;
+    max_align_t data[];
+};
+
+// the smallest block, a message with a few covers fits in one
+static const uint64_t MinBlock = (uint64_t) 1 << 20;
+
+void arena_init(Arena *const arena) {
+    pthread_mutex_init(&arena->lock, NULL);
+    arena->blocks = NULL;
+    arena->capacity = 0;
+    arena->blockNum = 0;
+}
+
+static Block *new_block(const uint64_t size) {
+    Block *const block = (Block *) malloc(sizeof(Block) + size);
+    if (block == NULL) return NULL;
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+void *arena_alloc(Arena *const arena, uint64_t size, const bool zeroed) {
+    const uint64_t align = sizeof(max_align_t);
+    size = (size + align - 1) / align * align;
+
+    pthread_mutex_lock(&arena->lock);
+    Block *block = arena->blocks;
+    if (block == NULL || block->size - block->used < size) {
+        // blocks double so a growing workload only takes a few of them
+        uint64_t blockSize = block == NULL ? MinBlock : block->size * 2;
+        if (blockSize < size) blockSize = size;
+        block = new_block(blockSize);
+        if (block == NULL) {
+            pthread_mutex_unlock(&arena->lock);
+            return NULL;
+        }
+        block->next = arena->blocks;
+        arena->blocks = block;
+        arena->capacity += blockSize;
+        ++(arena->blockNum);
+    }
+    uint8_t *const pointer = (uint8_t *) block->data + block->used;
+    block->used += size;
+    pthread_mutex_unlock(&arena->lock);
+
+    if (zeroed) memset(pointer, 0, size);
+    return pointer;
+}
+
+static void free_blocks(Block *block) {
+    while (block != NULL) {
+        Block *const next = block->next;
+        free(block);
+        block = next;
+    }
+}
+
+void arena_reset(Arena *const arena) {
+    pthread_mutex_lock(&arena->lock);
+    if (arena->blockNum > 1) {
+        // a failed merge keeps the blocks, it only costs the next round some allocations
+        Block *const merged = new_block(arena->capacity);
+        if (merged != NULL) {
+            free_blocks(arena->blocks);
+            arena->blocks = merged;
+            arena->blockNum = 1;
+        }
+    }
+    for (Block *block = arena->blocks; block != NULL; block = block->next) block->used = 0;
+    pthread_mutex_unlock(&arena->lock);
+}
+
+void arena_free(Arena *const arena) {
+    free_blocks(arena->blocks);
+    arena->blocks = NULL;
+    arena->capacity = 0;
+    arena->blockNum = 0;
+    pthread_mutex_destroy(&arena->lock);
+}
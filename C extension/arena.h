@@ -0,0 +1,30 @@
+#ifndef STEGANO_ARENA_H
+#define STEGANO_ARENA_H
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+
+typedef struct Block Block;
+
+// a bump allocator made of blocks, nothing is freed on its own but everything goes at once on reset
+// allocations may come from pool workers, so they take the lock
+typedef struct Arena {
+    pthread_mutex_t lock;
+    Block *blocks;  // the block being filled first
+    uint64_t capacity;  // the bytes in all blocks
+    uint64_t blockNum;
+} Arena;
+
+void arena_init(Arena *arena);
+
+// NULL when a new block can't be allocated
+void *arena_alloc(Arena *arena, uint64_t size, bool zeroed);
+
+// forgets every allocation, blocks that piled up are merged into one that holds them all
+// so the next round of the same size fits without allocating
+void arena_reset(Arena *arena);
+
+void arena_free(Arena *arena);
+
+#endif
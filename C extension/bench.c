@@ -0,0 +1,241 @@
+#include "library.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+// every phase of a precompute, embed and extract cycle, timed on its own, and probing and extracting the cover
+// before it, which has no payload to find
+typedef enum Phase {
+    PhaseCopy, PhaseGenerate, PhaseCount, PhaseEmbed, PhaseExtract, PhaseProbe, PhaseExtractClean, PhaseNum
+} Phase;
+
+static const char *const PhaseNames[] = {"copy_image", "generate_squares", "count_images", "embed", "extract",
+                                         "probe", "extract_clean"};
+
+typedef struct Case {
+    uint64_t megapixels, w, h, c;
+    double fill;  // the share of the capacity the payload takes
+    uint64_t threads;
+    uint64_t payload;
+} Case;
+
+typedef struct Options {
+    bool json;
+    uint64_t maxMegapixels;
+    uint64_t repeat;
+    FILE *output;
+} Options;
+
+static const uint64_t MEGAPIXELS[] = {1, 4, 16, 100};
+static const uint64_t CHANNELS[] = {1, 3, 4};
+static const double FILLS[] = {0.1, 0.5, 0.9};
+
+// monotonic, phases are differences of two readings
+static double now(void) {
+#ifdef _WIN32
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (double) counter.QuadPart / (double) frequency.QuadPart;
+#else
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double) time.tv_sec + (double) time.tv_nsec / 1e9;
+#endif
+}
+
+// xorshift, rand() is far too slow for a hundred megapixels
+static void randFill(uint8_t *const data, const uint64_t len, uint64_t state) {
+    for (uint64_t i = 0; i < len; ++i) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        data[i] = (uint8_t) (state >> 24);
+    }
+}
+
+// 4:3 covers, both sides a multiple of the square size
+static Case makeCase(const uint64_t megapixels, const uint64_t c, const double fill, const uint64_t threads) {
+    const double pixels = (double) megapixels * 1e6;
+    const uint64_t w = (uint64_t) sqrt(pixels * 4 / 3) / SquareSize * SquareSize;
+    const uint64_t h = (uint64_t) (pixels / (double) w) / SquareSize * SquareSize;
+    return (Case) {megapixels, w, h, c, fill, threads, 0};
+}
+
+// runs a whole cycle and keeps the fastest time of each phase, false if any phase failed
+static bool runCase(Case *const benchCase, const uint64_t repeat, double *const best) {
+    const uint64_t reserved = 64;
+    const uint64_t size = benchCase->w * benchCase->h * benchCase->c;
+    uint8_t *const pixels = (uint8_t *) malloc(size);
+    if (pixels == NULL) return false;
+    randFill(pixels, size, 0x9E3779B97F4A7C15 ^ size);
+
+    Image source = {benchCase->w, benchCase->h, benchCase->c, pixels, {NULL, 0}, 0, false, 0, 0};
+    // every square but the header's, less the reserved area
+    const uint64_t capacity = (benchCase->w / SquareSize) * (benchCase->h / SquareSize) - 1;
+    benchCase->payload = (uint64_t) ((double) (capacity * square_len(&source) - reserved) * benchCase->fill);
+    set_threads(benchCase->threads);
+
+    Data payload = {(uint8_t *) malloc(benchCase->payload + reserved), benchCase->payload + reserved, false};
+    if (payload.data == NULL) {
+        free(pixels);
+        return false;
+    }
+    randFill(payload.data, payload.len, 0xD1B54A32D192ED03);
+
+    bool succeeded = true;
+    for (uint64_t i = 0; i < PhaseNum; ++i) best[i] = INFINITY;
+    for (uint64_t run = 0; run < repeat && succeeded; ++run) {
+        double times[PhaseNum];
+        ImageList imageList = {&source, 1, false};
+
+        double start = now();
+        const Probed probed = probe(source, reserved);
+        times[PhaseProbe] = now() - start;
+        succeeded = probed.code == OK && !probed.present;
+
+        start = now();
+        const Extracted clean = extract_inplace(source, reserved);
+        times[PhaseExtractClean] = now() - start;
+        succeeded = succeeded && clean.code == InvalidLen;
+        free_extracted(clean);
+
+        start = now();
+        succeeded = succeeded && copy_imageList(&imageList) == OK;
+        times[PhaseCopy] = now() - start;
+        if (!succeeded) break;
+
+        start = now();
+        succeeded = generate_squares(imageList.images, reserved) == OK;
+        times[PhaseGenerate] = now() - start;
+
+        start = now();
+        succeeded = succeeded && count_images_bulk(&imageList, benchCase->payload, reserved) == OK;
+        prune_images(&imageList);
+        times[PhaseCount] = now() - start;
+        if (!succeeded) {
+            free_imageList(&imageList);
+            break;
+        }
+
+        Precomputed precomputed = {imageList, OK};
+        Data piece = payload;
+        start = now();
+        const Embedded embedded = embed(precomputed, (DataPieces) {&piece, 1});
+        times[PhaseEmbed] = now() - start;
+        succeeded = embedded.code == OK;
+        free_data(&piece);
+
+        start = now();
+        Extracted extracted = extract_inplace(imageList.images[0], reserved);
+        times[PhaseExtract] = now() - start;
+        succeeded = succeeded && extracted.code == OK && extracted.data.len == payload.len &&
+                    memcmp(extracted.data.data, payload.data, payload.len) == 0;
+        free_extracted(extracted);
+        free_imageList(&imageList);
+
+        for (uint64_t i = 0; i < PhaseNum; ++i) best[i] = times[i] < best[i] ? times[i] : best[i];
+    }
+
+    free(payload.data);
+    free(pixels);
+    return succeeded;
+}
+
+// copying, scoring, probing and looking for a payload that isn't there go through every pixel, the other phases
+// only through the payload
+static uint64_t phaseBytes(const Case *const benchCase, const Phase phase) {
+    if (phase == PhaseCopy || phase == PhaseGenerate || phase == PhaseProbe || phase == PhaseExtractClean) {
+        return benchCase->w * benchCase->h * benchCase->c;
+    }
+    return benchCase->payload;
+}
+
+static void printRecord(const Options *const options, const Case *const benchCase, const Phase phase,
+                        const double seconds, const bool first) {
+    const double megabytes = (double) phaseBytes(benchCase, phase) / 1e6;
+    if (options->json) {
+        fprintf(options->output,
+                "%s\n  {\"phase\": \"%s\", \"megapixels\": %" PRIu64 ", \"width\": %" PRIu64 ", \"height\": %" PRIu64
+                ", \"channels\": %" PRIu64 ", \"fill\": %.2f, \"threads\": %" PRIu64 ", \"payload\": %" PRIu64
+                ", \"ms\": %.3f, \"mb_per_s\": %.1f}",
+                first ? "" : ",", PhaseNames[phase], benchCase->megapixels, benchCase->w, benchCase->h,
+                benchCase->c, benchCase->fill, benchCase->threads, benchCase->payload, seconds * 1e3,
+                megabytes / seconds);
+    } else {
+        fprintf(options->output,
+                "%s,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.2f,%" PRIu64 ",%" PRIu64 ",%.3f,%.1f\n",
+                PhaseNames[phase], benchCase->megapixels, benchCase->w, benchCase->h, benchCase->c, benchCase->fill,
+                benchCase->threads, benchCase->payload, seconds * 1e3, megabytes / seconds);
+    }
+}
+
+static int usage(const char *const name) {
+    fprintf(stderr, "usage: %s [--csv | --json] [--max-mp N] [--repeat N] [--output FILE]\n", name);
+    return 2;
+}
+
+int main(const int argc, char **const argv) {
+    Options options = {false, 100, 3, stdout};
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--csv") == 0) options.json = false;
+        else if (strcmp(argv[i], "--json") == 0) options.json = true;
+        else if (strcmp(argv[i], "--max-mp") == 0 && i + 1 < argc)
+            options.maxMegapixels = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+            options.repeat = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            options.output = fopen(argv[++i], "w");
+            if (options.output == NULL) {
+                perror(argv[i]);
+                return 1;
+            }
+        } else return usage(argv[0]);
+    }
+    if (options.repeat == 0) options.repeat = 1;
+
+    // one thread and every thread the machine has
+    const uint64_t threads[] = {1, 0};
+    set_threads(0);
+    const uint64_t cores = get_threads();
+
+    if (options.json) fprintf(options.output, "[");
+    else fprintf(options.output, "phase,megapixels,width,height,channels,fill,threads,payload,ms,mb_per_s\n");
+
+    int failed = 0;
+    bool first = true;
+    for (uint64_t m = 0; m < sizeof(MEGAPIXELS) / sizeof(uint64_t); ++m) {
+        if (MEGAPIXELS[m] > options.maxMegapixels) continue;
+        for (uint64_t c = 0; c < sizeof(CHANNELS) / sizeof(uint64_t); ++c) {
+            for (uint64_t f = 0; f < sizeof(FILLS) / sizeof(double); ++f) {
+                for (uint64_t t = 0; t < 2; ++t) {
+                    if (t == 1 && cores == 1) continue;
+                    Case benchCase = makeCase(MEGAPIXELS[m], CHANNELS[c], FILLS[f], threads[t] ? threads[t] : cores);
+                    double best[PhaseNum];
+                    if (!runCase(&benchCase, options.repeat, best)) {
+                        fprintf(stderr, "bench failed: %" PRIu64 " MP, %" PRIu64 " channels, fill %.2f\n",
+                                benchCase.megapixels, benchCase.c, benchCase.fill);
+                        failed = 1;
+                        continue;
+                    }
+                    for (uint64_t p = 0; p < PhaseNum; ++p, first = false)
+                        printRecord(&options, &benchCase, (Phase) p, best[p], first);
+                    fflush(options.output);
+                }
+            }
+        }
+    }
+
+    if (options.json) fprintf(options.output, "\n]\n");
+    if (options.output != stdout) fclose(options.output);
+    set_threads(0);
+    return failed;
+}
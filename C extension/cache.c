@@ -0,0 +1,196 @@
+#include "cache.h"
+#include "pool.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#define getpid _getpid
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// a cache file is a header of Header words followed by the squares, all of them native uint64_t so it can be
+// mapped and read in place, the file of an image is named after its hash, square size and bits
+// bump Version whenever the layout or the order of squares changes
+static const uint64_t Magic = 0x0043515347455453;  // "STEGSQC" and the version byte on little-endian machines
+static const uint64_t Version = 2;
+
+enum {
+    HeaderMagic, HeaderHash, HeaderW, HeaderH, HeaderC, HeaderSize, HeaderBits, HeaderLen, HeaderWords
+};
+
+// squares whose entropy is scored again when a file is loaded, spread over the list
+#define CheckNum 4
+
+#define DirectoryMax 4096
+#define PathMax (DirectoryMax + 64)
+
+// the directory the files live in, an empty one disabling the cache
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static char directory[DirectoryMax];
+static atomic_bool enabled = false;
+
+// with the process id, a tag so that concurrent writers of the same file don't share a temporary one
+static atomic_uint_fast64_t writes = 0;
+
+uint64_t set_cache(const char *const path) {
+    if (path != NULL && strlen(path) >= DirectoryMax) return BadCachePath;
+    pthread_mutex_lock(&lock);
+    if (path == NULL || path[0] == '\0') {
+        directory[0] = '\0';
+    } else {
+        strcpy(directory, path);
+#ifdef _WIN32
+        _mkdir(directory);
+#else
+        mkdir(directory, 0777);
+#endif
+    }
+    atomic_store(&enabled, directory[0] != '\0');
+    pthread_mutex_unlock(&lock);
+    return OK;
+}
+
+bool cache_enabled(void) {
+    return atomic_load(&enabled);
+}
+
+// false when the cache was disabled in the meantime
+static bool cache_path(char *const path, const uint64_t hash, const Image *const image) {
+    pthread_mutex_lock(&lock);
+    const bool found = directory[0] != '\0';
+    if (found) {
+        snprintf(path, PathMax, "%s/%016" PRIx64 "-%" PRIu64 "-%" PRIu64 ".sqc", directory, hash, square_size(image),
+                 sample_bits(image));
+    }
+    pthread_mutex_unlock(&lock);
+    return found;
+}
+
+// the pixels are hashed in at most ChunkNum chunks in parallel, the chunks only depending on the size
+#define ChunkNum 256
+#define ChunkMin ((uint64_t) 1 << 20)
+
+static const uint64_t LowBits = 0x0101010101010101;
+
+static uint64_t mix(uint64_t hash) {
+    hash *= 0x9E3779B97F4A7C15;
+    return hash ^ (hash >> 29);
+}
+
+static uint64_t load_word(const uint8_t *const data, const uint64_t len, const uint64_t mask) {
+    uint64_t word = 0;
+    memcpy(&word, data, len);
+    return word & mask;
+}
+
+// four independent lanes so the multiplications overlap
+static uint64_t hash_chunk(const uint8_t *const data, const uint64_t len, const uint64_t seed, const uint64_t mask) {
+    uint64_t lanes[4] = {seed, seed ^ 1, seed ^ 2, seed ^ 3};
+    uint64_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        for (uint64_t lane = 0; lane < 4; ++lane)
+            lanes[lane] = mix(lanes[lane] ^ load_word(data + i + lane * 8, 8, mask));
+    }
+    for (; i + 8 <= len; i += 8) lanes[0] = mix(lanes[0] ^ load_word(data + i, 8, mask));
+    if (i < len) lanes[1] = mix(lanes[1] ^ load_word(data + i, len - i, mask));
+    return mix(lanes[0] ^ mix(lanes[1] ^ mix(lanes[2] ^ mix(lanes[3] ^ len))));
+}
+
+typedef struct HashJob {
+    const uint8_t *pixels;
+    uint64_t size, chunk;
+    uint64_t mask;  // the bits of every pixel byte embedding leaves alone
+    uint64_t *hashes;
+} HashJob;
+
+static void hash_task(void *const context, const uint64_t begin, const uint64_t end) {
+    const HashJob *const job = (const HashJob *) context;
+    for (uint64_t i = begin; i < end; ++i) {
+        const uint64_t offset = i * job->chunk;
+        const uint64_t len = job->size - offset < job->chunk ? job->size - offset : job->chunk;
+        job->hashes[i] = hash_chunk(job->pixels + offset, len, i, job->mask);
+    }
+}
+
+uint64_t cover_hash(const Image *const image) {
+    const uint64_t size = image->w * image->h * image->c;
+    uint64_t chunk = (size + ChunkNum - 1) / ChunkNum;
+    chunk = chunk < ChunkMin ? ChunkMin : chunk;
+    uint64_t hashes[ChunkNum];
+    const uint64_t mask = ((uint64_t) 0xFF << sample_bits(image) & 0xFF) * LowBits;
+    HashJob job = {image->pixels, size, chunk, mask, hashes};
+    const uint64_t chunkNum = (size + chunk - 1) / chunk;
+    parallel_for(chunkNum, 1, hash_task, &job);
+
+    uint64_t hash = mix(image->w ^ mix(image->h ^ mix(image->c)));
+    for (uint64_t i = 0; i < chunkNum; ++i) hash = mix(hash ^ hashes[i]);
+    return hash;
+}
+
+static void make_header(uint64_t *const header, const Image *const image, const uint64_t hash) {
+    header[HeaderMagic] = Magic | Version << 56;
+    header[HeaderHash] = hash;
+    header[HeaderW] = image->w;
+    header[HeaderH] = image->h;
+    header[HeaderC] = image->c;
+    header[HeaderSize] = square_size(image);
+    header[HeaderBits] = sample_bits(image);
+    header[HeaderLen] = image->squareList.len;
+}
+
+// a loaded list has to be a strictly ascending order of the image's squares, and a few of them have to score
+// what they claim, anything else is a stale or damaged file
+static bool check_squares(const Image *const image) {
+    const Square *const squares = image->squareList.squares;
+    const uint64_t len = image->squareList.len;
+    for (uint64_t i = 0; i < len; ++i) {
+        if (square_index(squares[i]) >= len || (i != 0 && squares[i - 1] >= squares[i])) return false;
+    }
+    for (uint64_t i = 0; i < CheckNum; ++i) {
+        const Square square = squares[(len - 1) * i / (CheckNum - 1)];
+        if (calc_entropy(image, square_index(square)) != square_entropy(square)) return false;
+    }
+    return true;
+}
+
+bool cache_load(Image *const image, const uint64_t hash) {
+    char path[PathMax];
+    if (image->squareList.squares == NULL || !cache_path(path, hash, image)) return false;
+    FILE *const file = fopen(path, "rb");
+    if (file == NULL) return false;
+
+    uint64_t header[HeaderWords], expected[HeaderWords];
+    make_header(expected, image, hash);
+    const bool loaded = fread(header, sizeof(uint64_t), HeaderWords, file) == HeaderWords &&
+                        memcmp(header, expected, sizeof(header)) == 0 &&
+                        fread(image->squareList.squares, sizeof(Square), image->squareList.len, file) ==
+                        image->squareList.len &&
+                        check_squares(image);
+    fclose(file);
+    return loaded;
+}
+
+void cache_store(const Image *const image, const uint64_t hash) {
+    char path[PathMax], temporary[PathMax + 32];
+    if (image->squareList.squares == NULL || !cache_path(path, hash, image)) return;
+    snprintf(temporary, sizeof(temporary), "%s.%" PRIu64 ".%" PRIu64 ".tmp", path, (uint64_t) getpid(),
+             (uint64_t) atomic_fetch_add(&writes, 1));
+    FILE *const file = fopen(temporary, "wb");
+    if (file == NULL) return;
+
+    // written aside and renamed, a reader never sees half a file
+    uint64_t header[HeaderWords];
+    make_header(header, image, hash);
+    bool written = fwrite(header, sizeof(uint64_t), HeaderWords, file) == HeaderWords &&
+                   fwrite(image->squareList.squares, sizeof(Square), image->squareList.len, file) ==
+                   image->squareList.len;
+    written = fclose(file) == 0 && written;
+    if (!written || rename(temporary, path) != 0) remove(temporary);
+}
@@ -0,0 +1,19 @@
+#ifndef STEGANO_CACHE_H
+#define STEGANO_CACHE_H
+
+#include "library.h"
+
+// a hash of the pixels without the low bits embedding writes to, so a cover and every image embedded into it
+// with the same bits share one
+uint64_t cover_hash(const Image *image);
+
+bool cache_enabled(void);
+
+// fills the squares of an image with the order stored for its hash, square size and bits, false on a miss
+// the list has to be sized for every square of the image already
+bool cache_load(Image *image, uint64_t hash);
+
+// stores the sorted squares of an image, a failure only costs the next call a miss
+void cache_store(const Image *image, uint64_t hash);
+
+#endif
@@ -0,0 +1,311 @@
+#include "library.h"
+#include "pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+// no mapping here, the file is read into memory and written back whole
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// the formats whose pixels can be used as they are stored: binary PGM, PPM and PAM with a maxval of 255,
+// and uncompressed 24 or 32-bit BMP, whose rows are converted to what an RGB decoder would give
+#define HeaderMax 4096
+
+#ifdef _WIN32
+
+static uint8_t *read_file(const char *const path, uint64_t *const len) {
+    FILE *const file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+    uint8_t *map = NULL;
+    if (_fseeki64(file, 0, SEEK_END) == 0) {
+        const int64_t size = _ftelli64(file);
+        rewind(file);
+        map = size > 0 ? (uint8_t *) malloc(size) : NULL;
+        if (map != NULL && fread(map, 1, size, file) != (size_t) size) {
+            free(map);
+            map = NULL;
+        }
+        *len = size;
+    }
+    fclose(file);
+    return map;
+}
+
+static uint8_t *map_file(const char *const path, uint64_t *const len) {
+    return read_file(path, len);
+}
+
+static uint8_t *map_file_copy(const char *const src, const char *const dst, uint64_t *const len,
+                              void **const handle) {
+    uint8_t *const map = read_file(src, len);
+    if (map == NULL) return NULL;
+    FILE *const file = fopen(dst, "wb");
+    if (file == NULL) {
+        free(map);
+        return NULL;
+    }
+    *handle = file;
+    return map;
+}
+
+static bool flush_file(const ImageFile *const file) {
+    FILE *const handle = (FILE *) file->handle;
+    rewind(handle);
+    return fwrite(file->map, 1, file->mapLen, handle) == file->mapLen && fflush(handle) == 0;
+}
+
+static void unmap_file(ImageFile *const file) {
+    if (file->handle != NULL) fclose((FILE *) file->handle);
+    free(file->map);
+}
+
+#else
+
+static uint8_t *map_file(const char *const path, uint64_t *const len) {
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat info;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        *len = info.st_size;
+    }
+    close(fd);
+    return map == MAP_FAILED ? NULL : (uint8_t *) map;
+}
+
+// the destination is sized and mapped shared, embedding then writes straight into the page cache
+static uint8_t *map_file_copy(const char *const src, const char *const dst, uint64_t *const len,
+                              void **const handle) {
+    (void) handle;
+    const uint8_t *const source = map_file(src, len);
+    if (source == NULL) return NULL;
+    void *map = MAP_FAILED;
+    const int fd = open(dst, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd >= 0) {
+        if (ftruncate(fd, (off_t) *len) == 0) map = mmap(NULL, *len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+    }
+    if (map != MAP_FAILED) memcpy(map, source, *len);
+    munmap((void *) source, *len);
+    return map == MAP_FAILED ? NULL : (uint8_t *) map;
+}
+
+static bool flush_file(const ImageFile *const file) {
+    return msync(file->map, file->mapLen, MS_ASYNC) == 0;
+}
+
+static void unmap_file(ImageFile *const file) {
+    munmap(file->map, file->mapLen);
+}
+
+#endif
+
+static bool is_space(const uint8_t byte) {
+    return byte == ' ' || byte == '\t' || byte == '\n' || byte == '\r' || byte == '\v' || byte == '\f';
+}
+
+// the next decimal of a PNM header, skipping whitespace and comments
+static bool pnm_number(const uint8_t *const map, const uint64_t len, uint64_t *const position,
+                       uint64_t *const value) {
+    uint64_t i = *position;
+    for (;;) {
+        while (i < len && is_space(map[i])) ++i;
+        if (i >= len || map[i] != '#') break;
+        while (i < len && map[i] != '\n') ++i;
+    }
+    if (i >= len || map[i] < '0' || map[i] > '9') return false;
+    *value = 0;
+    for (; i < len && map[i] >= '0' && map[i] <= '9'; ++i) {
+        if (*value > UINT32_MAX) return false;
+        *value = *value * 10 + (map[i] - '0');
+    }
+    *position = i;
+    return true;
+}
+
+static bool parse_pnm(ImageFile *const file) {
+    const uint8_t *const map = file->map;
+    uint64_t position = 2, w, h, maxval;
+    file->image.c = map[1] == '5' ? 1 : 3;
+    if (!pnm_number(map, file->mapLen, &position, &w) || !pnm_number(map, file->mapLen, &position, &h) ||
+        !pnm_number(map, file->mapLen, &position, &maxval)) {
+        return false;
+    }
+    // exactly one whitespace byte separates the header from the pixels
+    if (maxval != 255 || position >= file->mapLen || !is_space(map[position])) return false;
+    file->image.w = w;
+    file->image.h = h;
+    file->offset = position + 1;
+    return true;
+}
+
+// the value of a PAM header line of len bytes if it starts with key
+static bool pam_field(const uint8_t *const line, const uint64_t len, const char *const key, uint64_t *const value) {
+    const uint64_t keyLen = strlen(key);
+    if (len <= keyLen || memcmp(line, key, keyLen) != 0 || !is_space(line[keyLen])) return false;
+    uint64_t position = keyLen;
+    return pnm_number(line, len, &position, value);
+}
+
+static bool parse_pam(ImageFile *const file) {
+    const uint8_t *const map = file->map;
+    const uint64_t len = file->mapLen < HeaderMax ? file->mapLen : HeaderMax;
+    uint64_t w = 0, h = 0, depth = 0, maxval = 0;
+    for (uint64_t begin = 3; begin < len;) {
+        uint64_t end = begin;
+        while (end < len && map[end] != '\n') ++end;
+        if (end >= len) return false;
+        const uint8_t *const line = map + begin;
+        const uint64_t lineLen = end - begin;
+        if (lineLen == 6 && memcmp(line, "ENDHDR", 6) == 0) {
+            if (maxval != 255 || depth == 0 || depth > 4) return false;
+            file->image.w = w;
+            file->image.h = h;
+            file->image.c = depth;
+            file->offset = end + 1;
+            return true;
+        }
+        // TUPLTYPE and comments are left alone, the channels are whatever DEPTH says
+        pam_field(line, lineLen, "WIDTH", &w);
+        pam_field(line, lineLen, "HEIGHT", &h);
+        pam_field(line, lineLen, "DEPTH", &depth);
+        pam_field(line, lineLen, "MAXVAL", &maxval);
+        begin = end + 1;
+    }
+    return false;
+}
+
+static uint64_t read_le(const uint8_t *const data, const uint64_t len) {
+    uint64_t value = 0;
+    for (uint64_t i = 0; i < len; ++i) value |= (uint64_t) data[i] << i * 8;
+    return value;
+}
+
+static bool parse_bmp(ImageFile *const file) {
+    const uint8_t *const map = file->map;
+    if (file->mapLen < 54 || read_le(map + 14, 4) < 40) return false;
+    const uint64_t bpp = read_le(map + 28, 2);
+    const int32_t w = (int32_t) read_le(map + 18, 4), h = (int32_t) read_le(map + 22, 4);
+    // BI_RGB only, the fourth byte of a 32-bit pixel is padding like a decoder treats it
+    if ((bpp != 24 && bpp != 32) || read_le(map + 30, 4) != 0 || w <= 0 || h == 0 || h == INT32_MIN) return false;
+    file->image.w = w;
+    file->image.h = h < 0 ? -(int64_t) h : h;
+    file->image.c = 3;
+    file->offset = read_le(map + 10, 4);
+    file->depth = bpp / 8;
+    file->stride = (file->image.w * bpp + 31) / 32 * 4;
+    file->bottomUp = h > 0;
+    file->bmp = true;
+    return true;
+}
+
+typedef struct RowJob {
+    ImageFile *file;
+    bool store;  // from the image back into the file
+} RowJob;
+
+static void row_task(void *const context, const uint64_t begin, const uint64_t end) {
+    const RowJob *const job = (const RowJob *) context;
+    const ImageFile *const file = job->file;
+    const Image *const image = &file->image;
+    for (uint64_t row = begin; row < end; ++row) {
+        const uint64_t stored = file->bottomUp ? image->h - 1 - row : row;
+        uint8_t *const data = file->map + file->offset + stored * file->stride;
+        uint8_t *const pixels = image->pixels + row * image->w * 3;
+        // BGR in the file, RGB in the image
+        for (uint64_t x = 0; x < image->w; ++x) {
+            uint8_t *const from = job->store ? pixels + x * 3 : data + x * file->depth;
+            uint8_t *const to = job->store ? data + x * file->depth : pixels + x * 3;
+            to[0] = from[2];
+            to[1] = from[1];
+            to[2] = from[0];
+        }
+    }
+}
+
+// finds the pixels of a mapped file, copying the rows of a BMP
+static uint64_t parse_image(ImageFile *const file) {
+    const uint8_t *const map = file->map;
+    bool parsed = false;
+    if (file->mapLen >= 3 && map[0] == 'P' && (map[1] == '5' || map[1] == '6')) {
+        parsed = parse_pnm(file);
+    } else if (file->mapLen >= 3 && memcmp(map, "P7\n", 3) == 0) {
+        parsed = parse_pam(file);
+    } else if (file->mapLen >= 2 && map[0] == 'B' && map[1] == 'M') {
+        parsed = parse_bmp(file);
+    }
+    // no image can hold more pixel bytes than its file, which also keeps the sizes below from overflowing
+    if (!parsed || file->image.w == 0 || file->image.h == 0 ||
+        file->image.w > file->mapLen / file->image.h / file->image.c) {
+        return BadImageFile;
+    }
+
+    const uint64_t size = file->image.w * file->image.h * file->image.c;
+    if (!file->bmp) {
+        file->depth = file->image.c;
+        file->stride = file->image.w * file->image.c;
+        if (file->offset > file->mapLen || file->mapLen - file->offset < size) return BadImageFile;
+        file->image.pixels = file->map + file->offset;
+        return OK;
+    }
+    const uint64_t rows = file->stride * (file->image.h - 1) + file->image.w * file->depth;
+    if (file->offset > file->mapLen || file->mapLen - file->offset < rows) return BadImageFile;
+    file->image.pixels = (uint8_t *) malloc(size);
+    if (file->image.pixels == NULL) return AllocationFailure;
+    RowJob job = {file, false};
+    parallel_for(file->image.h, 64, row_task, &job);
+    return OK;
+}
+
+static ImageFile open_file(ImageFile file) {
+    file.code = parse_image(&file);
+    if (file.code != OK) unmap_image(&file);
+    return file;
+}
+
+ImageFile map_image(const char *const path) {
+    ImageFile file = {.code = BadImageFile};
+    file.map = map_file(path, &file.mapLen);
+    if (file.map == NULL) return file;
+    return open_file(file);
+}
+
+ImageFile map_image_copy(const char *const src, const char *const dst) {
+    ImageFile file = {.code = BadImageFile};
+    file.map = map_file_copy(src, dst, &file.mapLen, &file.handle);
+    if (file.map == NULL) return file;
+    file.writable = true;
+    return open_file(file);
+}
+
+uint64_t sync_image(ImageFile *const file) {
+    if (file->code != OK || !file->writable) return BadImageFile;
+    if (file->bmp) {
+        RowJob job = {file, true};
+        parallel_for(file->image.h, 64, row_task, &job);
+    }
+    return flush_file(file) ? OK : BadImageFile;
+}
+
+void unmap_image(ImageFile *const file) {
+    if (file->map != NULL) unmap_file(file);
+    if (file->bmp) free(file->image.pixels);
+    const uint64_t code = file->code;
+    *file = (ImageFile) {.code = code};
+}
+
+Extracted extract_file(const char *const path, const uint64_t reserved) {
+    ImageFile file = map_image(path);
+    if (file.code != OK) return (Extracted) {{NULL, 0, false}, file.code};
+    const Extracted extracted = extract_inplace(file.image, reserved);
+    unmap_image(&file);
+    return extracted;
+}
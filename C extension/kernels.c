@@ -0,0 +1,235 @@
+#include "kernels.h"
+#include "library.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define STEGANO_X86
+#include <immintrin.h>
+#endif
+
+const uint64_t
+        KernelScalar = 0,
+        KernelPortable = 1,
+        KernelSSE2 = 2,
+        KernelAVX2 = 3;
+
+static void embed_bits_scalar(uint8_t *pixels, const uint8_t *const data, const uint64_t len) {
+    for (uint64_t index = 0; index < len; ++index) {
+        for (uint64_t bit = 0; bit < 8; ++bit, ++pixels) {
+            *pixels &= (uint8_t) 0b11111110;
+            *pixels |= (uint8_t) ((data[index] & (1 << bit)) >> bit);
+        }
+    }
+}
+
+static void extract_bits_scalar(const uint8_t *pixels, uint8_t *const data, const uint64_t len) {
+    for (uint64_t index = 0; index < len; ++index) {
+        uint8_t byte = 0;
+        for (uint64_t bit = 0; bit < 8; ++bit, ++pixels) byte |= (*pixels & 1) << bit;
+        data[index] = byte;
+    }
+}
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+
+// the SWAR tricks below rely on pixel i being byte i of a uint64_t
+#define embed_bits_portable embed_bits_scalar
+#define extract_bits_portable extract_bits_scalar
+
+#else
+
+static const uint64_t LowBits = 0x0101010101010101;
+
+static void embed_bits_portable(uint8_t *pixels, const uint8_t *const data, const uint64_t len) {
+    for (uint64_t index = 0; index < len; ++index, pixels += 8) {
+        // byte i of spread keeps only bit i of the payload byte, then gets normalized to 0 or 1
+        uint64_t spread = (data[index] * LowBits) & 0x8040201008040201;
+        spread = ((spread + 0x7F7F7F7F7F7F7F7F) >> 7) & LowBits;
+        uint64_t word;
+        memcpy(&word, pixels, sizeof(word));
+        word = (word & ~LowBits) | spread;
+        memcpy(pixels, &word, sizeof(word));
+    }
+}
+
+static void extract_bits_portable(const uint8_t *pixels, uint8_t *const data, const uint64_t len) {
+    for (uint64_t index = 0; index < len; ++index, pixels += 8) {
+        uint64_t word;
+        memcpy(&word, pixels, sizeof(word));
+        // the multiplication gathers bit 0 of byte i into bit 56 + i without carries
+        data[index] = (uint8_t) (((word & LowBits) * 0x0102040810204080) >> 56);
+    }
+}
+
+#endif
+
+#ifdef STEGANO_X86
+
+__attribute__((target("sse2")))
+static void embed_bits_sse2(uint8_t *pixels, const uint8_t *data, uint64_t len) {
+    const __m128i select = _mm_set_epi8(
+            -128, 64, 32, 16, 8, 4, 2, 1,
+            -128, 64, 32, 16, 8, 4, 2, 1
+    );
+    const __m128i one = _mm_set1_epi8(1);
+    for (; len >= 2; len -= 2, data += 2, pixels += 16) {
+        uint16_t word;
+        memcpy(&word, data, sizeof(word));
+        // b0 b1 -> 8 x b0, 8 x b1
+        __m128i bits = _mm_cvtsi32_si128(word);
+        bits = _mm_unpacklo_epi8(bits, bits);
+        bits = _mm_unpacklo_epi16(bits, bits);
+        bits = _mm_unpacklo_epi32(bits, bits);
+        bits = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(bits, select), select), one);
+        const __m128i row = _mm_loadu_si128((const __m128i *) pixels);
+        _mm_storeu_si128((__m128i *) pixels, _mm_or_si128(_mm_andnot_si128(one, row), bits));
+    }
+    embed_bits_portable(pixels, data, len);
+}
+
+__attribute__((target("sse2")))
+static void extract_bits_sse2(const uint8_t *pixels, uint8_t *data, uint64_t len) {
+    for (; len >= 2; len -= 2, data += 2, pixels += 16) {
+        // moves every LSB to the sign bit of its byte
+        const __m128i row = _mm_slli_epi16(_mm_loadu_si128((const __m128i *) pixels), 7);
+        const uint32_t mask = (uint32_t) _mm_movemask_epi8(row);
+        data[0] = (uint8_t) mask;
+        data[1] = (uint8_t) (mask >> 8);
+    }
+    extract_bits_portable(pixels, data, len);
+}
+
+__attribute__((target("avx2")))
+static void embed_bits_avx2(uint8_t *pixels, const uint8_t *data, uint64_t len) {
+    const __m256i spread = _mm256_setr_epi8(
+            0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+            2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3
+    );
+    const __m256i select = _mm256_setr_epi8(
+            1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128,
+            1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128
+    );
+    const __m256i one = _mm256_set1_epi8(1);
+    for (; len >= 4; len -= 4, data += 4, pixels += 32) {
+        uint32_t word;
+        memcpy(&word, data, sizeof(word));
+        __m256i bits = _mm256_shuffle_epi8(_mm256_set1_epi32((int) word), spread);
+        bits = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(bits, select), select), one);
+        const __m256i row = _mm256_loadu_si256((const __m256i *) pixels);
+        _mm256_storeu_si256((__m256i *) pixels, _mm256_or_si256(_mm256_andnot_si256(one, row), bits));
+    }
+    embed_bits_sse2(pixels, data, len);
+}
+
+__attribute__((target("avx2")))
+static void extract_bits_avx2(const uint8_t *pixels, uint8_t *data, uint64_t len) {
+    for (; len >= 4; len -= 4, data += 4, pixels += 32) {
+        const __m256i row = _mm256_slli_epi16(_mm256_loadu_si256((const __m256i *) pixels), 7);
+        const uint32_t mask = (uint32_t) _mm256_movemask_epi8(row);
+        memcpy(data, &mask, sizeof(mask));
+    }
+    extract_bits_sse2(pixels, data, len);
+}
+
+#endif
+
+#ifdef __GNUC__
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
+#endif
+
+// the payload as a stream of bits, bits of them going into the low end of each pixel byte
+// a byte count that doesn't end on a whole pixel byte only overwrites the low bits of the last one
+static ALWAYS_INLINE void embed_wide(uint8_t *pixels, const uint8_t *const data, const uint64_t len,
+                                     const uint64_t bits) {
+    const uint8_t mask = (uint8_t) ((1 << bits) - 1);
+    uint64_t buffer = 0, buffered = 0;
+    for (uint64_t index = 0; index < len; ++index) {
+        buffer |= (uint64_t) data[index] << buffered;
+        for (buffered += 8; buffered >= bits; buffered -= bits, buffer >>= bits, ++pixels)
+            *pixels = (uint8_t) ((*pixels & ~mask) | (buffer & mask));
+    }
+    if (buffered != 0) {
+        const uint8_t partial = (uint8_t) ((1 << buffered) - 1);
+        *pixels = (uint8_t) ((*pixels & ~partial) | (buffer & partial));
+    }
+}
+
+static ALWAYS_INLINE void extract_wide(const uint8_t *pixels, uint8_t *const data, const uint64_t len,
+                                       const uint64_t bits) {
+    const uint8_t mask = (uint8_t) ((1 << bits) - 1);
+    uint64_t buffer = 0, buffered = 0;
+    for (uint64_t index = 0; index < len; ++index, buffer >>= 8, buffered -= 8) {
+        for (; buffered < 8; buffered += bits, ++pixels) buffer |= (uint64_t) (*pixels & mask) << buffered;
+        data[index] = (uint8_t) buffer;
+    }
+}
+
+#define WIDE_KERNEL(bits) \
+    static void embed_bits_##bits(uint8_t *const pixels, const uint8_t *const data, const uint64_t len) { \
+        embed_wide(pixels, data, len, bits); \
+    } \
+    static void extract_bits_##bits(const uint8_t *const pixels, uint8_t *const data, const uint64_t len) { \
+        extract_wide(pixels, data, len, bits); \
+    }
+
+WIDE_KERNEL(2)
+WIDE_KERNEL(3)
+WIDE_KERNEL(4)
+
+// indexed by the bits per pixel byte - 2, a single bit goes through the selected kernel
+static const BitKernel WideKernels[] = {
+        {embed_bits_2, extract_bits_2},
+        {embed_bits_3, extract_bits_3},
+        {embed_bits_4, extract_bits_4},
+};
+
+static const BitKernel Kernels[] = {
+        {embed_bits_scalar,   extract_bits_scalar},
+        {embed_bits_portable, extract_bits_portable},
+#ifdef STEGANO_X86
+        {embed_bits_sse2,     extract_bits_sse2},
+        {embed_bits_avx2,     extract_bits_avx2},
+#endif
+};
+
+static const BitKernel *current = NULL;
+static pthread_once_t detected = PTHREAD_ONCE_INIT;
+
+static void detect_kernel(void) {
+    if (current == NULL) current = Kernels + best_kernel();
+}
+
+static bool supports_kernel(const uint64_t kernel) {
+#ifdef STEGANO_X86
+    __builtin_cpu_init();
+    if (kernel == KernelAVX2) return __builtin_cpu_supports("avx2");
+    if (kernel == KernelSSE2) return __builtin_cpu_supports("sse2");
+#endif
+    return kernel == KernelScalar || kernel == KernelPortable;
+}
+
+uint64_t best_kernel(void) {
+    uint64_t kernel = KernelAVX2;
+    while (!supports_kernel(kernel)) --kernel;
+    return kernel;
+}
+
+uint64_t use_kernel(const uint64_t kernel) {
+    if (!supports_kernel(kernel)) return UnsupportedKernel;
+    pthread_once(&detected, detect_kernel);
+    current = Kernels + kernel;
+    return OK;
+}
+
+const BitKernel *bit_kernel(void) {
+    pthread_once(&detected, detect_kernel);
+    return current;
+}
+
+const BitKernel *depth_kernel(const uint64_t bits) {
+    return bits <= 1 ? bit_kernel() : WideKernels + bits - 2;
+}
@@ -0,0 +1,22 @@
+#ifndef STEGANO_KERNELS_H
+#define STEGANO_KERNELS_H
+
+#include <inttypes.h>
+
+// a bit-plane kernel moves whole payload bytes in and out of pixel LSBs
+// each payload byte covers 8 consecutive pixel bytes, the lowest bit first
+typedef struct BitKernel {
+    // writes len bytes of data into the LSBs of len * 8 pixel bytes
+    void (*embed)(uint8_t *pixels, const uint8_t *data, uint64_t len);
+
+    // reads len bytes of data from the LSBs of len * 8 pixel bytes
+    void (*extract)(const uint8_t *pixels, uint8_t *data, uint64_t len);
+} BitKernel;
+
+const BitKernel *bit_kernel(void);
+
+// the kernel moving bits (1 to 4) payload bits per pixel byte, len bytes then covering len * 8 / bits pixel bytes
+// rounded up, only the selected kernel above is vectorized
+const BitKernel *depth_kernel(uint64_t bits);
+
+#endif
@@ -1,23 +1,95 @@
 #include "library.h"
+#include "cache.h"
+#include "kernels.h"
+#include "pool.h"
+#include "stats.h"
 
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
-#include <math.h>
 
 const uint64_t SquareSize = 16;
 
+const uint64_t SelectFewest = 0, SelectPixels = 1;
+
 const uint64_t
         OK = 0,
         AllocationFailure = 1,
         OversizedData = 2,
         BadDataPiecesLen = 3,
         BadPrecomputed = 4,
-        InvalidLen = 5;
+        InvalidLen = 5,
+        UnsupportedKernel = 6,
+        BadSquareSize = 7,
+        BadCachePath = 8,
+        BadBits = 9,
+        BadImageFile = 10,
+        BadCoverIndex = 11,
+        StripFailure = 12,
+        BadChunk = 13,
+        ReassemblyFull = 14;
 
-uint64_t copy_image(Image *const image) {
+// the square sizes a message can use, in the order extraction tries them, a header's size code is the index
+static const uint64_t SquareSizes[] = {16, 8, 32};
+#define SquareSizeNum 3
+
+// the most payload bits a pixel byte can carry
+#define MaxBits 4
+
+// the length header: the payload length in the low LenBits bits, the size code of the squares above them and
+// the bits per pixel byte - 1 above that
+// messages from before square sizes were configurable have code 0, which is SquareSize, and one bit
+#define LenBits 56
+#define LenMask (((uint64_t) 1 << LenBits) - 1)
+#define SizeBits 2
+
+static uint64_t size_code(const uint64_t size) {
+    uint64_t code = 0;
+    while (code < SquareSizeNum && SquareSizes[code] != size) ++code;
+    return code;
+}
+
+uint64_t square_size(const Image *const image) {
+    return image->squareSize == 0 ? SquareSize : image->squareSize;
+}
+
+uint64_t sample_bits(const Image *const image) {
+    return image->bits == 0 ? 1 : image->bits;
+}
+
+uint64_t square_len(const Image *const image) {
+    const uint64_t size = square_size(image);
+    return size * size * image->c * sample_bits(image) / 8;
+}
+
+static bool valid_size(const Image *const image) {
+    return size_code(square_size(image)) != SquareSizeNum;
+}
+
+static bool valid_bits(const Image *const image) {
+    return image->bits <= MaxBits;
+}
+
+// BadSquareSize or BadBits for an image the library can't use, OK otherwise
+static uint64_t check_image(const Image *const image) {
+    if (!valid_size(image)) return BadSquareSize;
+    if (!valid_bits(image)) return BadBits;
+    return OK;
+}
+
+// everything above the length
+static uint64_t header_code(const Image *const image) {
+    return size_code(square_size(image)) | (sample_bits(image) - 1) << SizeBits;
+}
+
+static uint64_t make_header(const Image *const image, const uint64_t len) {
+    return len | header_code(image) << LenBits;
+}
+
+static uint64_t copy_pixels(Image *const image, Collector *const collector) {
     if (image->copied) return OK;
     const uint64_t size = image->w * image->h * image->c;
-    uint8_t *const pixels = (uint8_t *) calloc(size, sizeof(uint8_t));
+    uint8_t *const pixels = (uint8_t *) counted_malloc(collector, size);
     if (pixels == NULL) return AllocationFailure;
     memcpy(pixels, image->pixels, size);
     image->pixels = pixels;
@@ -25,184 +97,681 @@ uint64_t copy_image(Image *const image) {
     return OK;
 }
 
-uint64_t copy_imageList(ImageList *const imageList) {
-    Image *const images = (Image *) calloc(imageList->len, sizeof(Image));
+uint64_t copy_image(Image *const image) {
+    return copy_pixels(image, NULL);
+}
+
+typedef struct CopyJob {
+    Image *images;
+    Collector *collector;
+} CopyJob;
+
+static void copy_task(void *const context, const uint64_t begin, const uint64_t end) {
+    const CopyJob *const job = (const CopyJob *) context;
+    for (uint64_t i = begin; i < end; ++i) {
+        // a failed copy leaves copied unset, which is checked afterwards
+        copy_pixels(job->images + i, job->collector);
+    }
+}
+
+// frees what the library allocated for a list, arena memory waits for the reset instead
+static void release_imageList(ImageList *const imageList, Collector *const collector) {
+    if (!collector_pooled(collector)) {
+        free_imageList(imageList);
+        return;
+    }
+    if (imageList->images == NULL) return;
+    // the caller's own images mustn't keep pointing into the arena
+    for (uint64_t i = 0; !imageList->copied && i < imageList->len; ++i) {
+        imageList->images[i].squareList = (SquareList) {NULL, 0};
+        imageList->images[i].usage = 0;
+    }
+    imageList->images = NULL;
+}
+
+static uint64_t copy_images(ImageList *const imageList, Collector *const collector) {
+    const uint64_t start = collector_clock(collector);
+    Image *const images = (Image *) counted_calloc(collector, imageList->len, sizeof(Image));
     if (images == NULL) return AllocationFailure;
     memcpy(images, imageList->images, imageList->len * sizeof(Image));
+    CopyJob job = {images, collector};
+    parallel_for(imageList->len, 1, copy_task, &job);
     for (uint64_t i = 0; i < imageList->len; ++i) {
-        const uint64_t code = copy_image(images + i);
-        if (code != OK) {
-            free_imageList(imageList);
-            return code;
+        if (!images[i].copied) {
+            ImageList copies = {images, imageList->len, true};
+            release_imageList(&copies, collector);
+            return AllocationFailure;
         }
+        collect(collector, bytesTouched, images[i].w * images[i].h * images[i].c);
     }
     imageList->images = images;
+    imageList->copied = true;
+    collect(collector, copyNs, collector_clock(collector) - start);
     return OK;
 }
 
-void calc_entropy(const Image *const image, Square *const square) {
-    double entropy = 0.;
-    const uint64_t channel = image->c, width = image->w;
-    const uint64_t real_width = width * channel;
-    uint8_t map[128];
-    const uint8_t *start = image->pixels + (square->y * width + square->x) * channel;
+uint64_t copy_imageList(ImageList *const imageList) {
+    return copy_images(imageList, NULL);
+}
+
+// entropy is ranked in fixed point: count * log2(count) is tabulated with EntropyBits fractional bits,
+// computed with integers only so the order of squares is the same on every compiler and CPU
+#define EntropyBits 14
+#define Log2Bits 30
+
+// up to the pixels in the largest square
+static uint32_t NLogN[32 * 32 + 1];
+static pthread_once_t nLogNOnce = PTHREAD_ONCE_INIT;
+
+static uint64_t fixed_log2(uint64_t n) {
+    uint64_t result = 0;
+    while (n >> (result + 1)) ++result;
+    // mantissa in [1, 2) with Log2Bits fractional bits, one fractional bit of the log per squaring
+    uint64_t mantissa = n << (Log2Bits - result);
+    result <<= Log2Bits;
+    for (uint64_t bit = (uint64_t) 1 << (Log2Bits - 1); bit != 0; bit >>= 1) {
+        mantissa = mantissa * mantissa >> Log2Bits;
+        if (mantissa >= (uint64_t) 2 << Log2Bits) {
+            mantissa >>= 1;
+            result |= bit;
+        }
+    }
+    return result;
+}
+
+static void init_nlogn(void) {
+    const uint64_t round = (uint64_t) 1 << (Log2Bits - EntropyBits - 1);
+    for (uint64_t n = 1; n <= 32 * 32; ++n)
+        NLogN[n] = (uint32_t) ((n * fixed_log2(n) + round) >> (Log2Bits - EntropyBits));
+}
+
+static const uint32_t *nlogn_table(void) {
+    pthread_once(&nLogNOnce, init_nlogn);
+    return NLogN;
+}
+
+// the offset of the top left pixel of a square in the pixel buffer
+static uint64_t square_offset(const Image *const image, const uint64_t index) {
+    const uint64_t size = square_size(image);
+    const uint64_t square_w = image->w / size;
+    return ((index / square_w) * image->w + index % square_w) * size * image->c;
+}
+
+// H = log2(N) - sum / N per channel, averaged over the channels and scaled by 12 * SquareSize^2
+// so that squares of every size with 1 to 4 channels stay comparable, up to the rounding of the n*log2(n) table
+static uint64_t entropy_score(const uint32_t *const nLogN, const uint64_t sum, const uint64_t n,
+                              const uint64_t channel) {
+    const uint64_t total = channel * nLogN[n] - sum;
+    return total * 12 * SquareSize * SquareSize / (channel * n);
+}
+
+#ifdef __GNUC__
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
+#endif
+
+// a histogram per channel of the bits embedding leaves alone, the kernels below fix size and channel at compile time
+// so the loops unroll
+static ALWAYS_INLINE uint64_t entropy_of(const uint32_t *const nLogN, const uint8_t *start,
+                                         const uint64_t realWidth, const uint64_t size, const uint64_t channel,
+                                         const uint64_t shift) {
+    // sum of count * log2(count) over all bins of all channels
+    uint64_t sum = 0;
+    uint16_t map[128];
     for (uint64_t c = 0; c < channel; ++c, ++start) {
-        memset(map, 0, 128);
+        memset(map, 0, sizeof(map));
         const uint8_t *y_start = start;
-        for (uint64_t y = 0; y < SquareSize; ++y, y_start += real_width) {
-            const uint8_t *x_start = y_start;
-            for (uint64_t x = 0; x < SquareSize; ++x, x_start += channel) {
-                ++(map[(*x_start) >> 1]);
-            }
-        }
-        for (uint64_t i = 0; i < 128; ++i) {
-            if (map[i] == 0) continue;
-            const double p = (double) map[i] / (double) (SquareSize * SquareSize);
-            entropy += -p * log2(p);
+        for (uint64_t y = 0; y < size; ++y, y_start += realWidth) {
+            for (uint64_t x = 0; x < size; ++x) ++(map[y_start[x * channel] >> shift]);
         }
+        for (uint64_t i = 0; i < (uint64_t) 256 >> shift; ++i) sum += nLogN[map[i]];
+    }
+    return entropy_score(nLogN, sum, size * size, channel);
+}
+
+// any other channel count or size
+static uint64_t entropy_generic(const uint32_t *const nLogN, const uint8_t *const start, const uint64_t realWidth,
+                                const uint64_t size, const uint64_t channel, const uint64_t shift) {
+    return entropy_of(nLogN, start, realWidth, size, channel, shift);
+}
+
+typedef uint64_t (*EntropyKernel)(const uint32_t *nLogN, const uint8_t *start, uint64_t realWidth, uint64_t size,
+                                  uint64_t channel, uint64_t shift);
+
+#define ENTROPY_KERNEL(size, channel) \
+    static uint64_t entropy_##size##_##channel(const uint32_t *const nLogN, const uint8_t *const start, \
+                                               const uint64_t realWidth, const uint64_t s, const uint64_t c, \
+                                               const uint64_t shift) { \
+        (void) s; \
+        (void) c; \
+        return entropy_of(nLogN, start, realWidth, size, channel, shift); \
     }
-    square->entropy = entropy / (double) channel;
+#define ENTROPY_KERNELS(size) \
+    ENTROPY_KERNEL(size, 1) ENTROPY_KERNEL(size, 2) ENTROPY_KERNEL(size, 3) ENTROPY_KERNEL(size, 4)
+
+ENTROPY_KERNELS(8)
+ENTROPY_KERNELS(16)
+ENTROPY_KERNELS(32)
+
+// indexed by size code and channel count - 1
+static const EntropyKernel EntropyKernels[SquareSizeNum][4] = {
+        {entropy_16_1, entropy_16_2, entropy_16_3, entropy_16_4},
+        {entropy_8_1,  entropy_8_2,  entropy_8_3,  entropy_8_4},
+        {entropy_32_1, entropy_32_2, entropy_32_3, entropy_32_4},
+};
+
+// chosen once per image, everything but 1 to 4 channels at the known sizes gets the generic kernel
+static EntropyKernel entropy_kernel(const Image *const image) {
+    const uint64_t code = size_code(square_size(image));
+    if (code == SquareSizeNum || image->c == 0 || image->c > 4) return entropy_generic;
+    return EntropyKernels[code][image->c - 1];
+}
+
+uint64_t calc_entropy(const Image *const image, const uint64_t index) {
+    const uint8_t *const start = image->pixels + square_offset(image, index);
+    return entropy_kernel(image)(nlogn_table(), start, image->w * image->c, square_size(image), image->c,
+                                 sample_bits(image));
 }
 
 int compare_squares(const void *const a, const void *const b) {
-    if (((const Square *) a)->entropy > ((const Square *) b)->entropy) return -1;
-    else if (((const Square *) a)->entropy < ((const Square *) b)->entropy) return 1;
-    return 0;
+    // the words order by entropy first, ties going to the square that comes first in the image
+    const Square first = *(const Square *) a, second = *(const Square *) b;
+    return (first > second) - (first < second);
 }
 
-uint64_t generate_squares(Image *const image, const uint64_t reserved) {
-    const uint64_t square_w = image->w / SquareSize;
-    const uint64_t square_h = image->h / SquareSize;
-    const uint64_t size = square_w * square_h;
-    if (size <= (uint64_t) ceil((double) reserved / (double) ((SquareSize * SquareSize >> 3) * image->c))) return OK;
+// LSD radix sort on the 8-bit digits of the words from firstDigit on, the result ends up in squares
+static void radix_sort(Square *squares, Square *buffer, const uint64_t len, const uint64_t firstDigit) {
+    uint64_t counts[8][256] = {{0}};
+    for (uint64_t i = 0; i < len; ++i) {
+        for (uint64_t digit = firstDigit; digit < 8; ++digit) ++(counts[digit][(squares[i] >> (digit * 8)) & 0xFF]);
+    }
+
+    Square *const output = squares;
+    for (uint64_t digit = firstDigit; digit < 8; ++digit) {
+        uint64_t *const count = counts[digit];
+        // a digit every word shares doesn't move anything
+        if (count[(squares[0] >> (digit * 8)) & 0xFF] == len) continue;
+        for (uint64_t i = 0, sum = 0; i < 256; ++i) {
+            const uint64_t bucket = count[i];
+            count[i] = sum;
+            sum += bucket;
+        }
+        for (uint64_t i = 0; i < len; ++i) buffer[count[(squares[i] >> (digit * 8)) & 0xFF]++] = squares[i];
+        Square *const swap = squares;
+        squares = buffer;
+        buffer = swap;
+    }
+    if (squares != output) memcpy(output, squares, len * sizeof(Square));
+}
+
+// sorts a list, falling back to qsort when the scratch buffer can't be allocated
+// squares have to be in block order: the sort is stable and only looks at the entropy half
+static void sort_squares(Square *const squares, const uint64_t len, const uint64_t firstDigit,
+                         Collector *const collector) {
+    Square *const buffer = (Square *) counted_malloc(collector, len * sizeof(Square));
+    if (buffer == NULL) {
+        qsort(squares, len, sizeof(Square), compare_squares);
+        return;
+    }
+    radix_sort(squares, buffer, len, firstDigit);
+    counted_free(collector, buffer, len * sizeof(Square));
+}
+
+static void select_counted(Square *const squares, const uint64_t len, const uint64_t count,
+                           Collector *const collector) {
+    if (count == 0 || len == 0) return;
+    if (count >= len / 2) {
+        sort_squares(squares, len, 0, collector);
+        return;
+    }
+
+    // quickselect for the count-th best square, the words are unique so the pivot lands in a single spot
+    const uint64_t target = count - 1;
+    uint64_t low = 0, high = len;
+    for (uint64_t depth = 0; high - low > 1; ++depth) {
+        if (depth == 64) {
+            sort_squares(squares + low, high - low, 0, collector);
+            break;
+        }
+        const Square a = squares[low], b = squares[low + (high - low) / 2], c = squares[high - 1];
+        const Square pivot = a < b ? (b < c ? b : (a < c ? c : a)) : (a < c ? a : (b < c ? c : b));
+        uint64_t split = low;
+        for (uint64_t i = low; i < high; ++i) {
+            if (squares[i] >= pivot) continue;
+            const Square swap = squares[i];
+            squares[i] = squares[split];
+            squares[split++] = swap;
+        }
+        for (uint64_t i = split; i < high; ++i) {
+            if (squares[i] != pivot) continue;
+            squares[i] = squares[split];
+            squares[split] = pivot;
+            break;
+        }
+        if (split == target) break;
+        if (target < split) high = split;
+        else low = split + 1;
+    }
+    sort_squares(squares, count, 0, collector);
+}
+
+void select_squares(Square *const squares, const uint64_t len, const uint64_t count) {
+    select_counted(squares, len, count, NULL);
+}
+
+// the squares of a batch of images are computed one row of squares (a strip) at a time
+typedef struct StripJob {
+    Image *images;
+    uint64_t *offsets;  // the first strip of each image, offsets[len] being the total
+    uint64_t len;
+} StripJob;
+
+static void strip_task(void *const context, const uint64_t begin, const uint64_t end) {
+    const StripJob *const job = (const StripJob *) context;
+    uint64_t i = 0;
+    while (job->offsets[i + 1] <= begin) ++i;
+    for (uint64_t strip = begin; strip < end; ++strip) {
+        while (job->offsets[i + 1] <= strip) ++i;
+        Image *const image = job->images + i;
+        const uint64_t size = square_size(image), realWidth = image->w * image->c;
+        const uint64_t square_w = image->w / size;
+        const uint64_t first = (strip - job->offsets[i]) * square_w;
+        const EntropyKernel kernel = entropy_kernel(image);
+        const uint32_t *const nLogN = nlogn_table();
+        const uint64_t shift = sample_bits(image);
+        const uint8_t *const start = image->pixels + square_offset(image, first);
+        Square *const squares = image->squareList.squares;
+        for (uint64_t x = 0; x < square_w; ++x) {
+            const uint64_t entropy = kernel(nLogN, start + x * size * image->c, realWidth, size, image->c, shift);
+            squares[first + x] = make_square(entropy, first + x);
+        }
+    }
+}
+
+typedef struct SortJob {
+    Image *images;
+    Collector *collector;
+} SortJob;
 
-    Square *const squares = (Square *) calloc(size, sizeof(Square));
-    if (squares == NULL) return AllocationFailure;
+static void sort_task(void *const context, const uint64_t begin, const uint64_t end) {
+    const SortJob *const job = (const SortJob *) context;
+    for (uint64_t i = begin; i < end; ++i) {
+        const SquareList list = job->images[i].squareList;
+        // the lists come in block order, only the entropy half needs sorting
+        if (list.squares != NULL) sort_squares(list.squares, list.len, 4, job->collector);
+    }
+}
+
+// the number of squares an image is split into, none when they can't even hold the reserved area
+static uint64_t square_num(const Image *const image, const uint64_t reserved) {
+    const uint64_t squareSize = square_size(image);
+    const uint64_t size = (image->w / squareSize) * (image->h / squareSize);
+    const uint64_t squareLen = square_len(image);
+    return squareLen == 0 || size <= (reserved + squareLen - 1) / squareLen ? 0 : size;
+}
+
+// fills the square lists the images were given, offsets has room for len + 1 strip offsets
+static void score_images(Image *const images, const uint64_t len, uint64_t *const offsets, const bool sorted,
+                         Collector *const collector) {
+    offsets[0] = 0;
+    for (uint64_t i = 0; i < len; ++i) {
+        const Image *const image = images + i;
+        offsets[i + 1] = offsets[i] + (image->squareList.squares == NULL ? 0 : image->h / square_size(image));
+        if (image->squareList.squares == NULL) continue;
+        const uint64_t size = square_size(image);
+        collect(collector, squaresEvaluated, image->squareList.len);
+        collect(collector, bytesTouched, image->squareList.len * size * size * image->c);
+    }
+
+    uint64_t start = collector_clock(collector);
+    StripJob job = {images, offsets, len};
+    parallel_for(offsets[len], 1, strip_task, &job);
+    collect(collector, entropyNs, collector_clock(collector) - start);
+    if (!sorted) return;
 
-    Square *square = squares;
-    for (uint64_t i = 0; i < square_h; ++i) {
-        for (uint64_t j = 0; j < square_w; ++j, ++square) {
-            square->y = i * SquareSize;
-            square->x = j * SquareSize;
-            calc_entropy(image, square);
+    start = collector_clock(collector);
+    SortJob sortJob = {images, collector};
+    parallel_for(len, 1, sort_task, &sortJob);
+    collect(collector, sortNs, collector_clock(collector) - start);
+}
+
+// loads the covers the cache knows, scores the others and stores them once sorted, hits counting the loaded ones
+static uint64_t score_cached(Image *const images, const uint64_t len, uint64_t *const offsets, const bool sorted,
+                             uint64_t *const hits, Collector *const collector) {
+    // the images to score keep pointing to the same square lists
+    Image *const pending = (Image *) counted_malloc(collector, len * (sizeof(Image) + sizeof(uint64_t)));
+    if (pending == NULL) return AllocationFailure;
+    uint64_t *const hashes = (uint64_t *) (pending + len);
+
+    uint64_t start = collector_clock(collector);
+    uint64_t pendingLen = 0;
+    for (uint64_t i = 0; i < len; ++i) {
+        Image *const image = images + i;
+        if (image->squareList.squares == NULL) continue;
+        const uint64_t hash = cover_hash(image);
+        collect(collector, bytesTouched, image->w * image->h * image->c);
+        if (cache_load(image, hash)) {
+            ++(*hits);
+            continue;
         }
+        hashes[pendingLen] = hash;
+        pending[pendingLen++] = *image;
     }
-    qsort(squares, size, sizeof(Square), compare_squares);
+    collect(collector, cacheNs, collector_clock(collector) - start);
+    collect(collector, cacheHits, *hits);
 
-    image->squareList = (SquareList) {
-            squares, size
-    };
+    score_images(pending, pendingLen, offsets, sorted, collector);
 
+    start = collector_clock(collector);
+    for (uint64_t i = 0; sorted && i < pendingLen; ++i) cache_store(pending + i, hashes[i]);
+    collect(collector, cacheNs, collector_clock(collector) - start);
+    counted_free(collector, pending, len * (sizeof(Image) + sizeof(uint64_t)));
     return OK;
 }
 
-uint64_t init_imageList(ImageList *const imageList, const uint64_t reserved) {
+// hits counts the images whose squares came sorted from the cache, whether sorted was asked for or not
+static uint64_t generate_images(Image *const images, const uint64_t len, const uint64_t reserved, const bool sorted,
+                                uint64_t *const hits, Collector *const collector) {
+    uint64_t *const offsets = (uint64_t *) counted_calloc(collector, len + 1, sizeof(uint64_t));
+    if (offsets == NULL) return AllocationFailure;
+
+    for (uint64_t i = 0; i < len; ++i) {
+        Image *const image = images + i;
+        const uint64_t size = square_num(image, reserved);
+        if (size == 0) continue;
+
+        Square *const squares = (Square *) counted_calloc(collector, size, sizeof(Square));
+        if (squares == NULL) {
+            counted_free(collector, offsets, (len + 1) * sizeof(uint64_t));
+            return AllocationFailure;
+        }
+        image->squareList = (SquareList) {
+                squares, size
+        };
+    }
+
+    uint64_t code = OK;
+    *hits = 0;
+    if (cache_enabled()) code = score_cached(images, len, offsets, sorted, hits, collector);
+    else score_images(images, len, offsets, sorted, collector);
+
+    counted_free(collector, offsets, (len + 1) * sizeof(uint64_t));
+    return code;
+}
+
+uint64_t generate_squares(Image *const image, const uint64_t reserved) {
+    uint64_t hits;
+    return generate_images(image, 1, reserved, true, &hits, NULL);
+}
+
+static uint64_t init_images(ImageList *const imageList, const uint64_t reserved, Collector *const collector) {
     uint64_t code;
 
-    code = copy_imageList(imageList);
+    code = copy_images(imageList, collector);
     if (code != OK) return code;
 
-    for (uint64_t i = 0; i < imageList->len; ++i) {
-        code = generate_squares(imageList->images + i, reserved);
-        if (code != OK) {
-            free_imageList(imageList);
-            return code;
-        }
+    uint64_t hits;
+    code = generate_images(imageList->images, imageList->len, reserved, true, &hits, collector);
+    if (code != OK) {
+        release_imageList(imageList, collector);
+        return code;
     }
 
     return OK;
 }
 
-uint64_t count_images(ImageList *const imageList, const uint64_t dataLen, const uint64_t reserved) {
-    const uint64_t imageLen = imageList->len;
-    uint64_t size = 0;
+uint64_t init_imageList(ImageList *const imageList, const uint64_t reserved) {
+    return init_images(imageList, reserved, NULL);
+}
 
-    uint64_t *const squareIndex = (uint64_t *) calloc(imageLen, sizeof(uint64_t));
-    if (squareIndex == NULL) return AllocationFailure;
-    for (uint64_t i = 0; i < imageLen; ++i) {
+// gives every image its header and reserved squares, returns the capacity left after the reserved area
+static uint64_t reserve_squares(ImageList *const imageList, const uint64_t reserved, uint64_t *const squareIndex) {
+    uint64_t size = 0;
+    for (uint64_t i = 0; i < imageList->len; ++i) {
         Image *const image = imageList->images + i;
-        const uint64_t squareLen = SquareSize * SquareSize * image->c / 8;
-        const uint64_t count = (uint64_t) ceil((double) reserved / (double) squareLen);
+        const uint64_t squareLen = square_len(image);
+        const uint64_t count = (reserved + squareLen - 1) / squareLen;
         squareIndex[i] = count + 1;
         image->usage = count;
         size += squareLen * count - reserved;
     }
+    return size;
+}
 
-    const uint64_t squareLen = SquareSize * SquareSize / 8;
-    bool enough = (size >= dataLen);
-    for (; !enough; enough = (size >= dataLen)) {
-        double maxEntropy = 0.;
-        uint64_t maxIndex = 0;
-        Image *maxImage = NULL;
-        for (uint64_t i = 0; i < imageLen; ++i) {
-            Image *const image = imageList->images + i;
-            const Square *const squares = image->squareList.squares;
-            if (squares == NULL) continue;
-            if (squareIndex[i] == image->squareList.len) continue;
-            const double entropy = squares[squareIndex[i]].entropy;
-            if (entropy > maxEntropy) {
-                maxEntropy = entropy;
-                maxIndex = i;
-                maxImage = image;
-            }
-        }
-        if (maxImage == NULL) break;
-        ++(squareIndex[maxIndex]);
-        ++(maxImage->usage);
-        size += squareLen * maxImage->c;
+// whether the next square of image a goes before the next square of image b
+static bool heap_above(const Image *const images, const uint64_t *const squareIndex, const uint64_t a,
+                       const uint64_t b) {
+    const uint64_t first = square_entropy(images[a].squareList.squares[squareIndex[a]]);
+    const uint64_t second = square_entropy(images[b].squareList.squares[squareIndex[b]]);
+    if (first != second) return first > second;
+    return a < b;
+}
+
+static void heap_down(uint64_t *const heap, const uint64_t len, uint64_t i, const Image *const images,
+                      const uint64_t *const squareIndex) {
+    for (;;) {
+        const uint64_t left = 2 * i + 1, right = left + 1;
+        uint64_t top = i;
+        if (left < len && heap_above(images, squareIndex, heap[left], heap[top])) top = left;
+        if (right < len && heap_above(images, squareIndex, heap[right], heap[top])) top = right;
+        if (top == i) return;
+        const uint64_t swap = heap[i];
+        heap[i] = heap[top];
+        heap[top] = swap;
+        i = top;
+    }
+}
+
+// whether an image still has a square worth using, squares without entropy never are
+static bool has_next(const Image *const image, const uint64_t index) {
+    return image->squareList.squares != NULL && index < image->squareList.len &&
+           square_entropy(image->squareList.squares[index]) != 0;
+}
+
+uint64_t count_images(ImageList *const imageList, const uint64_t dataLen, const uint64_t reserved) {
+    const uint64_t imageLen = imageList->len;
+    Image *const images = imageList->images;
+
+    uint64_t *const squareIndex = (uint64_t *) calloc(2 * imageLen, sizeof(uint64_t));
+    if (squareIndex == NULL) return AllocationFailure;
+    uint64_t size = reserve_squares(imageList, reserved, squareIndex);
+
+    // a k-way merge of the sorted square lists, each image being in the heap with its next free square
+    uint64_t *const heap = squareIndex + imageLen;
+    uint64_t heapLen = 0;
+    for (uint64_t i = 0; i < imageLen; ++i) {
+        if (has_next(images + i, squareIndex[i])) heap[heapLen++] = i;
+    }
+    for (uint64_t i = heapLen / 2; i-- > 0;) heap_down(heap, heapLen, i, images, squareIndex);
+
+    while (size < dataLen && heapLen != 0) {
+        const uint64_t i = heap[0];
+        Image *const image = images + i;
+        ++(squareIndex[i]);
+        ++(image->usage);
+        size += square_len(image);
+        if (!has_next(image, squareIndex[i])) heap[0] = heap[--heapLen];
+        heap_down(heap, heapLen, 0, images, squareIndex);
     }
     free(squareIndex);
-    if (!enough) return OversizedData;
+    if (size < dataLen) return OversizedData;
 
     return OK;
 }
 
-void prune_images(ImageList *const imageList) {
+// the number of squares from start on with at least the given entropy, the squares being sorted
+static uint64_t count_above(const Image *const image, const uint64_t start, const uint64_t entropy) {
+    const Square *const squares = image->squareList.squares;
+    if (squares == NULL || start >= image->squareList.len) return 0;
+    uint64_t low = start, high = image->squareList.len;
+    while (low < high) {
+        const uint64_t middle = low + (high - low) / 2;
+        if (square_entropy(squares[middle]) >= entropy) low = middle + 1;
+        else high = middle;
+    }
+    return low - start;
+}
+
+// the capacity of all free squares with at least the given entropy
+static uint64_t capacity_above(const ImageList *const imageList, const uint64_t *const squareIndex,
+                               const uint64_t entropy) {
+    uint64_t size = 0;
+    for (uint64_t i = 0; i < imageList->len; ++i) {
+        const Image *const image = imageList->images + i;
+        size += count_above(image, squareIndex[i], entropy) * (square_len(image));
+    }
+    return size;
+}
+
+static uint64_t count_bulk(ImageList *const imageList, const uint64_t dataLen, const uint64_t reserved,
+                           Collector *const collector) {
+    const uint64_t imageLen = imageList->len;
+    Image *const images = imageList->images;
+
+    uint64_t *const squareIndex = (uint64_t *) counted_calloc(collector, imageLen, sizeof(uint64_t));
+    if (squareIndex == NULL) return AllocationFailure;
+    uint64_t size = reserve_squares(imageList, reserved, squareIndex);
+    if (size >= dataLen) {
+        counted_free(collector, squareIndex, imageLen * sizeof(uint64_t));
+        return OK;
+    }
+
+    uint64_t low = 1, high = 0;
+    for (uint64_t i = 0; i < imageLen; ++i) {
+        if (!has_next(images + i, squareIndex[i])) continue;
+        const uint64_t entropy = square_entropy(images[i].squareList.squares[squareIndex[i]]);
+        if (entropy > high) high = entropy;
+    }
+    if (high == 0 || size + capacity_above(imageList, squareIndex, 1) < dataLen) {
+        for (uint64_t i = 0; i < imageLen; ++i) images[i].usage += count_above(images + i, squareIndex[i], 1);
+        counted_free(collector, squareIndex, imageLen * sizeof(uint64_t));
+        return OversizedData;
+    }
+
+    // the entropy of the last square the merge would take: the highest cutoff that still holds the data
+    while (low < high) {
+        const uint64_t middle = low + (high - low + 1) / 2;
+        if (size + capacity_above(imageList, squareIndex, middle) >= dataLen) low = middle;
+        else high = middle - 1;
+    }
+
+    // everything above the cutoff fits, the squares at the cutoff go by image order like in the merge
+    for (uint64_t i = 0; i < imageLen; ++i) {
+        Image *const image = images + i;
+        const uint64_t count = count_above(image, squareIndex[i], low + 1);
+        squareIndex[i] += count;
+        image->usage += count;
+        size += count * (square_len(image));
+    }
+    for (uint64_t i = 0; i < imageLen && size < dataLen; ++i) {
+        Image *const image = images + i;
+        const uint64_t squareLen = square_len(image);
+        const uint64_t needed = (dataLen - size + squareLen - 1) / squareLen;
+        const uint64_t available = count_above(image, squareIndex[i], low);
+        const uint64_t count = needed < available ? needed : available;
+        image->usage += count;
+        size += count * squareLen;
+    }
+    counted_free(collector, squareIndex, imageLen * sizeof(uint64_t));
+
+    return OK;
+}
+
+uint64_t count_images_bulk(ImageList *const imageList, const uint64_t dataLen, const uint64_t reserved) {
+    return count_bulk(imageList, dataLen, reserved, NULL);
+}
+
+// a list that can't be shrunk just keeps its tail, nor is one from an arena where nothing would be given back
+static void prune(ImageList *const imageList, Collector *const collector) {
+    if (collector_pooled(collector)) return;
     const uint64_t imageLen = imageList->len;
     for (uint64_t i = 0; i < imageLen; ++i) {
         Image *const image = imageList->images + i;
         if (image->usage + 1 < image->squareList.len) {
-            Square *squares = (Square *) calloc(image->usage + 1, sizeof(Square));
+            Square *squares = (Square *) counted_calloc(collector, image->usage + 1, sizeof(Square));
+            if (squares == NULL) continue;
             memcpy(squares, image->squareList.squares, (image->usage + 1) * sizeof(Square));
-            free(image->squareList.squares);
-            image->squareList.len = image->usage + i;
+            counted_free(collector, image->squareList.squares, image->squareList.len * sizeof(Square));
+            image->squareList.len = image->usage + 1;
             image->squareList.squares = squares;
         }
     }
 }
 
-Precomputed precompute(ImageList imageList, const uint64_t dataLen, const uint64_t reserved) {
+void prune_images(ImageList *const imageList) {
+    prune(imageList, NULL);
+}
+
+static Precomputed precompute_images(ImageList imageList, const uint64_t dataLen, const uint64_t reserved,
+                                     const bool inplace, Collector *const collector) {
     uint64_t code;
 
-    code = init_imageList(&imageList, reserved);
+    if (dataLen > LenMask) return (Precomputed) {{NULL, 0, false}, OversizedData};
+    for (uint64_t i = 0; i < imageList.len; ++i) {
+        code = check_image(imageList.images + i);
+        if (code != OK) return (Precomputed) {{NULL, 0, false}, code};
+    }
+
+    uint64_t hits;
+    if (inplace) code = generate_images(imageList.images, imageList.len, reserved, true, &hits, collector);
+    else code = init_images(&imageList, reserved, collector);
     if (code != OK) {
-        free_imageList(&imageList);
-        return (Precomputed) {{NULL, 0}, code};
+        release_imageList(&imageList, collector);
+        return (Precomputed) {{NULL, 0, false}, code};
     }
 
-    code = count_images(&imageList, dataLen, reserved);
+    const uint64_t start = collector_clock(collector);
+    code = count_bulk(&imageList, dataLen, reserved, collector);
     if (code != OK) {
-        free_imageList(&imageList);
-        return (Precomputed) {{NULL, 0}, code};
+        release_imageList(&imageList, collector);
+        return (Precomputed) {{NULL, 0, false}, code};
     }
 
-    prune_images(&imageList);
+    prune(&imageList, collector);
+    collect(collector, allocateNs, collector_clock(collector) - start);
+    for (uint64_t i = 0; i < imageList.len; ++i) {
+        const Image *const image = imageList.images + i;
+        collect(collector, squaresUsed, image->squareList.squares == NULL ? 0 : image->usage + 1);
+    }
 
     return (Precomputed) {imageList, OK};
 }
 
+Precomputed precompute(const ImageList imageList, const uint64_t dataLen, const uint64_t reserved) {
+    return precompute_images(imageList, dataLen, reserved, false, NULL);
+}
+
+Precomputed precompute_inplace(const ImageList imageList, const uint64_t dataLen, const uint64_t reserved) {
+    return precompute_images(imageList, dataLen, reserved, true, NULL);
+}
+
+Precomputed precompute_stats(const ImageList imageList, const uint64_t dataLen, const uint64_t reserved,
+                             const bool inplace, Stats *const stats) {
+    Collector storage;
+    Collector *const collector = collector_begin(&storage, stats, NULL);
+    const Precomputed precomputed = precompute_images(imageList, dataLen, reserved, inplace, collector);
+    collector_end(collector);
+    return precomputed;
+}
+
 void free_image(Image *const image) {
-    if (!image->copied) return;
-    free(image->pixels);
+    // squares always come from the library, pixels only when they were copied
     free(image->squareList.squares);
-    *image = (Image) {0, 0, 0, NULL, {NULL, 0}, 0, false};
+    if (image->copied) {
+        free(image->pixels);
+        *image = (Image) {0, 0, 0, NULL, {NULL, 0}, 0, false, 0, 0};
+    } else {
+        image->squareList = (SquareList) {NULL, 0};
+        image->usage = 0;
+    }
 }
 
 void free_imageList(ImageList *const imageList) {
     if (imageList->images == NULL) return;
     const uint64_t len = imageList->len;
     for (uint64_t i = 0; i < len; ++i) free_image(imageList->images + i);
-    free(imageList->images);
+    if (imageList->copied) free(imageList->images);
     imageList->images = NULL;
 }
 
@@ -210,15 +779,16 @@ void free_precomputed(Precomputed precomputed) {
     free_imageList(&precomputed.imageList);
 }
 
-void embed_len(Image *const image, const Square *const square, const uint64_t len) {
+void embed_len_scalar(Image *const image, const Square square, const uint64_t len) {
+    const uint64_t size = square_size(image);
     const uint64_t channel = image->c;
     const uint64_t realWidth = image->w * channel;;
     uint8_t *const data = (uint8_t *) &len;
     uint64_t index = 0, bit = 0;
-    uint8_t *yStart = image->pixels + (square->y * image->w + square->x) * channel;
-    for (uint64_t y = 0; y < SquareSize; ++y, yStart += realWidth) {
+    uint8_t *yStart = image->pixels + square_offset(image, square_index(square));
+    for (uint64_t y = 0; y < size; ++y, yStart += realWidth) {
         uint8_t *xStart = yStart;
-        for (uint64_t x = 0; x < SquareSize; ++x) {
+        for (uint64_t x = 0; x < size; ++x) {
             for (uint64_t c = 0; c < channel; ++c, ++xStart) {
                 *xStart &= (uint8_t) 0b11111110;
                 *xStart |= (uint8_t) ((data[index] & (1 << bit)) >> bit);
@@ -231,14 +801,15 @@ void embed_len(Image *const image, const Square *const square, const uint64_t le
     }
 }
 
-void embed_square(Image *const image, const Square *const square, const uint8_t *const data) {
+void embed_square_scalar(Image *const image, const Square square, const uint8_t *const data) {
+    const uint64_t size = square_size(image);
     const uint64_t channel = image->c;
     const uint64_t realWidth = image->w * channel;
     uint64_t index = 0, bit = 0;
-    uint8_t *yStart = image->pixels + (square->y * image->w + square->x) * channel;
-    for (uint64_t y = 0; y < SquareSize; ++y, yStart += realWidth) {
+    uint8_t *yStart = image->pixels + square_offset(image, square_index(square));
+    for (uint64_t y = 0; y < size; ++y, yStart += realWidth) {
         uint8_t *xStart = yStart;
-        for (uint64_t x = 0; x < SquareSize; ++x) {
+        for (uint64_t x = 0; x < size; ++x) {
             for (uint64_t c = 0; c < channel; ++c, ++xStart) {
                 *xStart &= (uint8_t) 0b11111110;
                 *xStart |= (uint8_t) ((data[index] & (1 << bit)) >> bit);
@@ -251,23 +822,148 @@ void embed_square(Image *const image, const Square *const square, const uint8_t
     }
 }
 
-void embed_image(Image *const image, const Data *const data) {
-    const uint64_t squareLen = SquareSize * SquareSize * image->c / 8;
-    Square *const squares = image->squareList.squares;
-    embed_len(image, squares, data->len);
-    const uint8_t *dataPtr = data->data;
-    const uint64_t usage = image->usage;
-    for (uint64_t i = 0; i < usage; ++i) {
-        embed_square(image, squares + i + 1, dataPtr);
-        dataPtr += squareLen;
+void embed_len(Image *const image, const Square square, const uint64_t len) {
+    const uint64_t rowLen = square_size(image) * image->c * sample_bits(image) / 8;
+    const uint64_t realWidth = image->w * image->c;
+    const BitKernel *const kernel = depth_kernel(sample_bits(image));
+    const uint8_t *data = (const uint8_t *) &len;
+    uint8_t *yStart = image->pixels + square_offset(image, square_index(square));
+    for (uint64_t remaining = sizeof(uint64_t); remaining != 0; yStart += realWidth) {
+        const uint64_t size = remaining < rowLen ? remaining : rowLen;
+        kernel->embed(yStart, data, size);
+        data += size;
+        remaining -= size;
     }
 }
 
-uint64_t padding(const Image *const image, Data *const data) {
+void embed_square(Image *const image, const Square square, const uint8_t *data) {
+    const uint64_t size = square_size(image);
+    const uint64_t rowLen = size * image->c * sample_bits(image) / 8;
+    const uint64_t realWidth = image->w * image->c;
+    const BitKernel *const kernel = depth_kernel(sample_bits(image));
+    uint8_t *yStart = image->pixels + square_offset(image, square_index(square));
+    for (uint64_t y = 0; y < size; ++y, yStart += realWidth, data += rowLen)
+        kernel->embed(yStart, data, rowLen);
+}
+
+// the squares of a batch of images are embedded in one parallel loop, square 0 of each image holding the length
+// the pieces are either padded Data or segments, which are gathered square by square
+typedef struct EmbedJob {
+    Image *images;
+    const Data *pieces;
+    const Segments *segments;
+    uint64_t *offsets;  // the first square of each image, offsets[len] being the total
+} EmbedJob;
+
+static uint64_t segments_len(const Segments *const segments) {
+    uint64_t len = 0;
+    for (uint64_t i = 0; i < segments->len; ++i) len += segments->segments[i].len;
+    return len;
+}
+
+// the segment holding a byte of a piece and where that segment starts in it
+typedef struct Gather {
+    uint64_t segment, start;
+} Gather;
+
+// the bytes [offset, offset + len) of a piece, read in place when one segment holds them all
+// otherwise they are copied into the buffer, zero past the end of the piece
+static const uint8_t *gather(const Segments *const piece, Gather *const at, const uint64_t offset,
+                             const uint64_t len, uint8_t *const buffer) {
+    if (at->start > offset) *at = (Gather) {0, 0};
+    while (at->segment < piece->len && at->start + piece->segments[at->segment].len <= offset) {
+        at->start += piece->segments[at->segment++].len;
+    }
+    if (at->segment < piece->len && offset + len <= at->start + piece->segments[at->segment].len) {
+        return piece->segments[at->segment].data + (offset - at->start);
+    }
+    uint64_t copied = 0;
+    for (Gather next = *at; copied < len && next.segment < piece->len; ++next.segment) {
+        const Segment segment = piece->segments[next.segment];
+        const uint64_t skip = offset + copied - next.start;
+        const uint64_t size = segment.len - skip < len - copied ? segment.len - skip : len - copied;
+        memcpy(buffer + copied, segment.data + skip, size);
+        copied += size;
+        next.start += segment.len;
+    }
+    memset(buffer + copied, 0, len - copied);
+    return buffer;
+}
+
+// rows are gathered in parts of at most GatherMax bytes, a multiple of every depth so each part starts on a pixel
+#define GatherMax 1536
+
+static void embed_square_segments(Image *const image, const Square square, const Segments *const piece,
+                                  Gather *const at, uint64_t offset) {
+    const uint64_t size = square_size(image), bits = sample_bits(image);
+    const uint64_t rowLen = size * image->c * bits / 8;
+    const uint64_t realWidth = image->w * image->c;
+    const BitKernel *const kernel = depth_kernel(bits);
+    uint8_t buffer[GatherMax];
+    uint8_t *yStart = image->pixels + square_offset(image, square_index(square));
+    for (uint64_t y = 0; y < size; ++y, yStart += realWidth) {
+        for (uint64_t done = 0; done < rowLen; done += GatherMax) {
+            const uint64_t len = rowLen - done < GatherMax ? rowLen - done : GatherMax;
+            kernel->embed(yStart + done * 8 / bits, gather(piece, at, offset, len, buffer), len);
+            offset += len;
+        }
+    }
+}
+
+static void embed_task(void *const context, const uint64_t begin, const uint64_t end) {
+    const EmbedJob *const job = (const EmbedJob *) context;
+    Gather at = {0, 0};
+    uint64_t i = 0;
+    while (job->offsets[i + 1] <= begin) ++i;
+    for (uint64_t index = begin; index < end; ++index) {
+        while (job->offsets[i + 1] <= index) {
+            ++i;
+            at = (Gather) {0, 0};
+        }
+        Image *const image = job->images + i;
+        const Square *const squares = image->squareList.squares;
+        const uint64_t square = index - job->offsets[i];
+        const uint64_t squareLen = square_len(image);
+        if (square == 0) {
+            const uint64_t len = job->pieces != NULL ? job->pieces[i].len : segments_len(job->segments + i);
+            embed_len(image, squares[0], make_header(image, len));
+        } else if (job->pieces != NULL) {
+            embed_square(image, squares[square], job->pieces[i].data + (square - 1) * squareLen);
+        } else {
+            embed_square_segments(image, squares[square], job->segments + i, &at, (square - 1) * squareLen);
+        }
+    }
+}
+
+// only the squares the (padded) data reaches are written
+static uint64_t embedded_squares(const Image *const image, const uint64_t len) {
+    if (image->squareList.squares == NULL) return 0;
+    const uint64_t squareLen = square_len(image);
+    const uint64_t squareNum = len / squareLen + (len % squareLen != 0);
+    return 1 + (squareNum < image->usage ? squareNum : image->usage);
+}
+
+static void embed_images(Image *const images, const Data *const pieces, const Segments *const segments,
+                         uint64_t *const offsets, const uint64_t len) {
+    offsets[0] = 0;
+    for (uint64_t i = 0; i < len; ++i) {
+        const uint64_t pieceLen = pieces != NULL ? pieces[i].len : segments_len(segments + i);
+        offsets[i + 1] = offsets[i] + embedded_squares(images + i, pieceLen);
+    }
+    EmbedJob job = {images, pieces, segments, offsets};
+    parallel_for(offsets[len], 64, embed_task, &job);
+}
+
+void embed_image(Image *const image, const Data *const data) {
+    uint64_t offsets[2];
+    embed_images(image, data, NULL, offsets, 1);
+}
+
+static uint64_t pad(const Image *const image, Data *const data, Collector *const collector) {
     if (data->len == 0 || data->data == NULL || data->padded) return OK;
-    const uint64_t squareLen = SquareSize * SquareSize * image->c / 8;
+    const uint64_t squareLen = square_len(image);
     const uint64_t paddedLen = squareLen * (data->len / squareLen + (data->len % squareLen != 0));
-    uint8_t *const padded = (uint8_t *) calloc(paddedLen, sizeof(uint8_t));
+    uint8_t *const padded = (uint8_t *) counted_calloc(collector, paddedLen, sizeof(uint8_t));
     if (padded == NULL) return AllocationFailure;
     memcpy(padded, data->data, data->len);
     data->data = padded;
@@ -275,6 +971,10 @@ uint64_t padding(const Image *const image, Data *const data) {
     return OK;
 }
 
+uint64_t padding(const Image *const image, Data *const data) {
+    return pad(image, data, NULL);
+}
+
 void free_data(Data *const data) {
     if (data->padded) {
         free(data->data);
@@ -288,37 +988,101 @@ void free_dataPieces(DataPieces *const dataPieces) {
     *dataPieces = (DataPieces) {NULL, 0};
 }
 
-Embedded embed(Precomputed precomputed, DataPieces dataPieces) {
-    if (precomputed.code != OK) return (Embedded) {{NULL, 0}, BadPrecomputed};
+// writes the pieces, padded Data or segments, into the precomputed images and counts what that took
+static uint64_t embed_counted(const Precomputed *const precomputed, const Data *const pieces,
+                              const Segments *const segments, Collector *const collector) {
+    const uint64_t len = precomputed->imageList.len;
+    uint64_t *const offsets = (uint64_t *) counted_calloc(collector, len + 1, sizeof(uint64_t));
+    if (offsets == NULL) return AllocationFailure;
+
+    const uint64_t start = collector_clock(collector);
+    embed_images(precomputed->imageList.images, pieces, segments, offsets, len);
+    collect(collector, bitsNs, collector_clock(collector) - start);
+    for (uint64_t i = 0; i < len; ++i) {
+        const Image *const image = precomputed->imageList.images + i;
+        const uint64_t size = square_size(image), squares = offsets[i + 1] - offsets[i];
+        collect(collector, squaresUsed, squares);
+        collect(collector, bytesTouched, squares * size * size * image->c);
+    }
+
+    counted_free(collector, offsets, (len + 1) * sizeof(uint64_t));
+    return OK;
+}
+
+static Embedded embed_pieces(Precomputed precomputed, DataPieces dataPieces, Collector *const collector) {
+    if (precomputed.code != OK) return (Embedded) {{NULL, 0, false}, BadPrecomputed};
     const uint64_t len = dataPieces.len;
     uint64_t code;
-    if (precomputed.imageList.len != len) return (Embedded) {{NULL, 0}, BadDataPiecesLen};
+    if (precomputed.imageList.len != len) return (Embedded) {{NULL, 0, false}, BadDataPiecesLen};
+    const bool pooled = collector_pooled(collector);
+    if (pooled) {
+        // the padded copies live in the arena, the caller's pieces are left as they were
+        Data *const pieces = (Data *) counted_malloc(collector, len * sizeof(Data));
+        if (pieces == NULL) return (Embedded) {{NULL, 0, false}, AllocationFailure};
+        memcpy(pieces, dataPieces.pieces, len * sizeof(Data));
+        dataPieces.pieces = pieces;
+    }
     for (uint64_t i = 0; i < len; ++i) {
-        Image *const image = precomputed.imageList.images + i;
-        Data *const piece = dataPieces.pieces + i;
-        code = padding(image, piece);
+        code = pad(precomputed.imageList.images + i, dataPieces.pieces + i, collector);
         if (code != OK) {
-            free_dataPieces(&dataPieces);
-            return (Embedded) {{NULL, 0}, AllocationFailure};
+            if (!pooled) free_dataPieces(&dataPieces);
+            return (Embedded) {{NULL, 0, false}, AllocationFailure};
         }
-        embed_image(image, piece);
+    }
+    if (embed_counted(&precomputed, dataPieces.pieces, NULL, collector) != OK) {
+        if (!pooled) free_dataPieces(&dataPieces);
+        return (Embedded) {{NULL, 0, false}, AllocationFailure};
     }
     return precomputed;
 }
 
-uint64_t extract_len(const Image *const image, const Square *const square) {
-    uint64_t len = 0;
-    const uint64_t channel = image->c;
-    const uint64_t realWidth = image->w * channel;;
-    uint8_t *const data = (uint8_t *) &len;
-    uint64_t index = 0, bit = 0;
-    uint8_t *yStart = image->pixels + (square->y * image->w + square->x) * channel;
-    for (uint64_t y = 0; y < SquareSize; ++y, yStart += realWidth) {
-        uint8_t *xStart = yStart;
-        for (uint64_t x = 0; x < SquareSize; ++x) {
-            for (uint64_t c = 0; c < channel; ++c, ++xStart) {
-                data[index] |= (*xStart & 1) << bit;
-                if (++bit == 8) {
+static Embedded embed_gathered(const Precomputed precomputed, const SegmentPieces segmentPieces,
+                               Collector *const collector) {
+    if (precomputed.code != OK) return (Embedded) {{NULL, 0, false}, BadPrecomputed};
+    if (precomputed.imageList.len != segmentPieces.len) return (Embedded) {{NULL, 0, false}, BadDataPiecesLen};
+    const uint64_t code = embed_counted(&precomputed, NULL, segmentPieces.pieces, collector);
+    if (code != OK) return (Embedded) {{NULL, 0, false}, code};
+    return precomputed;
+}
+
+Embedded embed(const Precomputed precomputed, const DataPieces dataPieces) {
+    return embed_pieces(precomputed, dataPieces, NULL);
+}
+
+Embedded embed_stats(const Precomputed precomputed, const DataPieces dataPieces, Stats *const stats) {
+    Collector storage;
+    Collector *const collector = collector_begin(&storage, stats, NULL);
+    const Embedded embedded = embed_pieces(precomputed, dataPieces, collector);
+    collector_end(collector);
+    return embedded;
+}
+
+Embedded embed_segments(const Precomputed precomputed, const SegmentPieces segmentPieces) {
+    return embed_gathered(precomputed, segmentPieces, NULL);
+}
+
+Embedded embed_segments_stats(const Precomputed precomputed, const SegmentPieces segmentPieces, Stats *const stats) {
+    Collector storage;
+    Collector *const collector = collector_begin(&storage, stats, NULL);
+    const Embedded embedded = embed_gathered(precomputed, segmentPieces, collector);
+    collector_end(collector);
+    return embedded;
+}
+
+uint64_t extract_len_scalar(const Image *const image, const Square square) {
+    const uint64_t size = square_size(image);
+    uint64_t len = 0;
+    const uint64_t channel = image->c;
+    const uint64_t realWidth = image->w * channel;;
+    uint8_t *const data = (uint8_t *) &len;
+    uint64_t index = 0, bit = 0;
+    uint8_t *yStart = image->pixels + square_offset(image, square_index(square));
+    for (uint64_t y = 0; y < size; ++y, yStart += realWidth) {
+        uint8_t *xStart = yStart;
+        for (uint64_t x = 0; x < size; ++x) {
+            for (uint64_t c = 0; c < channel; ++c, ++xStart) {
+                data[index] |= (*xStart & 1) << bit;
+                if (++bit == 8) {
                     bit = 0;
                     if (++index == sizeof(uint64_t)) return len;
                 }
@@ -328,13 +1092,14 @@ uint64_t extract_len(const Image *const image, const Square *const square) {
     return len;
 }
 
-void extract_data(const Image *const image, const Square *const square, uint8_t *const data) {
+void extract_data_scalar(const Image *const image, const Square square, uint8_t *const data) {
+    const uint64_t size = square_size(image);
     const uint64_t realWidth = image->w * image->c;
     uint64_t index = 0, bit = 0;
-    uint8_t *yStart = image->pixels + square->y * realWidth + square->x * image->c;
-    for (uint64_t y = 0; y < SquareSize; ++y, yStart += realWidth) {
+    uint8_t *yStart = image->pixels + square_offset(image, square_index(square));
+    for (uint64_t y = 0; y < size; ++y, yStart += realWidth) {
         uint8_t *xStart = yStart;
-        for (uint64_t x = 0; x < SquareSize; ++x) {
+        for (uint64_t x = 0; x < size; ++x) {
             for (uint64_t c = 0; c < image->c; ++c, ++xStart) {
                 data[index] |= (*xStart & 1) << bit;
                 if (++bit == 8) {
@@ -346,39 +1111,1163 @@ void extract_data(const Image *const image, const Square *const square, uint8_t
     }
 }
 
-Extracted extract(Image image, const uint64_t reserved) {
+uint64_t extract_len(const Image *const image, const Square square) {
+    uint64_t len = 0;
+    const uint64_t rowLen = square_size(image) * image->c * sample_bits(image) / 8;
+    const uint64_t realWidth = image->w * image->c;
+    const BitKernel *const kernel = depth_kernel(sample_bits(image));
+    uint8_t *data = (uint8_t *) &len;
+    const uint8_t *yStart = image->pixels + square_offset(image, square_index(square));
+    for (uint64_t remaining = sizeof(uint64_t); remaining != 0; yStart += realWidth) {
+        const uint64_t size = remaining < rowLen ? remaining : rowLen;
+        kernel->extract(yStart, data, size);
+        data += size;
+        remaining -= size;
+    }
+    return len;
+}
+
+void extract_data(const Image *const image, const Square square, uint8_t *data) {
+    const uint64_t size = square_size(image);
+    const uint64_t rowLen = size * image->c * sample_bits(image) / 8;
+    const uint64_t realWidth = image->w * image->c;
+    const BitKernel *const kernel = depth_kernel(sample_bits(image));
+    const uint8_t *yStart = image->pixels + square_offset(image, square_index(square));
+    for (uint64_t y = 0; y < size; ++y, yStart += realWidth, data += rowLen)
+        kernel->extract(yStart, data, rowLen);
+}
+
+typedef struct ExtractJob {
+    const Image *image;
+    const Square *squares;  // the squares in payload order
+    uint8_t *data;
+} ExtractJob;
+
+static void extract_task(void *const context, const uint64_t begin, const uint64_t end) {
+    const ExtractJob *const job = (const ExtractJob *) context;
+    const uint64_t squareLen = square_len(job->image);
+    for (uint64_t i = begin; i < end; ++i) extract_data(job->image, job->squares[i], job->data + squareLen * i);
+}
+
+// frees what extract allocated, pixels it didn't copy stay with their owner
+static void free_extract_image(Image *const image, const bool borrowed, Collector *const collector) {
+    counted_free(collector, image->squareList.squares, image->squareList.len * sizeof(Square));
+    if (!borrowed) counted_free(collector, image->pixels, image->w * image->h * image->c);
+}
+
+// whether a header was written with the image's square size and bits and its length fits into the other squares
+static bool header_fits(const Image *const image, const uint64_t header, const uint64_t total) {
+    const uint64_t len = header & LenMask, squareLen = square_len(image);
+    return header >> LenBits == header_code(image) && len / squareLen + (len % squareLen != 0) < total;
+}
+
+// the header is in the best square, so when no square could hold one there's nothing to score, which is what an
+// image without a payload comes down to: a few pixels read per square
+static bool header_candidate(const Image *const image, const uint64_t total) {
+    for (uint64_t index = 0; index < total; ++index) {
+        if (header_fits(image, extract_len(image, index), total)) return true;
+    }
+    return false;
+}
+
+// reads the header from the best square of a scored image
+static bool read_header(const Image *const image, uint64_t *const len) {
+    const Square *const squares = image->squareList.squares;
+    Square best = squares[0];
+    for (uint64_t i = 1; i < image->squareList.len; ++i) best = squares[i] < best ? squares[i] : best;
+
+    const uint64_t header = extract_len(image, best);
+    *len = header & LenMask;
+    return header_fits(image, header, image->squareList.len);
+}
+
+// scores an image with every square size and bits it may use until one holds a valid header, the squares stay
+// unsorted unless they came from the cache, which sorted tells
+// size and bits are fixed when the image names them, otherwise the header tells which were used
+static uint64_t score_header(Image *const image, const uint64_t reserved, uint64_t *const len, bool *const sorted,
+                             Collector *const collector) {
+    const uint64_t size = image->squareSize, bits = image->bits;
+    const uint64_t checked = check_image(image);
+    if (checked != OK) return checked;
+    for (uint64_t round = 0; round < SquareSizeNum * MaxBits; ++round) {
+        const uint64_t roundSize = SquareSizes[round / MaxBits], roundBits = round % MaxBits + 1;
+        if ((size != 0 && roundSize != size) || (bits != 0 && roundBits != bits)) continue;
+        image->squareSize = roundSize;
+        image->bits = roundBits;
+        image->squareList = (SquareList) {NULL, 0};
+        const uint64_t total = square_num(image, reserved);
+        if (total == 0 || !header_candidate(image, total)) continue;
+        uint64_t hits;
+        const uint64_t code = generate_images(image, 1, reserved, false, &hits, collector);
+        if (code != OK) return code;
+        if (image->squareList.squares == NULL) continue;
+        *sorted = hits != 0;
+        if (read_header(image, len)) return OK;
+        counted_free(collector, image->squareList.squares, image->squareList.len * sizeof(Square));
+    }
+    image->squareList = (SquareList) {NULL, 0};
+    image->squareSize = size;
+    image->bits = bits;
+    return InvalidLen;
+}
+
+static Extracted extract_image(Image image, const uint64_t reserved, const bool inplace, Collector *const collector) {
     uint64_t code;
+    const bool borrowed = inplace || image.copied;
+    image.squareList = (SquareList) {NULL, 0};
 
-    code = copy_image(&image);
-    if (code != OK) return (Extracted) {{NULL, 0, false}, code};
+    if (!borrowed) {
+        const uint64_t start = collector_clock(collector);
+        code = copy_pixels(&image, collector);
+        if (code != OK) return (Extracted) {{NULL, 0, false}, code};
+        collect(collector, copyNs, collector_clock(collector) - start);
+        collect(collector, bytesTouched, image.w * image.h * image.c);
+    }
 
-    code = generate_squares(&image, reserved);
+    uint64_t len;
+    bool sorted;
+    code = score_header(&image, reserved, &len, &sorted, collector);
     if (code != OK) {
-        free_image(&image);
+        free_extract_image(&image, borrowed, collector);
         return (Extracted) {{NULL, 0, false}, code};
     }
 
-    const uint64_t len = extract_len(&image, image.squareList.squares);
-    const uint64_t squareLen = SquareSize * SquareSize * image.c / 8;
+    // only the squares the payload needs get ordered
+    Square *const squares = image.squareList.squares;
+    const uint64_t squareLen = square_len(&image);
     const uint64_t squareNum = len / squareLen + (len % squareLen != 0);
-    if (squareNum > image.squareList.len) {
-        free_image(&image);
-        return (Extracted) {{NULL, 0, false}, InvalidLen};
-    }
+    uint64_t start = collector_clock(collector);
+    if (!sorted) select_counted(squares, image.squareList.len, squareNum + 1, collector);
+    collect(collector, sortNs, collector_clock(collector) - start);
     const uint64_t paddedLen = squareLen * squareNum;
 
-    uint8_t *const padded = (uint8_t *) calloc(paddedLen, sizeof(uint8_t));
+    uint8_t *const padded = (uint8_t *) counted_calloc(collector, paddedLen, sizeof(uint8_t));
     if (padded == NULL) {
-        free_image(&image);
+        free_extract_image(&image, borrowed, collector);
         return (Extracted) {{NULL, 0, false}, AllocationFailure};
     }
 
-    for (uint64_t i = 0; i < squareNum; ++i)
-        extract_data(&image, image.squareList.squares + i + 1, padded + squareLen * i);
+    start = collector_clock(collector);
+    ExtractJob job = {&image, squares + 1, padded};
+    parallel_for(squareNum, 64, extract_task, &job);
+    collect(collector, bitsNs, collector_clock(collector) - start);
+    const uint64_t size = square_size(&image);
+    collect(collector, squaresUsed, squareNum + 1);
+    collect(collector, bytesTouched, (squareNum + 1) * size * size * image.c);
+    free_extract_image(&image, borrowed, collector);
+
+    // arena memory isn't the caller's to free
+    return (Extracted) {{padded, len, !collector_pooled(collector)}, OK};
+}
+
+Extracted extract(const Image image, const uint64_t reserved) {
+    return extract_image(image, reserved, false, NULL);
+}
+
+Extracted extract_inplace(const Image image, const uint64_t reserved) {
+    return extract_image(image, reserved, true, NULL);
+}
+
+Extracted extract_stats(const Image image, const uint64_t reserved, const bool inplace, Stats *const stats) {
+    Collector storage;
+    Collector *const collector = collector_begin(&storage, stats, NULL);
+    const Extracted extracted = extract_image(image, reserved, inplace, collector);
+    collector_end(collector);
+    return extracted;
+}
+
+// a strip image is read one row of squares at a time, twice: the first pass scores the squares and keeps the best
+// ones, the second embeds into or extracts from those, so only a strip of pixels is ever held
+
+// the image a strip of rows is, which square_offset and the kernels treat like any other
+static Image strip_of(const StripImage *const image, uint8_t *const pixels) {
+    const uint64_t size = image->squareSize == 0 ? SquareSize : image->squareSize;
+    return (Image) {image->w, size, image->c, pixels, {NULL, 0}, 0, false, image->squareSize, image->bits};
+}
+
+typedef struct StripScoreJob {
+    const Image *strip;
+    Square *squares;
+    uint64_t first;  // the index of the strip's first square in the whole image
+} StripScoreJob;
+
+static void strip_score_task(void *const context, const uint64_t begin, const uint64_t end) {
+    const StripScoreJob *const job = (const StripScoreJob *) context;
+    for (uint64_t x = begin; x < end; ++x) job->squares[x] = make_square(calc_entropy(job->strip, x), job->first + x);
+}
+
+static bool read_strip(const StripImage *const image, Image *const strip, const uint64_t index,
+                       Square *const squares) {
+    const uint64_t squareW = image->w / strip->h;
+    if (!image->read(image->context, index * strip->h, strip->h, strip->pixels)) return false;
+    StripScoreJob job = {strip, squares, index * squareW};
+    parallel_for(squareW, 16, strip_score_task, &job);
+    return true;
+}
 
-    return (Extracted) {{padded, len, true}, OK};
+// the count best squares seen so far, a heap with the worst of them on top
+// each one has a slot its payload is extracted to, which it hands over to the square that pushes it out
+typedef struct BestSquares {
+    Square *heap;
+    uint64_t *slots;
+    uint64_t len, count;
+} BestSquares;
+
+static void best_swap(BestSquares *const best, const uint64_t a, const uint64_t b) {
+    const Square square = best->heap[a];
+    const uint64_t slot = best->slots[a];
+    best->heap[a] = best->heap[b];
+    best->slots[a] = best->slots[b];
+    best->heap[b] = square;
+    best->slots[b] = slot;
+}
+
+static void best_down(BestSquares *const best, uint64_t i) {
+    for (;;) {
+        const uint64_t left = 2 * i + 1, right = left + 1;
+        uint64_t top = i;
+        if (left < best->len && best->heap[left] > best->heap[top]) top = left;
+        if (right < best->len && best->heap[right] > best->heap[top]) top = right;
+        if (top == i) return;
+        best_swap(best, i, top);
+        i = top;
+    }
+}
+
+// the slot the square takes, count when it isn't among the best
+static uint64_t best_offer(BestSquares *const best, const Square square) {
+    if (best->len < best->count) {
+        uint64_t i = best->len++;
+        best->heap[i] = square;
+        best->slots[i] = i;
+        for (; i > 0 && best->heap[(i - 1) / 2] < best->heap[i]; i = (i - 1) / 2) best_swap(best, i, (i - 1) / 2);
+        return best->slots[i];
+    }
+    if (square >= best->heap[0]) return best->count;
+    const uint64_t slot = best->slots[0];
+    best->heap[0] = square;
+    best_down(best, 0);
+    return slot;
+}
+
+// empties the heap into payload order, slots then says where the square of each rank was extracted to
+static void best_order(BestSquares *const best) {
+    while (best->len > 0) {
+        best_swap(best, 0, --best->len);
+        best_down(best, 0);
+    }
+}
+
+static uint64_t best_init(BestSquares *const best, const uint64_t count) {
+    best->heap = (Square *) calloc(count, sizeof(Square));
+    best->slots = (uint64_t *) calloc(count, sizeof(uint64_t));
+    best->len = 0;
+    best->count = count;
+    return best->heap == NULL || best->slots == NULL ? AllocationFailure : OK;
+}
+
+static void best_free(BestSquares *const best) {
+    free(best->heap);
+    free(best->slots);
+}
+
+// the first pass keeping the count best squares, best first
+static uint64_t best_strips(const StripImage *const image, Image *const strip, Square *const squares,
+                            BestSquares *const best) {
+    const uint64_t squareW = image->w / strip->h, strips = image->h / strip->h;
+    for (uint64_t index = 0; index < strips; ++index) {
+        if (!read_strip(image, strip, index, squares)) return StripFailure;
+        for (uint64_t x = 0; x < squareW; ++x) best_offer(best, squares[x]);
+    }
+    best_order(best);
+    return OK;
+}
+
+// the second pass, every row is written back once and in order, the rows below the last strip as they were
+static uint64_t embed_strip_pass(const StripImage *const image, Image *const strip, const uint64_t *const order,
+                                 const uint64_t count, const Segments *const piece, const uint64_t len) {
+    const uint64_t squareW = image->w / strip->h, strips = image->h / strip->h;
+    const uint64_t squareLen = square_len(strip);
+    Gather at = {0, 0};
+    uint64_t next = 0;
+    for (uint64_t index = 0; index < strips; ++index) {
+        if (!image->read(image->context, index * strip->h, strip->h, strip->pixels)) return StripFailure;
+        for (; next < count && (order[next] >> 32) / squareW == index; ++next) {
+            const Square square = (order[next] >> 32) % squareW;
+            const uint64_t rank = order[next] & UINT32_MAX;
+            if (rank == 0) embed_len(strip, square, make_header(strip, len));
+            else embed_square_segments(strip, square, piece, &at, (rank - 1) * squareLen);
+        }
+        if (!image->write(image->context, index * strip->h, strip->h, strip->pixels)) return StripFailure;
+    }
+    const uint64_t rest = image->h - strips * strip->h;
+    if (rest != 0 && (!image->read(image->context, strips * strip->h, rest, strip->pixels) ||
+                      !image->write(image->context, strips * strip->h, rest, strip->pixels))) {
+        return StripFailure;
+    }
+    return OK;
+}
+
+static int compare_words(const void *const a, const void *const b) {
+    const uint64_t first = *(const uint64_t *) a, second = *(const uint64_t *) b;
+    return (first > second) - (first < second);
+}
+
+uint64_t embed_strips(const StripImage image, const Segments piece, const uint64_t reserved) {
+    Image strip = strip_of(&image, NULL);
+    uint64_t code = check_image(&strip);
+    if (code != OK) return code;
+    if (image.read == NULL || image.write == NULL) return StripFailure;
+    const uint64_t len = segments_len(&piece);
+    if (len > LenMask) return OversizedData;
+
+    // the squares precompute and embed would use for the piece on a single cover: the header square, then the
+    // reserved ones, then the rest down to a square that still has entropy
+    const Image whole = {image.w, image.h, image.c, NULL, {NULL, 0}, 0, false, image.squareSize, image.bits};
+    const uint64_t squareLen = square_len(&strip);
+    const uint64_t count = 1 + len / squareLen + (len % squareLen != 0);
+    const uint64_t reservedCount = (reserved + squareLen - 1) / squareLen;
+    if (square_num(&whole, reserved) < count) return OversizedData;
+
+    strip.pixels = (uint8_t *) malloc(image.w * strip.h * image.c);
+    Square *const squares = (Square *) calloc(image.w / strip.h, sizeof(Square));
+    BestSquares best;
+    code = best_init(&best, count);
+    if (strip.pixels == NULL || squares == NULL) code = AllocationFailure;
+    if (code == OK) code = best_strips(&image, &strip, squares, &best);
+    if (code == OK && count - 1 > reservedCount && square_entropy(best.heap[count - 1]) == 0) code = OversizedData;
+
+    if (code == OK) {
+        // the best squares in image order, each with its rank in the payload
+        uint64_t *const order = best.heap;
+        for (uint64_t rank = 0; rank < count; ++rank) order[rank] = square_index(best.heap[rank]) << 32 | rank;
+        qsort(order, count, sizeof(uint64_t), compare_words);
+        code = embed_strip_pass(&image, &strip, order, count, &piece, len);
+    }
+
+    best_free(&best);
+    free(squares);
+    free(strip.pixels);
+    return code;
+}
+
+// moves the square at from[i] to i for every i, following the cycles of the permutation
+static void permute_squares(uint8_t *const data, uint64_t *const from, const uint64_t len, const uint64_t squareLen,
+                            uint8_t *const temp) {
+    for (uint64_t start = 0; start < len; ++start) {
+        if (from[start] == start) continue;
+        memcpy(temp, data + start * squareLen, squareLen);
+        uint64_t i = start;
+        while (from[i] != start) {
+            const uint64_t next = from[i];
+            memcpy(data + i * squareLen, data + next * squareLen, squareLen);
+            from[i] = i;
+            i = next;
+        }
+        memcpy(data + i * squareLen, temp, squareLen);
+        from[i] = i;
+    }
+}
+
+// the first pass: the header in the best square, valid like read_header has it
+static uint64_t header_strips(const StripImage *const image, Image *const strip, Square *const squares,
+                              const uint64_t total, uint64_t *const len) {
+    const uint64_t squareW = image->w / strip->h, strips = image->h / strip->h;
+    Square best = UINT64_MAX;
+    uint64_t header = 0;
+    for (uint64_t index = 0; index < strips; ++index) {
+        if (!read_strip(image, strip, index, squares)) return StripFailure;
+        for (uint64_t x = 0; x < squareW; ++x) {
+            if (squares[x] >= best) continue;
+            best = squares[x];
+            header = extract_len(strip, x);
+        }
+    }
+    if (header >> LenBits != header_code(strip)) return InvalidLen;
+    *len = header & LenMask;
+    const uint64_t squareLen = square_len(strip);
+    return *len / squareLen + (*len % squareLen != 0) < total ? OK : InvalidLen;
+}
+
+// the second pass, every square that makes it among the best is extracted to its slot right away
+static uint64_t extract_strip_pass(const StripImage *const image, Image *const strip, Square *const squares,
+                                   BestSquares *const best, uint8_t *const data) {
+    const uint64_t squareW = image->w / strip->h, strips = image->h / strip->h;
+    const uint64_t squareLen = square_len(strip);
+    for (uint64_t index = 0; index < strips; ++index) {
+        if (!read_strip(image, strip, index, squares)) return StripFailure;
+        for (uint64_t x = 0; x < squareW; ++x) {
+            const uint64_t slot = best_offer(best, squares[x]);
+            if (slot == best->count) continue;
+            extract_data(strip, x, data + slot * squareLen);
+        }
+    }
+    best_order(best);
+    return OK;
+}
+
+Extracted extract_strips(const StripImage image, const uint64_t reserved) {
+    uint64_t code = check_image(&(Image) {.squareSize = image.squareSize, .bits = image.bits});
+    if (code != OK) return (Extracted) {{NULL, 0, false}, code};
+    if (image.read == NULL) return (Extracted) {{NULL, 0, false}, StripFailure};
+
+    // every square size and bits the image may use, like extract tries them
+    for (uint64_t round = 0; round < SquareSizeNum * MaxBits; ++round) {
+        StripImage tried = image;
+        tried.squareSize = SquareSizes[round / MaxBits];
+        tried.bits = round % MaxBits + 1;
+        if ((image.squareSize != 0 && tried.squareSize != image.squareSize) ||
+            (image.bits != 0 && tried.bits != image.bits)) {
+            continue;
+        }
+        const Image whole = {image.w, image.h, image.c, NULL, {NULL, 0}, 0, false, tried.squareSize, tried.bits};
+        const uint64_t total = square_num(&whole, reserved);
+        if (total == 0) continue;
+
+        Image strip = strip_of(&tried, (uint8_t *) malloc(image.w * tried.squareSize * image.c));
+        Square *const squares = (Square *) calloc(image.w / tried.squareSize, sizeof(Square));
+        uint64_t len;
+        code = strip.pixels == NULL || squares == NULL ? AllocationFailure : OK;
+        if (code == OK) code = header_strips(&tried, &strip, squares, total, &len);
+        if (code == InvalidLen) {
+            free(squares);
+            free(strip.pixels);
+            continue;
+        }
+
+        uint8_t *data = NULL, *temp = NULL;
+        BestSquares best = {NULL, NULL, 0, 0};
+        const uint64_t squareLen = square_len(&strip);
+        const uint64_t squareNum = len / squareLen + (len % squareLen != 0);
+        if (code == OK) {
+            code = best_init(&best, squareNum + 1);
+            data = (uint8_t *) calloc(squareNum + 1, squareLen);
+            temp = (uint8_t *) malloc(squareLen);
+            if (data == NULL || temp == NULL) code = AllocationFailure;
+        }
+        if (code == OK) code = extract_strip_pass(&tried, &strip, squares, &best, data);
+        if (code == OK) {
+            // the header square goes first and is dropped
+            permute_squares(data, best.slots, squareNum + 1, squareLen, temp);
+            memmove(data, data + squareLen, squareNum * squareLen);
+        }
+
+        best_free(&best);
+        free(temp);
+        free(squares);
+        free(strip.pixels);
+        if (code != OK) {
+            free(data);
+            return (Extracted) {{NULL, 0, false}, code};
+        }
+        return (Extracted) {{data, len, true}, OK};
+    }
+    return (Extracted) {{NULL, 0, false}, InvalidLen};
+}
+
+// whether a header could be real: written with the image's square size and bits, its length holding the reserved
+// area and fitting into the other squares
+static bool plausible_header(const Image *const image, const uint64_t header, const uint64_t reserved,
+                             const uint64_t total) {
+    return (header & LenMask) >= reserved && header_fits(image, header, total);
+}
+
+typedef struct ProbeJob {
+    const Image *image;
+    Square *best;  // the best square of each strip
+} ProbeJob;
+
+static void probe_task(void *const context, const uint64_t begin, const uint64_t end) {
+    const ProbeJob *const job = (const ProbeJob *) context;
+    const Image *const image = job->image;
+    const uint64_t size = square_size(image), squareW = image->w / size, realWidth = image->w * image->c;
+    const EntropyKernel kernel = entropy_kernel(image);
+    const uint32_t *const nLogN = nlogn_table();
+    const uint64_t shift = sample_bits(image);
+    for (uint64_t strip = begin; strip < end; ++strip) {
+        job->best[strip] = UINT64_MAX;
+        for (uint64_t index = strip * squareW; index < (strip + 1) * squareW; ++index) {
+            const uint8_t *const start = image->pixels + square_offset(image, index);
+            const Square square = make_square(kernel(nLogN, start, realWidth, size, image->c, shift), index);
+            if (square < job->best[strip]) job->best[strip] = square;
+        }
+    }
+}
+
+// the best square of the image, scored strip by strip without keeping the squares
+static uint64_t probe_best(const Image *const image, Square *const best) {
+    const uint64_t strips = image->h / square_size(image);
+    Square *const stripBest = (Square *) malloc(strips * sizeof(Square));
+    if (stripBest == NULL) return AllocationFailure;
+    ProbeJob job = {image, stripBest};
+    parallel_for(strips, 1, probe_task, &job);
+    *best = UINT64_MAX;
+    for (uint64_t strip = 0; strip < strips; ++strip) *best = stripBest[strip] < *best ? stripBest[strip] : *best;
+    free(stripBest);
+    return OK;
+}
+
+Probed probe(const Image image, const uint64_t reserved) {
+    const uint64_t checked = check_image(&image);
+    if (checked != OK) return (Probed) {false, 0, 0, 0, checked};
+
+    // the rounds extract goes through, in its order, so a payload is found with the square size and bits it would use
+    for (uint64_t round = 0; round < SquareSizeNum * MaxBits; ++round) {
+        Image sized = image;
+        sized.squareSize = SquareSizes[round / MaxBits];
+        sized.bits = round % MaxBits + 1;
+        if ((image.squareSize != 0 && sized.squareSize != image.squareSize) ||
+            (image.bits != 0 && sized.bits != image.bits)) {
+            continue;
+        }
+        const uint64_t total = square_num(&sized, reserved);
+        if (total == 0) continue;
+
+        if (!header_candidate(&sized, total)) continue;
+
+        Square best;
+        const uint64_t code = probe_best(&sized, &best);
+        if (code != OK) return (Probed) {false, 0, 0, 0, code};
+        const uint64_t header = extract_len(&sized, best);
+        if (plausible_header(&sized, header, reserved, total)) {
+            return (Probed) {true, header & LenMask, sized.squareSize, sized.bits, OK};
+        }
+    }
+    return (Probed) {false, 0, 0, 0, OK};
+}
+
+struct Context {
+    Arena arena;
+};
+
+Context *context_new(void) {
+    Context *const context = (Context *) malloc(sizeof(Context));
+    if (context == NULL) return NULL;
+    arena_init(&context->arena);
+    return context;
+}
+
+void context_reset(Context *const context) {
+    arena_reset(&context->arena);
+}
+
+void context_free(Context *const context) {
+    if (context == NULL) return;
+    arena_free(&context->arena);
+    free(context);
+}
+
+uint64_t context_capacity(const Context *const context) {
+    return context->arena.capacity;
+}
+
+Precomputed precompute_context(Context *const context, const ImageList imageList, const uint64_t dataLen,
+                               const uint64_t reserved, const bool inplace) {
+    Collector storage;
+    Collector *const collector = collector_begin(&storage, NULL, &context->arena);
+    return precompute_images(imageList, dataLen, reserved, inplace, collector);
+}
+
+Embedded embed_context(Context *const context, const Precomputed precomputed, const DataPieces dataPieces) {
+    Collector storage;
+    Collector *const collector = collector_begin(&storage, NULL, &context->arena);
+    return embed_pieces(precomputed, dataPieces, collector);
+}
+
+Embedded embed_segments_context(Context *const context, const Precomputed precomputed,
+                                const SegmentPieces segmentPieces) {
+    Collector storage;
+    Collector *const collector = collector_begin(&storage, NULL, &context->arena);
+    return embed_gathered(precomputed, segmentPieces, collector);
+}
+
+Extracted extract_context(Context *const context, const Image image, const uint64_t reserved, const bool inplace) {
+    Collector storage;
+    Collector *const collector = collector_begin(&storage, NULL, &context->arena);
+    return extract_image(image, reserved, inplace, collector);
+}
+
+// the squares a cover's list starts with as they were before the last allocation handed them out to be embedded into
+typedef struct Saved {
+    uint8_t *bytes;
+    uint64_t capacity;  // in bytes
+    uint64_t squares;
+} Saved;
+
+struct Covers {
+    Image *images;  // scored and sorted once, never pruned
+    Image *views;  // the images of the last allocation, their lists cut to the squares it uses
+    Saved *saved;  // one for every cover, put back by the next allocation
+    uint64_t len, capacity;
+    uint64_t reserved;
+};
+
+Covers *covers_new(const uint64_t reserved) {
+    Covers *const covers = (Covers *) calloc(1, sizeof(Covers));
+    if (covers == NULL) return NULL;
+    covers->reserved = reserved;
+    return covers;
+}
+
+static uint64_t grow_covers(Covers *const covers, const uint64_t len) {
+    if (len <= covers->capacity) return OK;
+    uint64_t capacity = covers->capacity == 0 ? 4 : covers->capacity * 2;
+    if (capacity < len) capacity = len;
+    // a failed second reallocation leaves the first one bigger than needed, which is harmless
+    Image *const images = (Image *) realloc(covers->images, capacity * sizeof(Image));
+    if (images == NULL) return AllocationFailure;
+    covers->images = images;
+    Image *const views = (Image *) realloc(covers->views, capacity * sizeof(Image));
+    if (views == NULL) return AllocationFailure;
+    covers->views = views;
+    Saved *const saved = (Saved *) realloc(covers->saved, capacity * sizeof(Saved));
+    if (saved == NULL) return AllocationFailure;
+    memset(saved + covers->capacity, 0, (capacity - covers->capacity) * sizeof(Saved));
+    covers->saved = saved;
+    covers->capacity = capacity;
+    return OK;
+}
+
+// copies the saved squares into the cover's pixels or, the other way round, its pixels into the saved squares
+static void transfer_squares(Image *const image, const Saved *const saved, const bool restore) {
+    const uint64_t size = square_size(image), row = size * image->c, stride = image->w * image->c;
+    uint8_t *bytes = saved->bytes;
+    for (uint64_t i = 0; i < saved->squares; ++i) {
+        uint8_t *start = image->pixels + square_offset(image, square_index(image->squareList.squares[i]));
+        for (uint64_t y = 0; y < size; ++y, start += stride, bytes += row) {
+            if (restore) memcpy(start, bytes, row);
+            else memcpy(bytes, start, row);
+        }
+    }
+}
+
+static void restore_task(void *const context, const uint64_t begin, const uint64_t end) {
+    Covers *const covers = (Covers *) context;
+    for (uint64_t i = begin; i < end; ++i) {
+        transfer_squares(covers->images + i, covers->saved + i, true);
+        covers->saved[i].squares = 0;
+    }
+}
+
+static void save_task(void *const context, const uint64_t begin, const uint64_t end) {
+    Covers *const covers = (Covers *) context;
+    for (uint64_t i = begin; i < end; ++i) transfer_squares(covers->images + i, covers->saved + i, false);
+}
+
+uint64_t covers_add(Covers *const covers, const ImageList imageList, const bool inplace, Stats *const stats) {
+    uint64_t code;
+    for (uint64_t i = 0; i < imageList.len; ++i) {
+        code = check_image(imageList.images + i);
+        if (code != OK) return code;
+    }
+    if (imageList.len == 0) return OK;
+    if (grow_covers(covers, covers->len + imageList.len) != OK) return AllocationFailure;
+
+    Collector storage;
+    Collector *const collector = collector_begin(&storage, stats, NULL);
+    ImageList added = imageList;
+    code = inplace ? OK : copy_images(&added, collector);
+    if (code == OK) {
+        // the covers own the copied pixels from here on, the array they came in is dropped
+        Image *const images = covers->images + covers->len;
+        memcpy(images, added.images, added.len * sizeof(Image));
+        if (added.copied) counted_free(collector, added.images, added.len * sizeof(Image));
+        for (uint64_t i = 0; i < added.len; ++i) {
+            images[i].squareList = (SquareList) {NULL, 0};
+            images[i].usage = 0;
+        }
+        uint64_t hits;
+        code = generate_images(images, added.len, covers->reserved, true, &hits, collector);
+        if (code == OK) {
+            covers->len += added.len;
+        } else {
+            ImageList failed = {images, added.len, false};
+            free_imageList(&failed);
+        }
+    }
+    collector_end(collector);
+    return code;
+}
+
+uint64_t covers_remove(Covers *const covers, const uint64_t index) {
+    if (index >= covers->len) return BadCoverIndex;
+    // pixels borrowed in place go back to the caller as they were added
+    restore_task(covers, index, index + 1);
+    free_image(covers->images + index);
+    memmove(covers->images + index, covers->images + index + 1, (covers->len - index - 1) * sizeof(Image));
+    // the saved squares move down with their cover, the buffer of the removed one is kept for whichever comes last
+    const Saved removed = covers->saved[index];
+    memmove(covers->saved + index, covers->saved + index + 1, (covers->len - index - 1) * sizeof(Saved));
+    covers->saved[covers->len - 1] = removed;
+    --covers->len;
+    return OK;
+}
+
+uint64_t covers_len(const Covers *const covers) {
+    return covers->len;
+}
+
+// the views embed into the covers' own pixels, so the squares they are cut to are saved first and put back before
+// the next allocation, a shorter payload then leaves nothing of a longer one in the squares it doesn't use
+static uint64_t save_views(Covers *const covers, Collector *const collector) {
+    const uint64_t start = collector_clock(collector);
+    for (uint64_t i = 0; i < covers->len; ++i) {
+        const Image *const view = covers->views + i;
+        Saved *const saved = covers->saved + i;
+        const uint64_t size = square_size(view);
+        const uint64_t squares = view->squareList.squares == NULL ? 0 : view->squareList.len;
+        const uint64_t len = squares * size * size * view->c;
+        if (len > saved->capacity) {
+            uint8_t *const bytes = (uint8_t *) realloc(saved->bytes, len);
+            if (bytes == NULL) {
+                // nothing was saved yet, so there is nothing to put back either
+                for (uint64_t j = 0; j < i; ++j) covers->saved[j].squares = 0;
+                return AllocationFailure;
+            }
+            saved->bytes = bytes;
+            saved->capacity = len;
+        }
+        saved->squares = squares;
+        collect(collector, bytesTouched, len);
+    }
+    parallel_for(covers->len, 1, save_task, covers);
+    collect(collector, copyNs, collector_clock(collector) - start);
+    return OK;
+}
+
+Precomputed covers_allocate(Covers *const covers, const uint64_t dataLen, Stats *const stats) {
+    if (dataLen > LenMask || covers->len == 0) return (Precomputed) {{NULL, 0, false}, OversizedData};
+    Collector storage;
+    Collector *const collector = collector_begin(&storage, stats, NULL);
+    parallel_for(covers->len, 1, restore_task, covers);
+    memcpy(covers->views, covers->images, covers->len * sizeof(Image));
+    const uint64_t start = collector_clock(collector);
+    ImageList views = {covers->views, covers->len, false};
+    uint64_t code = count_bulk(&views, dataLen, covers->reserved, collector);
+
+    // pruning only shortens the views, the covers keep every square for the next length
+    for (uint64_t i = 0; code == OK && i < views.len; ++i) {
+        Image *const image = views.images + i;
+        if (image->squareList.squares == NULL) continue;
+        if (image->usage + 1 < image->squareList.len) image->squareList.len = image->usage + 1;
+        collect(collector, squaresUsed, image->usage + 1);
+    }
+    collect(collector, allocateNs, collector_clock(collector) - start);
+    if (code == OK) code = save_views(covers, collector);
+    collector_end(collector);
+    if (code != OK) return (Precomputed) {{NULL, 0, false}, code};
+    return (Precomputed) {views, OK};
+}
+
+void covers_free(Covers *const covers) {
+    if (covers == NULL) return;
+    parallel_for(covers->len, 1, restore_task, covers);
+    for (uint64_t i = 0; i < covers->len; ++i) free_image(covers->images + i);
+    for (uint64_t i = 0; i < covers->capacity; ++i) free(covers->saved[i].bytes);
+    free(covers->images);
+    free(covers->views);
+    free(covers->saved);
+    free(covers);
+}
+
+// squares whose entropy is sampled to estimate a candidate, and how many candidates are scored in one go
+#define EstimateSamples 64
+#define FinalistBatch 256
+
+typedef struct Candidate {
+    uint64_t index;  // in the pool
+    uint64_t capacity;  // estimated, exact once the candidate became a finalist
+    uint64_t pixels;
+} Candidate;
+
+// the payload an image carries when usable squares reach the floor, the best ones going to the header and reserved
+// area, whatever the reserved squares leave over isn't counted
+static uint64_t floor_capacity(const Image *const image, const uint64_t reserved, const uint64_t usable) {
+    const uint64_t squareLen = square_len(image);
+    const uint64_t count = (reserved + squareLen - 1) / squareLen;
+    return usable <= count + 1 ? 0 : (usable - 1) * squareLen - reserved;
+}
+
+typedef struct EstimateJob {
+    const Image *images;
+    Candidate *candidates;
+    uint64_t reserved, floor;
+} EstimateJob;
+
+static void estimate_task(void *const context, const uint64_t begin, const uint64_t end) {
+    const EstimateJob *const job = (const EstimateJob *) context;
+    for (uint64_t i = begin; i < end; ++i) {
+        const Image *const image = job->images + i;
+        Candidate *const candidate = job->candidates + i;
+        *candidate = (Candidate) {i, 0, image->w * image->h};
+        const uint64_t total = square_num(image, job->reserved);
+        if (total == 0) continue;
+        // evenly spread squares, each standing for the stretch of squares around it
+        const uint64_t samples = total < EstimateSamples ? total : EstimateSamples;
+        uint64_t above = 0;
+        for (uint64_t sample = 0; sample < samples; ++sample) {
+            const uint64_t index = sample * total / samples + total / samples / 2;
+            above += calc_entropy(image, index) >= job->floor;
+        }
+        candidate->capacity = floor_capacity(image, job->reserved, above * total / samples);
+    }
+}
+
+static int compare_capacity(const void *const a, const void *const b) {
+    const Candidate *const first = (const Candidate *) a, *const second = (const Candidate *) b;
+    if (first->capacity != second->capacity) return first->capacity < second->capacity ? 1 : -1;
+    return (first->index > second->index) - (first->index < second->index);
+}
+
+// payload per pixel, the way to the fewest pixels
+static int compare_density(const void *const a, const void *const b) {
+    const Candidate *const first = (const Candidate *) a, *const second = (const Candidate *) b;
+    const double firstDensity = (double) first->capacity / (double) first->pixels;
+    const double secondDensity = (double) second->capacity / (double) second->pixels;
+    if (firstDensity != secondDensity) return firstDensity < secondDensity ? 1 : -1;
+    return (first->index > second->index) - (first->index < second->index);
+}
+
+// scores the candidates [begin, end) in place and replaces their estimates with exact capacities
+static uint64_t score_finalists(const ImageList *const pool, Candidate *const candidates, const uint64_t begin,
+                                const uint64_t end, const uint64_t reserved, const uint64_t floor,
+                                Image *const batch) {
+    const uint64_t len = end - begin;
+    for (uint64_t i = 0; i < len; ++i) {
+        batch[i] = pool->images[candidates[begin + i].index];
+        batch[i].squareList = (SquareList) {NULL, 0};
+        batch[i].usage = 0;
+        batch[i].copied = false;
+    }
+    uint64_t hits;
+    const uint64_t code = generate_images(batch, len, reserved, true, &hits, NULL);
+    for (uint64_t i = 0; i < len; ++i) {
+        const uint64_t above = code == OK ? count_above(batch + i, 0, floor) : 0;
+        candidates[begin + i].capacity = floor_capacity(batch + i, reserved, above);
+        free(batch[i].squareList.squares);
+    }
+    return code;
+}
+
+static int compare_indices(const void *const a, const void *const b) {
+    const uint64_t first = *(const uint64_t *) a, second = *(const uint64_t *) b;
+    return (first > second) - (first < second);
+}
+
+Selection select_covers(const ImageList pool, const uint64_t dataLen, const uint64_t reserved, uint64_t floor,
+                        const uint64_t goal) {
+    uint64_t code;
+    if (dataLen > LenMask || pool.len == 0) return (Selection) {NULL, 0, 0, OversizedData};
+    for (uint64_t i = 0; i < pool.len; ++i) {
+        code = check_image(pool.images + i);
+        if (code != OK) return (Selection) {NULL, 0, 0, code};
+    }
+    // squares without entropy are never used
+    if (floor == 0) floor = 1;
+    int (*const compare)(const void *, const void *) = goal == SelectPixels ? compare_density : compare_capacity;
+
+    Candidate *const candidates = (Candidate *) calloc(pool.len, sizeof(Candidate));
+    Image *const batch = (Image *) calloc(pool.len < FinalistBatch ? pool.len : FinalistBatch, sizeof(Image));
+    if (candidates == NULL || batch == NULL) {
+        free(candidates);
+        free(batch);
+        return (Selection) {NULL, 0, 0, AllocationFailure};
+    }
+    EstimateJob job = {pool.images, candidates, reserved, floor};
+    parallel_for(pool.len, 16, estimate_task, &job);
+    qsort(candidates, pool.len, sizeof(Candidate), compare);
+
+    // the best estimates become finalists until their exact capacities hold the payload
+    // a batch aims a quarter past what is still missing, estimates being only samples
+    uint64_t total = 0, finalists = 0;
+    code = OK;
+    while (code == OK && total < dataLen && finalists < pool.len) {
+        const uint64_t missing = dataLen - total;
+        uint64_t end = finalists, estimated = 0;
+        while (end < pool.len && end - finalists < FinalistBatch &&
+               (end == finalists || estimated < missing + missing / 4)) {
+            estimated += candidates[end++].capacity;
+        }
+        code = score_finalists(&pool, candidates, finalists, end, reserved, floor, batch);
+        for (uint64_t i = finalists; i < end; ++i) total += candidates[i].capacity;
+        finalists = end;
+    }
+    free(batch);
+    if (code == OK && total < dataLen) code = OversizedData;
+    if (code != OK) {
+        free(candidates);
+        return (Selection) {NULL, 0, 0, code};
+    }
+
+    // the finalists in order again with what they really carry, taken until the payload fits
+    qsort(candidates, finalists, sizeof(Candidate), compare);
+    uint64_t chosen = 0, capacity = 0;
+    while (capacity < dataLen) capacity += candidates[chosen++].capacity;
+    // the densest covers may have overshot, the least dense chosen ones go when the others carry the payload
+    uint64_t len = chosen;
+    for (uint64_t i = chosen; goal == SelectPixels && i-- > 0;) {
+        if (capacity - candidates[i].capacity < dataLen) continue;
+        capacity -= candidates[i].capacity;
+        candidates[i].pixels = 0;
+        --len;
+    }
+
+    uint64_t *const indices = (uint64_t *) candidates;
+    for (uint64_t i = 0, j = 0; i < chosen; ++i) {
+        if (goal != SelectPixels || candidates[i].pixels != 0) indices[j++] = candidates[i].index;
+    }
+    qsort(indices, len, sizeof(uint64_t), compare_indices);
+    return (Selection) {indices, len, capacity, OK};
+}
+
+void free_selection(Selection selection) {
+    free(selection.indices);
 }
 
 void free_extracted(Extracted extracted) {
     free_data(&extracted.data);
 }
+
+typedef struct ListJob {
+    Image *images;  // the images whose header was found
+    Image *pending;  // the images scored with the square size of the current round
+    const uint64_t *index;  // the image each pending one stands for
+    const Data *pieces;
+    uint64_t *lens, *codes;
+    uint64_t *offsets;  // the first payload square of each image, offsets[len] being the total
+} ListJob;
+
+// reads the header of every pending image and orders the squares its payload needs, usage becomes their count
+static void header_task(void *const context, const uint64_t begin, const uint64_t end) {
+    const ListJob *const job = (const ListJob *) context;
+    for (uint64_t i = begin; i < end; ++i) {
+        Image *const image = job->pending + i;
+        uint64_t len;
+        if (image->squareList.squares == NULL || !read_header(image, &len)) continue;
+
+        const uint64_t squareLen = square_len(image);
+        const uint64_t squareNum = len / squareLen + (len % squareLen != 0);
+        select_counted(image->squareList.squares, image->squareList.len, squareNum + 1, NULL);
+        image->usage = squareNum;
+        job->images[job->index[i]] = *image;
+        job->lens[job->index[i]] = len;
+        job->codes[job->index[i]] = OK;
+    }
+}
+
+static void list_task(void *const context, const uint64_t begin, const uint64_t end) {
+    const ListJob *const job = (const ListJob *) context;
+    uint64_t i = 0;
+    for (uint64_t index = begin; index < end; ++index) {
+        while (job->offsets[i + 1] <= index) ++i;
+        const Image *const image = job->images + i;
+        const uint64_t square = index - job->offsets[i];
+        const uint64_t squareLen = square_len(image);
+        extract_data(image, image->squareList.squares[square + 1], job->pieces[i].data + square * squareLen);
+    }
+}
+
+// the most squares an image can be split into with the sizes extraction may try
+// the bits only decide whether the squares hold the reserved area, the most bits holding it best
+static uint64_t square_capacity(const Image *const image, const uint64_t reserved) {
+    Image sized = *image;
+    sized.bits = image->bits == 0 ? MaxBits : image->bits;
+    uint64_t capacity = 0;
+    for (uint64_t i = 0; i < SquareSizeNum; ++i) {
+        if (image->squareSize != 0 && SquareSizes[i] != image->squareSize) continue;
+        sized.squareSize = SquareSizes[i];
+        const uint64_t num = square_num(&sized, reserved);
+        capacity = num > capacity ? num : capacity;
+    }
+    return capacity;
+}
+
+ExtractedList extract_list(const ImageList imageList, const uint64_t reserved) {
+    const uint64_t len = imageList.len;
+    if (len == 0) return (ExtractedList) {{NULL, 0}, NULL, OK};
+
+    // one scratch block: the image descriptors, the bookkeeping and room for every image's squares
+    uint64_t squareNum = 0;
+    for (uint64_t i = 0; i < len; ++i) squareNum += square_capacity(imageList.images + i, reserved);
+    const uint64_t scratchSize =
+            2 * len * sizeof(Image) + (5 * len + 1) * sizeof(uint64_t) + squareNum * sizeof(Square);
+    uint8_t *const scratch = (uint8_t *) malloc(scratchSize);
+    if (scratch == NULL) return (ExtractedList) {{NULL, 0}, NULL, AllocationFailure};
+
+    // the descriptors borrow the caller's pixels, nothing is written to them
+    Image *const images = (Image *) scratch;
+    Image *const pending = images + len;
+    uint64_t *const offsets = (uint64_t *) (pending + len);
+    uint64_t *const lens = offsets + len + 1;
+    uint64_t *const results = lens + len;
+    uint64_t *const index = results + len;
+    uint64_t *const starts = index + len;
+    Square *const squares = (Square *) (starts + len);
+    for (uint64_t i = 0, start = 0; i < len; ++i) {
+        Image *const image = images + i;
+        *image = imageList.images[i];
+        image->squareList = (SquareList) {NULL, 0};
+        image->usage = 0;
+        lens[i] = 0;
+        results[i] = check_image(image);
+        if (results[i] == OK) results[i] = InvalidLen;
+        starts[i] = start;
+        start += square_capacity(image, reserved);
+    }
+
+    // one round per square size and bits, in the order extraction tries them, an image takes part until its
+    // header is found
+    ListJob job = {images, pending, index, NULL, lens, results, offsets};
+    for (uint64_t round = 0; round < SquareSizeNum * MaxBits; ++round) {
+        const uint64_t roundSize = SquareSizes[round / MaxBits], roundBits = round % MaxBits + 1;
+        uint64_t pendingLen = 0;
+        for (uint64_t i = 0; i < len; ++i) {
+            const uint64_t size = images[i].squareSize, bits = images[i].bits;
+            if (results[i] != InvalidLen || (size != 0 && size != roundSize) || (bits != 0 && bits != roundBits))
+                continue;
+            Image *const image = pending + pendingLen;
+            *image = images[i];
+            image->squareSize = roundSize;
+            image->bits = roundBits;
+            const uint64_t num = square_num(image, reserved);
+            // like a single extraction, an image no square of which could hold a header isn't scored this round
+            if (num == 0 || !header_candidate(image, num)) continue;
+            image->squareList = (SquareList) {squares + starts[i], num};
+            index[pendingLen++] = i;
+        }
+        score_images(pending, pendingLen, offsets, false, NULL);
+        parallel_for(pendingLen, 1, header_task, &job);
+    }
+
+    // one result block: the pieces, the codes and every payload padded to whole squares
+    uint64_t dataSize = 0;
+    for (uint64_t i = 0; i < len; ++i) dataSize += images[i].usage * square_len(images + i);
+    uint8_t *const block = (uint8_t *) calloc(len * (sizeof(Data) + sizeof(uint64_t)) + dataSize, sizeof(uint8_t));
+    if (block == NULL) {
+        free(scratch);
+        return (ExtractedList) {{NULL, 0}, NULL, AllocationFailure};
+    }
+
+    Data *const pieces = (Data *) block;
+    uint64_t *const codes = (uint64_t *) (pieces + len);
+    uint8_t *data = (uint8_t *) (codes + len);
+    offsets[0] = 0;
+    for (uint64_t i = 0; i < len; ++i) {
+        const Image *const image = images + i;
+        codes[i] = results[i];
+        pieces[i] = (Data) {codes[i] == OK ? data : NULL, lens[i], false};
+        data += image->usage * square_len(image);
+        offsets[i + 1] = offsets[i] + image->usage;
+    }
+
+    job.pieces = pieces;
+    parallel_for(offsets[len], 64, list_task, &job);
+    free(scratch);
+
+    return (ExtractedList) {{pieces, len}, codes, OK};
+}
+
+void free_extractedList(ExtractedList extractedList) {
+    // the pieces head the block everything else lives in
+    free(extractedList.dataPieces.pieces);
+}
+
+// a binary min-heap of square words, the best square sits on top
+static void square_down(Square *const heap, const uint64_t len, uint64_t i) {
+    const Square square = heap[i];
+    for (;;) {
+        uint64_t child = 2 * i + 1;
+        if (child >= len) break;
+        if (child + 1 < len && heap[child + 1] < heap[child]) ++child;
+        if (square < heap[child]) break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = square;
+}
+
+// moves the best square to the end of the heap and returns it
+static Square square_pop(Square *const heap, const uint64_t len) {
+    const Square top = heap[0];
+    heap[0] = heap[len - 1];
+    heap[len - 1] = top;
+    square_down(heap, len - 1, 0);
+    return top;
+}
+
+ExtractCursor extract_begin(const Image image, const uint64_t reserved) {
+    ExtractCursor cursor = {image, 0, 0, 0, NULL, 0, 0, OK};
+    cursor.image.squareList = (SquareList) {NULL, 0};
+
+    bool sorted;
+    cursor.code = score_header(&cursor.image, reserved, &cursor.len, &sorted, NULL);
+    if (cursor.code != OK) return cursor;
+
+    // heapifying is linear, a sorted list from the cache already is a heap, after that every square costs a pop,
+    // the first one being the header
+    Square *const squares = cursor.image.squareList.squares;
+    cursor.remaining = cursor.image.squareList.len;
+    for (uint64_t i = cursor.remaining / 2; i-- > 0;) square_down(squares, cursor.remaining, i);
+    square_pop(squares, cursor.remaining--);
+
+    cursor.buffer = (uint8_t *) calloc(square_len(&cursor.image), sizeof(uint8_t));
+    if (cursor.buffer == NULL) {
+        extract_end(&cursor);
+        cursor.code = AllocationFailure;
+    }
+    return cursor;
+}
+
+// pops the next count squares and extracts them in payload order
+static void extract_next(ExtractCursor *const cursor, const uint64_t count, uint8_t *const data) {
+    Square *const squares = cursor->image.squareList.squares;
+    for (uint64_t i = 0; i < count; ++i) square_pop(squares, cursor->remaining--);
+    // popped squares pile up behind the heap in reverse
+    Square *const popped = squares + cursor->remaining;
+    for (uint64_t i = 0, j = count - 1; i < j; ++i, --j) {
+        const Square swap = popped[i];
+        popped[i] = popped[j];
+        popped[j] = swap;
+    }
+    ExtractJob job = {&cursor->image, popped, data};
+    parallel_for(count, 64, extract_task, &job);
+}
+
+uint64_t extract_read(ExtractCursor *const cursor, uint8_t *const data, const uint64_t len) {
+    if (cursor->code != OK) return 0;
+    const uint64_t squareLen = square_len(&cursor->image);
+    uint64_t written = 0;
+    while (written < len && cursor->offset < cursor->len) {
+        const uint64_t left = cursor->len - cursor->offset;
+        const uint64_t wanted = len - written < left ? len - written : left;
+        if (cursor->position == cursor->buffered) {
+            // whole squares go straight to the caller, only a partial square is buffered
+            const uint64_t count = wanted / squareLen;
+            if (count != 0) {
+                extract_next(cursor, count, data + written);
+                written += count * squareLen;
+                cursor->offset += count * squareLen;
+                continue;
+            }
+            extract_next(cursor, 1, cursor->buffer);
+            cursor->position = 0;
+            cursor->buffered = squareLen;
+        }
+        const uint64_t available = cursor->buffered - cursor->position;
+        const uint64_t size = wanted < available ? wanted : available;
+        memcpy(data + written, cursor->buffer + cursor->position, size);
+        cursor->position += size;
+        written += size;
+        cursor->offset += size;
+    }
+    return written;
+}
+
+void extract_end(ExtractCursor *const cursor) {
+    free(cursor->image.squareList.squares);
+    free(cursor->buffer);
+    cursor->image.squareList = (SquareList) {NULL, 0};
+    cursor->buffer = NULL;
+    cursor->remaining = cursor->position = cursor->buffered = 0;
+    cursor->offset = cursor->len;
+}
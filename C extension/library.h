@@ -4,10 +4,21 @@
 #include <inttypes.h>
 #include <stdbool.h>
 
-typedef struct Square {
-    uint64_t x, y;
-    double entropy;
-} Square;
+// a square is packed into one word: the inverted entropy key in the high half, the block index in the low half
+// ascending words therefore go from the highest entropy down, ties going to the square that comes first
+typedef uint64_t Square;
+
+static inline Square make_square(const uint64_t entropy, const uint64_t index) {
+    return (UINT32_MAX - entropy) << 32 | index;
+}
+
+static inline uint64_t square_entropy(const Square square) {
+    return UINT32_MAX - (square >> 32);
+}
+
+static inline uint64_t square_index(const Square square) {
+    return square & UINT32_MAX;
+}
 
 typedef struct SquareList {
     Square *squares;
@@ -19,12 +30,15 @@ typedef struct Image {
     uint8_t *pixels;
     SquareList squareList;
     uint64_t usage;
-    bool copied;
+    bool copied;  // the pixels belong to the library
+    uint64_t squareSize;  // 8, 16 or 32, 0 meaning SquareSize, extraction reads it from the header when it's 0
+    uint64_t bits;  // payload bits per pixel byte from 1 to 4, 0 meaning 1, extraction reads it like squareSize
 } Image;
 
 typedef struct ImageList {
     Image *images;
     uint64_t len;
+    bool copied;  // the image array belongs to the library
 } ImageList;
 
 typedef struct Data {
@@ -38,6 +52,22 @@ typedef struct DataPieces {
     uint64_t len;
 } DataPieces;
 
+// a stretch of the caller's memory, a piece can be given as segments that are read one after another
+typedef struct Segment {
+    const uint8_t *data;
+    uint64_t len;
+} Segment;
+
+typedef struct Segments {
+    const Segment *segments;
+    uint64_t len;
+} Segments;
+
+typedef struct SegmentPieces {
+    const Segments *pieces;
+    uint64_t len;
+} SegmentPieces;
+
 typedef struct Precomputed {
     ImageList imageList;
     uint64_t code;
@@ -48,44 +78,290 @@ typedef struct Extracted {
     uint64_t code;
 } Extracted;
 
+// whether an image carries a payload, and how long it is and how it was embedded when it does
+typedef struct Probed {
+    bool present;
+    uint64_t len;  // the reserved area included, like an extracted piece
+    uint64_t squareSize, bits;
+    uint64_t code;
+} Probed;
+
+// one result per image, a piece whose code isn't OK is empty
+typedef struct ExtractedList {
+    DataPieces dataPieces;
+    uint64_t *codes;
+    uint64_t code;
+} ExtractedList;
+
 typedef Precomputed Embedded;
 
+// what a call spent its time and memory on, every field adds up over the calls given the same stats
+typedef struct Stats {
+    uint64_t copyNs, entropyNs, sortNs, allocateNs, bitsNs;  // copying pixels, scoring, ordering, counting, embedding
+    uint64_t bytesTouched;  // pixel bytes copied, scored, embedded or extracted
+    uint64_t squaresEvaluated, squaresUsed;
+    uint64_t allocations, peakBytes;  // peakBytes is the most the call had allocated at once
+    uint64_t cacheNs, cacheHits;  // hashing, loading and storing cached square orders, the images found there
+} Stats;
+
+// reads a payload square by square, the image's pixels have to outlive the cursor
+typedef struct ExtractCursor {
+    Image image;  // its squares are a heap of the squares not read yet
+    uint64_t remaining;  // squares left in the heap
+    uint64_t len, offset;  // the payload length and how much of it was read
+    uint8_t *buffer;  // the square that was only partially read
+    uint64_t position, buffered;
+    uint64_t code;
+} ExtractCursor;
+
+// an image file mapped into memory, the pixels of a binary PGM, PPM or PAM file are the mapping itself
+// BMP rows are padded, BGR and usually bottom-up, so the image gets a top-down RGB copy that sync_image stores back
+typedef struct ImageFile {
+    Image image;  // set squareSize and bits before precomputing
+    uint8_t *map;
+    uint64_t mapLen;
+    uint64_t offset, stride, depth;  // where the stored rows start, the bytes from one to the next and per pixel
+    bool bmp, bottomUp;
+    bool writable;
+    void *handle;  // the output file where it can't be mapped
+    uint64_t code;
+} ImageFile;
+
+// an image too large to hold, read and written a strip of square rows at a time
+typedef struct StripImage {
+    uint64_t w, h, c;
+    uint64_t squareSize, bits;  // like an Image's, extraction tries every one left at 0
+    // fills pixels with the rows [row, row + rows), w * c bytes each, false when it can't
+    bool (*read)(void *context, uint64_t row, uint64_t rows, uint8_t *pixels);
+    // takes the embedded rows, every row of the image once and in order, only embedding calls it
+    bool (*write)(void *context, uint64_t row, uint64_t rows, const uint8_t *pixels);
+    void *context;
+} StripImage;
+
+// a message put back together, its data being its chunks' in index order as segments the reassembly owns
+typedef struct Reassembled {
+    uint8_t id[8];
+    uint64_t time;  // when it was sent
+    Segments data;
+    uint64_t len;
+    void *message;  // NULL when there was no complete message
+} Reassembled;
+
+// owns an arena every call made with it allocates from, reusing the same memory message after message
+// results of those calls stay valid until context_reset and are never passed to the free_ functions
+typedef struct Context Context;
+
+// covers scored once and kept with all their squares, so a new payload length only reruns the cheap allocation
+// a Precomputed it returns borrows its images until the next add, remove, allocate or free and is never freed
+// embedding into one writes into the covers' pixels, the next allocate, remove or free puts back what it changed
+typedef struct Covers Covers;
+
+// chunks as distribution.split makes them, taken one at a time in any order and from any number of messages at
+// once, a message coming out once all its chunks are in
+// a chunk is the message's id, chunk count, its index and the send time, little-endian uint64_t each, then its data
+typedef struct Reassembly Reassembly;
+
 Precomputed precompute(ImageList imageList, uint64_t dataLen, uint64_t reserved);
 
 void free_precomputed(Precomputed precomputed);
 
+// works on the caller's image array and pixels instead of copies, embed then writes into those pixels
+// freeing the result only releases the squares, the caller keeps owning everything it passed in
+Precomputed precompute_inplace(ImageList imageList, uint64_t dataLen, uint64_t reserved);
+
 Embedded embed(Precomputed precomputed, DataPieces dataPieces);
 
+// like the calls above, adding what they did to stats, nothing is measured when stats is NULL
+Precomputed precompute_stats(ImageList imageList, uint64_t dataLen, uint64_t reserved, bool inplace, Stats *stats);
+
+Embedded embed_stats(Precomputed precomputed, DataPieces dataPieces, Stats *stats);
+
+// embeds pieces given as segments straight from the caller's memory, nothing is padded or copied beforehand
+// the tail of the last square of a piece is written as zeros
+Embedded embed_segments(Precomputed precomputed, SegmentPieces segmentPieces);
+
+Embedded embed_segments_stats(Precomputed precomputed, SegmentPieces segmentPieces, Stats *stats);
+
 Extracted extract(Image image, uint64_t reserved);
 
+// reads the caller's pixels without copying them
+Extracted extract_inplace(Image image, uint64_t reserved);
+
+Extracted extract_stats(Image image, uint64_t reserved, bool inplace, Stats *stats);
+
 void free_extracted(Extracted extracted);
 
+// looks for a payload in the caller's pixels without copying them or keeping any squares: only when some square
+// holds a plausible header is the best one searched for, in a single pass, and its header checked like extract does
+Probed probe(Image image, uint64_t reserved);
+
+// extracts every image in one pass over the caller's pixels, a bad image doesn't fail the others
+ExtractedList extract_list(ImageList imageList, uint64_t reserved);
+
+void free_extractedList(ExtractedList extractedList);
+
+ExtractCursor extract_begin(Image image, uint64_t reserved);
+
+uint64_t extract_read(ExtractCursor *cursor, uint8_t *data, uint64_t len);
+
+void extract_end(ExtractCursor *cursor);
+
+// embeds a piece, reserved area included, into the squares precompute and embed would pick for it on this one cover
+// the image is read twice, only a strip of pixels and the chosen squares are held, and written once
+uint64_t embed_strips(StripImage image, Segments piece, uint64_t reserved);
+
+// extracts what extract would in two passes over the strips, holding a strip of pixels and the payload
+Extracted extract_strips(StripImage image, uint64_t reserved);
+
+// NULL when it can't be allocated
+Context *context_new(void);
+
+// releases everything the calls made with the context returned, its memory is kept for the next ones
+void context_reset(Context *context);
+
+void context_free(Context *context);
+
+// the bytes the arena holds, it stops growing once a reset round fits in it
+uint64_t context_capacity(const Context *context);
+
+Precomputed precompute_context(Context *context, ImageList imageList, uint64_t dataLen, uint64_t reserved,
+                               bool inplace);
+
+Embedded embed_context(Context *context, Precomputed precomputed, DataPieces dataPieces);
+
+Embedded embed_segments_context(Context *context, Precomputed precomputed, SegmentPieces segmentPieces);
+
+Extracted extract_context(Context *context, Image image, uint64_t reserved, bool inplace);
+
+// NULL when it can't be allocated, memoryLimit bounds the chunks and bookkeeping it holds, incomplete messages
+// expire maxAge seconds after their first chunk came in, chunks sent longer ago than that are refused, 0 never
+Reassembly *reassembly_new(uint64_t memoryLimit, uint64_t maxAge);
+
+// copies a chunk in, now is the time in the clock of the chunks' send times, a chunk that came before is dropped
+// BadChunk for one that is malformed, from the future or too old, ReassemblyFull when it doesn't fit into the limit
+// even after every other incomplete message is dropped, the oldest first, AllocationFailure when it fits but the
+// memory couldn't be allocated
+uint64_t reassembly_add(Reassembly *reassembly, const uint8_t *chunk, uint64_t len, uint64_t now);
+
+// drops the incomplete messages that are too old, adding does this as well, the number dropped
+uint64_t reassembly_expire(Reassembly *reassembly, uint64_t now);
+
+// the complete message that was completed first, its message is NULL when there is none
+Reassembled reassembly_next(Reassembly *reassembly);
+
+// frees a message next returned, its data isn't valid anymore
+void reassembly_release(Reassembly *reassembly, Reassembled reassembled);
+
+// the incomplete messages and the bytes held, which stay within the limit
+uint64_t reassembly_pending(const Reassembly *reassembly);
+
+uint64_t reassembly_memory(const Reassembly *reassembly);
+
+void reassembly_free(Reassembly *reassembly);
+
+// NULL when it can't be allocated, reserved applies to every cover
+Covers *covers_new(uint64_t reserved);
+
+// scores the images, copying their pixels unless inplace, in which case they have to outlive the covers
+uint64_t covers_add(Covers *covers, ImageList imageList, bool inplace, Stats *stats);
+
+// the covers after it move down by one
+uint64_t covers_remove(Covers *covers, uint64_t index);
+
+uint64_t covers_len(const Covers *covers);
+
+Precomputed covers_allocate(Covers *covers, uint64_t dataLen, Stats *stats);
+
+void covers_free(Covers *covers);
+
+// the covers picked from a pool, by their position in it
+typedef struct Selection {
+    uint64_t *indices;
+    uint64_t len;
+    uint64_t capacity;  // what they carry together counting only squares at the floor, exact
+    uint64_t code;
+} Selection;
+
+// picks the fewest covers (SelectFewest) or the fewest pixels (SelectPixels) carrying dataLen bytes in squares
+// whose entropy, as calc_entropy gives it, is at least floor; only the most promising covers by sampled entropy
+// get scored in full, the pool's pixels are never copied
+Selection select_covers(ImageList pool, uint64_t dataLen, uint64_t reserved, uint64_t floor, uint64_t goal);
+
+void free_selection(Selection selection);
+
+// maps a file to read, BadImageFile when it can't be or isn't one of the formats above
+ImageFile map_image(const char *path);
+
+// writes dst as a copy of src and maps it to embed into, precompute_inplace and embed then work on the mapping
+ImageFile map_image_copy(const char *src, const char *dst);
+
+// stores what was embedded into the image in its file, call it before unmapping
+uint64_t sync_image(ImageFile *file);
+
+void unmap_image(ImageFile *file);
+
+// extracts straight from a mapped file, no decoding
+Extracted extract_file(const char *path, uint64_t reserved);
+
 extern const uint64_t SquareSize;
 
-extern const uint64_t OK, AllocationFailure, OversizedData, BadDataPiecesLen, BadPrecomputed, InvalidLen;
+extern const uint64_t SelectFewest, SelectPixels;
+
+extern const uint64_t OK, AllocationFailure, OversizedData, BadDataPiecesLen, BadPrecomputed, InvalidLen,
+        UnsupportedKernel, BadSquareSize, BadCachePath, BadBits, BadImageFile, BadCoverIndex,
+        StripFailure, BadChunk, ReassemblyFull;
+
+extern const uint64_t KernelScalar, KernelPortable, KernelSSE2, KernelAVX2;
+
+uint64_t set_threads(uint64_t threads);
+
+uint64_t get_threads(void);
+
+uint64_t best_kernel(void);
+
+// keeps the sorted squares of every cover in the directory, created when missing, NULL turns the cache off
+// precompute and extract then skip scoring and sorting a cover they have met before
+uint64_t set_cache(const char *directory);
 
+uint64_t use_kernel(uint64_t kernel);
+
+
+uint64_t square_size(const Image *image);
+
+uint64_t sample_bits(const Image *image);
+
+// the payload bytes a square of the image holds
+uint64_t square_len(const Image *image);
 
 uint64_t copy_imageList(ImageList *imageList);
 
-void calc_entropy(const Image *image, Square *square);
+uint64_t calc_entropy(const Image *image, uint64_t index);
 
 int compare_squares(const void *a, const void *b);
 
+void select_squares(Square *squares, uint64_t len, uint64_t count);
+
 uint64_t generate_squares(Image *image, uint64_t reservedSquareNum);
 
 uint64_t init_imageList(ImageList *imageList, uint64_t reserved);
 
 uint64_t count_images(ImageList *imageList, uint64_t dataLen, uint64_t reservedSquareNum);
 
+uint64_t count_images_bulk(ImageList *imageList, uint64_t dataLen, uint64_t reservedSquareNum);
+
 void prune_images(ImageList *imageList);
 
 void free_image(Image *image);
 
 void free_imageList(ImageList *imageList);
 
-void embed_len(Image *image, const Square *square, uint64_t len);
+void embed_len(Image *image, Square square, uint64_t len);
+
+void embed_len_scalar(Image *image, Square square, uint64_t len);
+
+void embed_square(Image *image, Square square, const uint8_t *data);
 
-void embed_square(Image *image, const Square *square, const uint8_t *data);
+void embed_square_scalar(Image *image, Square square, const uint8_t *data);
 
 void embed_image(Image *image, const Data *data);
 
@@ -95,8 +371,12 @@ void free_data(Data *data);
 
 void free_dataPieces(DataPieces *dataPieces);
 
-uint64_t extract_len(const Image *image, const Square *square);
+uint64_t extract_len(const Image *image, Square square);
+
+uint64_t extract_len_scalar(const Image *image, Square square);
+
+void extract_data(const Image *image, Square square, uint8_t *data);
 
-void extract_data(const Image *image, const Square *square, uint8_t *data);
+void extract_data_scalar(const Image *image, Square square, uint8_t *data);
 
 #endif
\ No newline at end of file
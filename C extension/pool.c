@@ -0,0 +1,145 @@
+#include "pool.h"
+#include "library.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+typedef struct Job {
+    Task task;
+    void *context;
+    uint64_t len, grain;
+    atomic_uint_fast64_t next;
+} Job;
+
+// held by whoever owns the workers: a parallel_for in progress or set_threads
+static pthread_mutex_t dispatch = PTHREAD_MUTEX_INITIALIZER;
+
+// protects everything below
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER, done = PTHREAD_COND_INITIALIZER;
+static Job *job = NULL;
+static uint64_t generation = 0, busy = 0;
+static bool stopping = false;
+
+// only touched while holding dispatch
+static pthread_t *workers = NULL;
+static uint64_t workerNum = 0, threadNum = 0;
+static bool started = false;
+
+static uint64_t cpu_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    const long count = (long) info.dwNumberOfProcessors;
+#else
+    const long count = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return count > 0 ? (uint64_t) count : 1;
+}
+
+static void run(Job *const current) {
+    for (;;) {
+        const uint64_t begin = atomic_fetch_add(&current->next, current->grain);
+        if (begin >= current->len) return;
+        const uint64_t end = current->len - begin < current->grain ? current->len : begin + current->grain;
+        current->task(current->context, begin, end);
+    }
+}
+
+static void *worker(void *const arg) {
+    uint64_t seen = (uint64_t) (uintptr_t) arg;
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        while (!stopping && generation == seen) pthread_cond_wait(&wake, &lock);
+        if (stopping) break;
+        seen = generation;
+        Job *const current = job;
+        pthread_mutex_unlock(&lock);
+        run(current);
+        pthread_mutex_lock(&lock);
+        if (--busy == 0) pthread_cond_signal(&done);
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+static void start_workers(void) {
+    started = true;
+    if (threadNum == 0) threadNum = cpu_count();
+    if (threadNum == 1) return;
+    workers = (pthread_t *) calloc(threadNum - 1, sizeof(pthread_t));
+    if (workers == NULL) return;
+    // a worker that fails to start only costs parallelism
+    for (; workerNum < threadNum - 1; ++workerNum) {
+        if (pthread_create(workers + workerNum, NULL, worker, (void *) (uintptr_t) generation) != 0) break;
+    }
+}
+
+static void stop_workers(void) {
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_broadcast(&wake);
+    pthread_mutex_unlock(&lock);
+    for (uint64_t i = 0; i < workerNum; ++i) pthread_join(workers[i], NULL);
+    free(workers);
+    workers = NULL;
+    workerNum = 0;
+    stopping = false;
+    started = false;
+}
+
+void parallel_for(const uint64_t len, uint64_t grain, const Task task, void *const context) {
+    if (len == 0) return;
+    if (grain == 0) grain = 1;
+    if (len <= grain || pthread_mutex_trylock(&dispatch) != 0) {
+        task(context, 0, len);
+        return;
+    }
+    if (!started) start_workers();
+    if (workerNum == 0) {
+        pthread_mutex_unlock(&dispatch);
+        task(context, 0, len);
+        return;
+    }
+
+    Job current = {.task = task, .context = context, .len = len, .grain = grain};
+    atomic_init(&current.next, 0);
+
+    pthread_mutex_lock(&lock);
+    job = &current;
+    busy = workerNum;
+    ++generation;
+    pthread_cond_broadcast(&wake);
+    pthread_mutex_unlock(&lock);
+
+    run(&current);
+
+    pthread_mutex_lock(&lock);
+    while (busy != 0) pthread_cond_wait(&done, &lock);
+    job = NULL;
+    pthread_mutex_unlock(&lock);
+
+    pthread_mutex_unlock(&dispatch);
+}
+
+uint64_t set_threads(const uint64_t threads) {
+    pthread_mutex_lock(&dispatch);
+    stop_workers();
+    threadNum = threads;
+    pthread_mutex_unlock(&dispatch);
+    return OK;
+}
+
+uint64_t get_threads(void) {
+    pthread_mutex_lock(&dispatch);
+    const uint64_t threads = threadNum == 0 ? cpu_count() : threadNum;
+    pthread_mutex_unlock(&dispatch);
+    return threads;
+}
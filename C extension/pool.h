@@ -0,0 +1,13 @@
+#ifndef STEGANO_POOL_H
+#define STEGANO_POOL_H
+
+#include <inttypes.h>
+
+// processes the items [begin, end) of a parallel loop
+typedef void (*Task)(void *context, uint64_t begin, uint64_t end);
+
+// runs task over [0, len) in chunks of grain items, on the calling thread and the pool workers
+// returns once every chunk is done; nested or concurrent calls run on the calling thread only
+void parallel_for(uint64_t len, uint64_t grain, Task task, void *context);
+
+#endif
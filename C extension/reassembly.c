@@ -0,0 +1,273 @@
+#include "library.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// the header distribution.split puts before the data of every chunk: id, chunk count, index and send time
+#define ChunkHeader 32
+#define KeyLen 24
+
+// a message by the id, chunk count and send time its chunks share, the same signature distribution.check uses
+typedef struct Message {
+    uint8_t key[KeyLen];
+    uint64_t hash;
+    uint64_t total, received, len, time;
+    uint64_t arrival;  // when its first chunk came in
+    uint64_t bytes;  // what it holds, counted against the limit
+    struct Message *prev, *next;  // the arrival order of incomplete messages, complete ones queue on next
+    Segment *chunks;
+    uint64_t *present;  // a bit per chunk, the data of an empty chunk being no sign of it
+} Message;
+
+struct Reassembly {
+    Message **slots;  // open addressing with linear probing, a power of two of them
+    uint64_t capacity, count;
+    Message *oldest, *newest;  // incomplete messages by arrival
+    Message *ready, *readyTail;  // complete messages not handed out yet
+    uint64_t pending;
+    uint64_t memory, memoryLimit, maxAge;
+};
+
+#define InitialSlots 64
+
+static uint64_t read_word(const uint8_t *const data) {
+    uint64_t value = 0;
+    for (uint64_t i = 0; i < 8; ++i) value |= (uint64_t) data[i] << i * 8;
+    return value;
+}
+
+// ids are random, but the count and time aren't, so every word is mixed in
+static uint64_t key_hash(const uint8_t *const key) {
+    uint64_t hash = 0x9E3779B97F4A7C15;
+    for (uint64_t i = 0; i < KeyLen; i += 8) {
+        hash ^= read_word(key + i);
+        hash *= 0xBF58476D1CE4E5B9;
+        hash ^= hash >> 31;
+    }
+    return hash;
+}
+
+Reassembly *reassembly_new(const uint64_t memoryLimit, const uint64_t maxAge) {
+    Reassembly *const reassembly = (Reassembly *) calloc(1, sizeof(Reassembly));
+    if (reassembly == NULL) return NULL;
+    reassembly->slots = (Message **) calloc(InitialSlots, sizeof(Message *));
+    if (reassembly->slots == NULL) {
+        free(reassembly);
+        return NULL;
+    }
+    reassembly->capacity = InitialSlots;
+    reassembly->memory = InitialSlots * sizeof(Message *);
+    reassembly->memoryLimit = memoryLimit;
+    reassembly->maxAge = maxAge;
+    return reassembly;
+}
+
+static uint64_t find_slot(const Reassembly *const reassembly, const uint8_t *const key, const uint64_t hash) {
+    const uint64_t mask = reassembly->capacity - 1;
+    uint64_t slot = hash & mask;
+    for (const Message *message; (message = reassembly->slots[slot]) != NULL; slot = (slot + 1) & mask) {
+        if (message->hash == hash && memcmp(message->key, key, KeyLen) == 0) break;
+    }
+    return slot;
+}
+
+// doubles the table once it is half full, false when the memory isn't there
+static bool grow_table(Reassembly *const reassembly) {
+    const uint64_t capacity = reassembly->capacity * 2;
+    Message **const slots = (Message **) calloc(capacity, sizeof(Message *));
+    if (slots == NULL) return false;
+    for (uint64_t i = 0; i < reassembly->capacity; ++i) {
+        Message *const message = reassembly->slots[i];
+        if (message == NULL) continue;
+        uint64_t slot = message->hash & (capacity - 1);
+        while (slots[slot] != NULL) slot = (slot + 1) & (capacity - 1);
+        slots[slot] = message;
+    }
+    free(reassembly->slots);
+    reassembly->memory += reassembly->capacity * sizeof(Message *);
+    reassembly->slots = slots;
+    reassembly->capacity = capacity;
+    return true;
+}
+
+// the messages after it in its run move back into the gap, so lookups never need tombstones
+static void remove_slot(Reassembly *const reassembly, uint64_t slot) {
+    const uint64_t mask = reassembly->capacity - 1;
+    for (uint64_t next = (slot + 1) & mask; reassembly->slots[next] != NULL; next = (next + 1) & mask) {
+        const uint64_t home = reassembly->slots[next]->hash & mask;
+        if (((next - home) & mask) < ((next - slot) & mask)) continue;
+        reassembly->slots[slot] = reassembly->slots[next];
+        slot = next;
+    }
+    reassembly->slots[slot] = NULL;
+    --reassembly->count;
+}
+
+static uint64_t room(const Reassembly *const reassembly) {
+    return reassembly->memory >= reassembly->memoryLimit ? 0 : reassembly->memoryLimit - reassembly->memory;
+}
+
+static void unlink_pending(Reassembly *const reassembly, Message *const message) {
+    if (message->prev != NULL) message->prev->next = message->next;
+    else reassembly->oldest = message->next;
+    if (message->next != NULL) message->next->prev = message->prev;
+    else reassembly->newest = message->prev;
+    message->prev = message->next = NULL;
+    --reassembly->pending;
+}
+
+static void free_message(Reassembly *const reassembly, Message *const message) {
+    remove_slot(reassembly, find_slot(reassembly, message->key, message->hash));
+    for (uint64_t i = 0; i < message->total; ++i) {
+        if (message->present[i / 64] >> i % 64 & 1) free((void *) message->chunks[i].data);
+    }
+    reassembly->memory -= message->bytes;
+    free(message);
+}
+
+// drops the incomplete messages whose first chunk came in more than maxAge ago
+uint64_t reassembly_expire(Reassembly *const reassembly, const uint64_t now) {
+    uint64_t expired = 0;
+    while (reassembly->maxAge != 0 && reassembly->oldest != NULL &&
+           now > reassembly->oldest->arrival + reassembly->maxAge) {
+        Message *const message = reassembly->oldest;
+        unlink_pending(reassembly, message);
+        free_message(reassembly, message);
+        ++expired;
+    }
+    return expired;
+}
+
+// makes room for needed more bytes by dropping the oldest incomplete messages but the one a chunk is for
+static bool make_room(Reassembly *const reassembly, const uint64_t needed, const Message *const keep) {
+    Message *message = reassembly->oldest;
+    while (room(reassembly) < needed && message != NULL) {
+        Message *const next = message->next;
+        if (message != keep) {
+            unlink_pending(reassembly, message);
+            free_message(reassembly, message);
+        }
+        message = next;
+    }
+    return room(reassembly) >= needed;
+}
+
+// ReassemblyFull when the limit leaves no room for it, AllocationFailure when the memory isn't there
+static uint64_t new_message(Reassembly *const reassembly, const uint8_t *const key, const uint64_t hash,
+                            const uint64_t total, const uint64_t time, const uint64_t now, Message **const result) {
+    const uint64_t words = (total + 63) / 64;
+    const uint64_t bytes = sizeof(Message) + total * sizeof(Segment) + words * sizeof(uint64_t);
+    // a table that is half full doubles, which takes as much again as it has
+    const bool grow = reassembly->count + 1 > reassembly->capacity / 2;
+    if (!make_room(reassembly, bytes + (grow ? reassembly->capacity * sizeof(Message *) : 0), NULL)) {
+        return ReassemblyFull;
+    }
+    if (grow && !grow_table(reassembly)) return AllocationFailure;
+
+    Message *const message = (Message *) calloc(1, bytes);
+    if (message == NULL) return AllocationFailure;
+    memcpy(message->key, key, KeyLen);
+    message->hash = hash;
+    message->total = total;
+    message->time = time;
+    message->arrival = now;
+    message->bytes = bytes;
+    message->chunks = (Segment *) (message + 1);
+    message->present = (uint64_t *) (message->chunks + total);
+
+    reassembly->slots[find_slot(reassembly, key, hash)] = message;
+    ++reassembly->count;
+    message->prev = reassembly->newest;
+    if (reassembly->newest != NULL) reassembly->newest->next = message;
+    else reassembly->oldest = message;
+    reassembly->newest = message;
+    ++reassembly->pending;
+    reassembly->memory += bytes;
+    *result = message;
+    return OK;
+}
+
+uint64_t reassembly_add(Reassembly *const reassembly, const uint8_t *const chunk, const uint64_t len,
+                        const uint64_t now) {
+    reassembly_expire(reassembly, now);
+    if (len < ChunkHeader) return BadChunk;
+    const uint64_t total = read_word(chunk + 8), index = read_word(chunk + 16), time = read_word(chunk + 24);
+    // like distribution.check: no chunk from the future or past its message's end, and none too old to finish
+    if (index >= total || time > now || (reassembly->maxAge != 0 && now > time + reassembly->maxAge)) {
+        return BadChunk;
+    }
+    // a count no limit could hold is refused before anything is sized by it
+    if (total > reassembly->memoryLimit / sizeof(Segment)) return ReassemblyFull;
+
+    uint8_t key[KeyLen];
+    memcpy(key, chunk, 8);
+    memcpy(key + 8, chunk + 8, 8);
+    memcpy(key + 16, chunk + 24, 8);
+    const uint64_t hash = key_hash(key);
+    Message *message = reassembly->slots[find_slot(reassembly, key, hash)];
+    if (message == NULL) {
+        const uint64_t code = new_message(reassembly, key, hash, total, time, now, &message);
+        if (code != OK) return code;
+    }
+
+    // a chunk sent again is dropped, the first copy is kept
+    if (message->present[index / 64] >> index % 64 & 1) return OK;
+    const uint64_t dataLen = len - ChunkHeader;
+    // only the limit stops this, make_room allocates nothing
+    if (!make_room(reassembly, dataLen, message)) return ReassemblyFull;
+    uint8_t *const data = (uint8_t *) malloc(dataLen == 0 ? 1 : dataLen);
+    if (data == NULL) return AllocationFailure;
+    memcpy(data, chunk + ChunkHeader, dataLen);
+    message->chunks[index] = (Segment) {data, dataLen};
+    message->present[index / 64] |= (uint64_t) 1 << index % 64;
+    message->bytes += dataLen;
+    message->len += dataLen;
+    reassembly->memory += dataLen;
+
+    if (++message->received == message->total) {
+        unlink_pending(reassembly, message);
+        if (reassembly->readyTail != NULL) reassembly->readyTail->next = message;
+        else reassembly->ready = message;
+        reassembly->readyTail = message;
+    }
+    return OK;
+}
+
+Reassembled reassembly_next(Reassembly *const reassembly) {
+    Message *const message = reassembly->ready;
+    if (message == NULL) return (Reassembled) {{0}, 0, {NULL, 0}, 0, NULL};
+    reassembly->ready = message->next;
+    if (reassembly->ready == NULL) reassembly->readyTail = NULL;
+    message->next = NULL;
+
+    Reassembled reassembled = {{0}, message->time, {message->chunks, message->total}, message->len, message};
+    memcpy(reassembled.id, message->key, 8);
+    return reassembled;
+}
+
+void reassembly_release(Reassembly *const reassembly, const Reassembled reassembled) {
+    if (reassembled.message != NULL) free_message(reassembly, (Message *) reassembled.message);
+}
+
+uint64_t reassembly_pending(const Reassembly *const reassembly) {
+    return reassembly->pending;
+}
+
+uint64_t reassembly_memory(const Reassembly *const reassembly) {
+    return reassembly->memory;
+}
+
+void reassembly_free(Reassembly *const reassembly) {
+    if (reassembly == NULL) return;
+    // complete messages handed out but not released are still in the table
+    for (uint64_t i = 0; i < reassembly->capacity; ++i) {
+        Message *const message = reassembly->slots[i];
+        if (message == NULL) continue;
+        for (uint64_t j = 0; j < message->total; ++j) {
+            if (message->present[j / 64] >> j % 64 & 1) free((void *) message->chunks[j].data);
+        }
+        free(message);
+    }
+    free(reassembly->slots);
+    free(reassembly);
+}
@@ -0,0 +1,75 @@
+#include "stats.h"
+
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+Collector *collector_begin(Collector *const collector, Stats *const stats, Arena *const arena) {
+    if (stats == NULL && arena == NULL) return NULL;
+    collector->stats = stats;
+    collector->arena = arena;
+    atomic_init(&collector->allocations, 0);
+    atomic_init(&collector->live, 0);
+    atomic_init(&collector->peak, 0);
+    return collector;
+}
+
+void collector_end(Collector *const collector) {
+    if (collector == NULL || collector->stats == NULL) return;
+    Stats *const stats = collector->stats;
+    stats->allocations += atomic_load(&collector->allocations);
+    const uint64_t peak = atomic_load(&collector->peak);
+    if (peak > stats->peakBytes) stats->peakBytes = peak;
+}
+
+static void count_allocation(Collector *const collector, const uint64_t size) {
+    if (collector->stats == NULL) return;
+    atomic_fetch_add(&collector->allocations, 1);
+    const uint64_t live = atomic_fetch_add(&collector->live, size) + size;
+    uint64_t peak = atomic_load(&collector->peak);
+    while (live > peak && !atomic_compare_exchange_weak(&collector->peak, &peak, live));
+}
+
+void *counted_malloc(Collector *const collector, const uint64_t size) {
+    if (collector_pooled(collector)) return arena_alloc(collector->arena, size, false);
+    void *const pointer = malloc(size);
+    if (collector != NULL && pointer != NULL) count_allocation(collector, size);
+    return pointer;
+}
+
+void *counted_calloc(Collector *const collector, const uint64_t count, const uint64_t size) {
+    if (collector_pooled(collector)) return arena_alloc(collector->arena, count * size, true);
+    void *const pointer = calloc(count, size);
+    if (collector != NULL && pointer != NULL) count_allocation(collector, count * size);
+    return pointer;
+}
+
+void counted_free(Collector *const collector, void *const pointer, const uint64_t size) {
+    if (collector_pooled(collector)) return;
+    if (collector != NULL && pointer != NULL) atomic_fetch_sub(&collector->live, size);
+    free(pointer);
+}
+
+bool collector_pooled(const Collector *const collector) {
+    return collector != NULL && collector->arena != NULL;
+}
+
+uint64_t collector_clock(const Collector *const collector) {
+    if (collector == NULL || collector->stats == NULL) return 0;
+    // a monotonic clock, the wall clock can jump between the two ends of a phase
+#ifdef _WIN32
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (uint64_t) (counter.QuadPart / frequency.QuadPart * 1000000000 +
+                       counter.QuadPart % frequency.QuadPart * 1000000000 / frequency.QuadPart);
+#else
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000000000 + (uint64_t) time.tv_nsec;
+#endif
+}
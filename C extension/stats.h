@@ -0,0 +1,43 @@
+#ifndef STEGANO_STATS_H
+#define STEGANO_STATS_H
+
+#include "arena.h"
+#include "library.h"
+
+#include <stdatomic.h>
+
+// gathers the stats of one call and the arena it allocates from, every helper does nothing but the plain work
+// when the collector is NULL
+// allocations may happen on pool workers, so only those counters are atomic
+typedef struct Collector {
+    Stats *stats;
+    Arena *arena;  // allocations come from it and are never freed on their own, NULL meaning the heap
+    atomic_uint_fast64_t allocations, live, peak;
+} Collector;
+
+// NULL when both stats and arena are NULL, so a plain call carries no collector at all
+Collector *collector_begin(Collector *collector, Stats *stats, Arena *arena);
+
+// adds the allocation counters to the caller's stats
+void collector_end(Collector *collector);
+
+void *counted_malloc(Collector *collector, uint64_t size);
+
+void *counted_calloc(Collector *collector, uint64_t count, uint64_t size);
+
+// size has to be what was allocated, arena memory stays until the arena is reset
+void counted_free(Collector *collector, void *pointer, uint64_t size);
+
+// the start of a timed phase in nanoseconds, 0 when nothing is collected
+uint64_t collector_clock(const Collector *collector);
+
+// whether allocations come from an arena, whose memory isn't worth giving back before the reset
+bool collector_pooled(const Collector *collector);
+
+// adds value to a field of the stats, only on the calling thread
+#define collect(collector, field, value) \
+    do { \
+        if ((collector) != NULL && (collector)->stats != NULL) (collector)->stats->field += (value); \
+    } while (0)
+
+#endif
@@ -1,9 +1,18 @@
 #include "library.h"
 
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef _WIN32
+#include <direct.h>
+#include <io.h>
+#else
+#include <dirent.h>
+#include <unistd.h>
+#endif
+
 const uint64_t IMAGE_LEN = 5;
 
 const uint64_t
@@ -19,7 +28,7 @@ Image createRandomImage(uint64_t w, uint64_t h, uint64_t c) {
     const uint64_t size = w * h * c;
     uint8_t *const pixels = (uint8_t *) calloc(size, sizeof(uint8_t));
     randFill(pixels, size);
-    return (Image) {w, h, c, pixels, {NULL, 0}, 0, false};
+    return (Image) {w, h, c, pixels, {NULL, 0}, 0, false, 0, 0};
 }
 
 ImageList createRandomImageList(void) {
@@ -30,7 +39,7 @@ ImageList createRandomImageList(void) {
         const uint64_t c = IMAGE_C[i];
         images[i] = createRandomImage(w, h, c);
     }
-    ImageList imageList = {images, IMAGE_LEN};
+    ImageList imageList = {images, IMAGE_LEN, false};
     return imageList;
 }
 
@@ -50,7 +59,7 @@ DataPieces splitData(Precomputed precomputed, Data data, uint64_t reserved) {
         Data *const piece = pieces + i;
         const Image *const image = precomputed.imageList.images + i;
 
-        piece->len = SquareSize * SquareSize * image->c / 8 * image->usage;
+        piece->len = square_len(image) * image->usage;
         if (dataIndex + piece->len - reserved > data.len) {
             piece->len = data.len - dataIndex + reserved;
         }
@@ -94,7 +103,7 @@ Data mergeDataPieces(const DataPieces dataPieces, const uint64_t reserved) {
     return data;
 }
 
-int main(void) {
+int testRoundTrip(void) {
     ImageList imageList = createRandomImageList();
     const Data data = randData(2025);
     const uint64_t reserved = 64;
@@ -117,11 +126,14 @@ int main(void) {
 
     DataPieces rDataPieces = extractImageList(embedded.imageList, reserved);
     Data rData = mergeDataPieces(rDataPieces, reserved);
+    int failed = 0;
 
     if (data.len != rData.len) {
         printf("Test failed: lengths don't match\n");
+        failed = 1;
     } else if (memcmp(data.data, rData.data, data.len) != 0) {
         printf("Test failed: data don't match\n");
+        failed = 1;
     } else {
         printf("Test Succeeded\n");
     }
@@ -131,5 +143,1414 @@ int main(void) {
     free_data(&rData);
     free_precomputed(precomputed);
 
-    return 0;
-}
\ No newline at end of file
+    return failed;
+}
+
+Image cloneImage(const Image *const image) {
+    const uint64_t size = image->w * image->h * image->c;
+    Image clone = createRandomImage(image->w, image->h, image->c);
+    memcpy(clone.pixels, image->pixels, size);
+    return clone;
+}
+
+int testKernels(void) {
+    const uint64_t best = best_kernel();
+    // squares (16, 0) and (32, 16) of a 64x48 image
+    const Square lenSquare = make_square(0, 1), dataSquare = make_square(0, 6);
+    int failed = 0;
+
+    for (uint64_t c = 1; c <= 4; ++c) {
+        Image original = createRandomImage(64, 48, c);
+        const uint64_t squareLen = SquareSize * SquareSize * c / 8;
+        const uint64_t len = ((uint64_t) rand() << 32) ^ (uint64_t) rand();
+        Data data = randData(squareLen);
+
+        Image reference = cloneImage(&original);
+        embed_len_scalar(&reference, lenSquare, len);
+        embed_square_scalar(&reference, dataSquare, data.data);
+        uint8_t *const rData = (uint8_t *) calloc(squareLen, sizeof(uint8_t));
+
+        for (uint64_t kernel = KernelScalar; kernel <= best; ++kernel) {
+            if (use_kernel(kernel) != OK) continue;
+            Image image = cloneImage(&original);
+            embed_len(&image, lenSquare, len);
+            embed_square(&image, dataSquare, data.data);
+            if (memcmp(image.pixels, reference.pixels, image.w * image.h * c) != 0) {
+                printf("Kernel test failed: kernel %" PRIu64 " embeds differently with %" PRIu64 " channels\n",
+                       kernel, c);
+                failed = 1;
+            }
+            memset(rData, 0, squareLen);
+            extract_data(&image, dataSquare, rData);
+            if (extract_len(&image, lenSquare) != len || memcmp(rData, data.data, squareLen) != 0) {
+                printf("Kernel test failed: kernel %" PRIu64 " extracts differently with %" PRIu64 " channels\n",
+                       kernel, c);
+                failed = 1;
+            }
+            free(image.pixels);
+        }
+
+        free(rData);
+        free(reference.pixels);
+        free(original.pixels);
+        free(data.data);
+    }
+
+    use_kernel(best);
+    if (!failed) printf("Kernel Test Succeeded\n");
+    return failed;
+}
+
+double referenceEntropy(const Image *const image, const Square square) {
+    const uint64_t size = square_size(image);
+    const uint64_t squareW = image->w / size;
+    const uint64_t squareX = square_index(square) % squareW * size;
+    const uint64_t squareY = square_index(square) / squareW * size;
+    double entropy = 0.;
+    for (uint64_t c = 0; c < image->c; ++c) {
+        uint64_t map[128] = {0};
+        for (uint64_t y = 0; y < size; ++y)
+            for (uint64_t x = 0; x < size; ++x)
+                ++map[image->pixels[((squareY + y) * image->w + squareX + x) * image->c + c] >> 1];
+        for (uint64_t i = 0; i < 128; ++i) {
+            if (map[i] == 0) continue;
+            const double p = (double) map[i] / (double) (size * size);
+            entropy -= p * log2(p);
+        }
+    }
+    return entropy / (double) image->c;
+}
+
+int testEntropy(void) {
+    // scores are H * 12 * N in fixed point, N being the pixels in a default square whatever the size
+    const double scale = (double) (12 * SquareSize * SquareSize << 14);
+    const uint64_t sizes[] = {8, 16, 32};
+    int failed = 0;
+
+    for (uint64_t c = 1; c <= 5; ++c) for (uint64_t s = 0; s < 3; ++s) {
+        Image image = createRandomImage(160, 96, c);
+        image.squareSize = sizes[s];
+        // a flat square, a two-valued square and a square filling a single bin
+        memset(image.pixels, 0, 160 * 16 * c);
+        for (uint64_t y = 0; y < SquareSize; ++y)
+            for (uint64_t x = 16; x < 32; ++x)
+                memset(image.pixels + (y * 160 + x) * c, (int) (x & 2), c);
+        for (uint64_t y = 0; y < SquareSize; ++y) memset(image.pixels + (y * 160 + 32) * c, 200, 16 * c);
+
+        if (generate_squares(&image, 0) != OK) return 1;
+        const SquareList list = image.squareList;
+        for (uint64_t i = 0; i < list.len; ++i) {
+            const Square square = list.squares[i];
+            if (fabs((double) square_entropy(square) / scale - referenceEntropy(&image, square)) > 1e-4) {
+                printf("Entropy test failed: square %" PRIu64 " of size %" PRIu64 " with %" PRIu64 " channels is off\n",
+                       square_index(square), sizes[s], c);
+                failed = 1;
+            }
+            if (i != 0 && compare_squares(list.squares + i - 1, list.squares + i) >= 0) {
+                printf("Entropy test failed: squares aren't strictly ordered\n");
+                failed = 1;
+            }
+        }
+        free(image.squareList.squares);
+        free(image.pixels);
+    }
+
+    if (!failed) printf("Entropy Test Succeeded\n");
+    return failed;
+}
+
+int testThreads(void) {
+    ImageList imageList = createRandomImageList();
+    const Data data = randData(20000);
+    const uint64_t reserved = 64;
+    const uint64_t threads[] = {1, 4};
+    Precomputed results[2];
+    int failed = 0;
+
+    for (uint64_t i = 0; i < 2; ++i) {
+        set_threads(threads[i]);
+        results[i] = precompute(imageList, data.len, reserved);
+        if (results[i].code != OK) {
+            printf("Thread test failed: precomputation failed with %" PRIu64 " threads\n", threads[i]);
+            return 1;
+        }
+        srand(1);
+        DataPieces dataPieces = splitData(results[i], data, reserved);
+        embed(results[i], dataPieces);
+        free_dataPieces(&dataPieces);
+    }
+
+    for (uint64_t i = 0; i < IMAGE_LEN; ++i) {
+        const Image *const single = results[0].imageList.images + i, *const multiple = results[1].imageList.images + i;
+        if (single->usage != multiple->usage ||
+            memcmp(single->pixels, multiple->pixels, single->w * single->h * single->c) != 0) {
+            printf("Thread test failed: image %" PRIu64 " differs between 1 and 4 threads\n", i);
+            failed = 1;
+        }
+        Extracted extracted = extract(*multiple, reserved);
+        Extracted expected = extract(*single, reserved);
+        if (extracted.code != OK || expected.code != OK || extracted.data.len != expected.data.len ||
+            memcmp(extracted.data.data, expected.data.data, expected.data.len) != 0) {
+            printf("Thread test failed: image %" PRIu64 " extracts differently with 4 threads\n", i);
+            failed = 1;
+        }
+        free_extracted(extracted);
+        free_extracted(expected);
+    }
+
+    set_threads(0);
+    free_precomputed(results[0]);
+    free_precomputed(results[1]);
+    free_imageList(&imageList);
+    if (!failed) printf("Thread Test Succeeded\n");
+    return failed;
+}
+
+int testSelection(void) {
+    const uint64_t len = 5000;
+    Square *const squares = (Square *) calloc(len, sizeof(Square));
+    Square *const sorted = (Square *) calloc(len, sizeof(Square));
+    int failed = 0;
+
+    for (uint64_t count = 1; count <= len; count = count * 3 + 1) {
+        // few distinct entropies, so that the position has to break most ties
+        for (uint64_t i = 0; i < len; ++i) squares[i] = make_square((uint64_t) rand() % 50, i);
+        memcpy(sorted, squares, len * sizeof(Square));
+        qsort(sorted, len, sizeof(Square), compare_squares);
+        select_squares(squares, len, count);
+        if (memcmp(squares, sorted, count * sizeof(Square)) != 0) {
+            printf("Selection test failed: the best %" PRIu64 " squares differ\n", count);
+            failed = 1;
+        }
+    }
+
+    free(squares);
+    free(sorted);
+    if (!failed) printf("Selection Test Succeeded\n");
+    return failed;
+}
+
+// the original allocation, one square at a time by scanning every image
+void countImagesLinear(ImageList *const imageList, const uint64_t dataLen, const uint64_t reserved) {
+    uint64_t *const squareIndex = (uint64_t *) calloc(imageList->len, sizeof(uint64_t));
+    uint64_t size = 0;
+    for (uint64_t i = 0; i < imageList->len; ++i) {
+        Image *const image = imageList->images + i;
+        const uint64_t squareLen = SquareSize * SquareSize * image->c / 8;
+        const uint64_t count = (reserved + squareLen - 1) / squareLen;
+        squareIndex[i] = count + 1;
+        image->usage = count;
+        size += squareLen * count - reserved;
+    }
+    while (size < dataLen) {
+        uint64_t maxEntropy = 0;
+        Image *maxImage = NULL;
+        uint64_t maxIndex = 0;
+        for (uint64_t i = 0; i < imageList->len; ++i) {
+            const Image *const image = imageList->images + i;
+            if (image->squareList.squares == NULL || squareIndex[i] == image->squareList.len) continue;
+            if (square_entropy(image->squareList.squares[squareIndex[i]]) > maxEntropy) {
+                maxEntropy = square_entropy(image->squareList.squares[squareIndex[i]]);
+                maxImage = imageList->images + i;
+                maxIndex = i;
+            }
+        }
+        if (maxImage == NULL) break;
+        ++(squareIndex[maxIndex]);
+        ++(maxImage->usage);
+        size += SquareSize * SquareSize * maxImage->c / 8;
+    }
+    free(squareIndex);
+}
+
+int testAllocation(void) {
+    // the same cover twice makes every entropy tie across images
+    ImageList original = createRandomImageList();
+    Image images[IMAGE_LEN + 1];
+    memcpy(images, original.images, IMAGE_LEN * sizeof(Image));
+    images[IMAGE_LEN] = images[1];
+    ImageList imageList = {images, IMAGE_LEN + 1, false};
+    const uint64_t reserved = 64;
+    int failed = 0;
+
+    if (init_imageList(&imageList, reserved) != OK) return 1;
+    for (uint64_t dataLen = 0; dataLen < 1000000; dataLen += 1 + dataLen / 4) {
+        uint64_t expected[IMAGE_LEN + 1];
+        countImagesLinear(&imageList, dataLen, reserved);
+        for (uint64_t i = 0; i <= IMAGE_LEN; ++i) expected[i] = imageList.images[i].usage;
+
+        for (uint64_t bulk = 0; bulk < 2; ++bulk) {
+            if (bulk) count_images_bulk(&imageList, dataLen, reserved);
+            else count_images(&imageList, dataLen, reserved);
+            for (uint64_t i = 0; i <= IMAGE_LEN; ++i) {
+                if (imageList.images[i].usage == expected[i]) continue;
+                printf("Allocation test failed: %s allocation differs for %" PRIu64 " bytes\n",
+                       bulk ? "bulk" : "heap", dataLen);
+                failed = 1;
+                break;
+            }
+        }
+    }
+
+    free_imageList(&imageList);
+    free_imageList(&original);
+    if (!failed) printf("Allocation Test Succeeded\n");
+    return failed;
+}
+
+int testInplace(void) {
+    ImageList imageList = createRandomImageList();
+    const Data data = randData(20000);
+    const uint64_t reserved = 64;
+    int failed = 0;
+
+    Precomputed copied = precompute(imageList, data.len, reserved);
+    Precomputed inplace = precompute_inplace(imageList, data.len, reserved);
+    if (copied.code != OK || inplace.code != OK || inplace.imageList.images != imageList.images) {
+        printf("Inplace test failed: precomputation didn't work on the caller's images\n");
+        return 1;
+    }
+    for (uint64_t i = 0; i < 2; ++i) {
+        srand(1);
+        DataPieces dataPieces = splitData(i ? inplace : copied, data, reserved);
+        embed(i ? inplace : copied, dataPieces);
+        free_dataPieces(&dataPieces);
+    }
+
+    for (uint64_t i = 0; i < IMAGE_LEN; ++i) {
+        const Image *const image = imageList.images + i;
+        if (memcmp(image->pixels, copied.imageList.images[i].pixels, image->w * image->h * image->c) != 0) {
+            printf("Inplace test failed: image %" PRIu64 " wasn't embedded in place\n", i);
+            failed = 1;
+        }
+        Extracted extracted = extract_inplace(*image, reserved);
+        Extracted expected = extract(copied.imageList.images[i], reserved);
+        if (extracted.code != OK || extracted.data.len != expected.data.len ||
+            memcmp(extracted.data.data, expected.data.data, expected.data.len) != 0) {
+            printf("Inplace test failed: image %" PRIu64 " extracts differently in place\n", i);
+            failed = 1;
+        }
+        free_extracted(extracted);
+        free_extracted(expected);
+    }
+
+    // the caller still owns its array and pixels after this
+    free_precomputed(inplace);
+    free_precomputed(copied);
+    for (uint64_t i = 0; i < IMAGE_LEN; ++i) free(imageList.images[i].pixels);
+    free(imageList.images);
+    if (!failed) printf("Inplace Test Succeeded\n");
+    return failed;
+}
+
+int testStream(void) {
+    ImageList imageList = createRandomImageList();
+    const Data data = randData(20000);
+    const uint64_t reserved = 64;
+    const uint64_t chunks[] = {1, 7, 96, 1000, 1 << 20};
+    int failed = 0;
+
+    Precomputed precomputed = precompute(imageList, data.len, reserved);
+    if (precomputed.code != OK) return 1;
+    DataPieces dataPieces = splitData(precomputed, data, reserved);
+    embed(precomputed, dataPieces);
+
+    for (uint64_t i = 0; i < IMAGE_LEN; ++i) {
+        const Image image = precomputed.imageList.images[i];
+        Extracted expected = extract(image, reserved);
+        uint8_t *const streamed = (uint8_t *) calloc(expected.data.len + 1, sizeof(uint8_t));
+        for (uint64_t j = 0; j < sizeof(chunks) / sizeof(uint64_t); ++j) {
+            ExtractCursor cursor = extract_begin(image, reserved);
+            uint64_t len = 0;
+            for (uint64_t read = 1; read != 0; len += read) {
+                const uint64_t room = expected.data.len + 1 - len;
+                read = extract_read(&cursor, streamed + len, chunks[j] < room ? chunks[j] : room);
+            }
+            extract_end(&cursor);
+            if (cursor.code != OK || len != expected.data.len || memcmp(streamed, expected.data.data, len) != 0) {
+                printf("Stream test failed: image %" PRIu64 " streams differently in chunks of %" PRIu64 "\n",
+                       i, chunks[j]);
+                failed = 1;
+            }
+        }
+        free(streamed);
+        free_extracted(expected);
+    }
+
+    free_dataPieces(&dataPieces);
+    free_precomputed(precomputed);
+    if (!failed) printf("Stream Test Succeeded\n");
+    return failed;
+}
+
+int testList(void) {
+    ImageList imageList = createRandomImageList();
+    const Data data = randData(20000);
+    const uint64_t reserved = 64;
+    int failed = 0;
+
+    Precomputed precomputed = precompute(imageList, data.len, reserved);
+    if (precomputed.code != OK) return 1;
+    DataPieces dataPieces = splitData(precomputed, data, reserved);
+    embed(precomputed, dataPieces);
+
+    // a cover nothing was embedded into sits between the stego images
+    Image images[IMAGE_LEN + 1];
+    const uint64_t bad = 2;
+    for (uint64_t i = 0, j = 0; i < IMAGE_LEN + 1; ++i) {
+        images[i] = i == bad ? createRandomImage(300, 200, 3) : precomputed.imageList.images[j++];
+    }
+    ExtractedList extracted = extract_list((ImageList) {images, IMAGE_LEN + 1, false}, reserved);
+    if (extracted.code != OK) {
+        printf("List test failed: code %" PRIu64 "\n", extracted.code);
+        failed = 1;
+    }
+
+    for (uint64_t i = 0; !failed && i < IMAGE_LEN + 1; ++i) {
+        const Data piece = extracted.dataPieces.pieces[i];
+        if (i == bad) {
+            if (extracted.codes[i] != InvalidLen || piece.data != NULL) {
+                printf("List test failed: the cover was extracted\n");
+                failed = 1;
+            }
+            continue;
+        }
+        Extracted expected = extract(images[i], reserved);
+        if (extracted.codes[i] != OK || piece.len != expected.data.len ||
+            memcmp(piece.data, expected.data.data, piece.len) != 0) {
+            printf("List test failed: image %" PRIu64 " extracts differently\n", i);
+            failed = 1;
+        }
+        free_extracted(expected);
+    }
+
+    free_extractedList(extracted);
+    free(images[bad].pixels);
+    free_dataPieces(&dataPieces);
+    free_precomputed(precomputed);
+    if (!failed) printf("List Test Succeeded\n");
+    return failed;
+}
+
+int testSquareSizes(void) {
+    ImageList imageList = createRandomImageList();
+    const Data data = randData(20000);
+    const uint64_t reserved = 64;
+    // every size on its own, then a mix of them in one message
+    const uint64_t sizes[][5] = {{8, 8, 8, 8, 8}, {32, 32, 32, 32, 32}, {8, 0, 32, 16, 32}};
+    int failed = 0;
+
+    for (uint64_t s = 0; s < 3; ++s) {
+        for (uint64_t i = 0; i < IMAGE_LEN; ++i) imageList.images[i].squareSize = sizes[s][i];
+        Precomputed precomputed = precompute(imageList, data.len, reserved);
+        if (precomputed.code != OK) {
+            printf("Square size test failed: precomputation failed with sizes %" PRIu64 "\n", s);
+            failed = 1;
+            continue;
+        }
+        DataPieces dataPieces = splitData(precomputed, data, reserved);
+        embed(precomputed, dataPieces);
+
+        // extraction has to find the size in the header
+        Image images[IMAGE_LEN];
+        for (uint64_t i = 0; i < IMAGE_LEN; ++i) {
+            images[i] = precomputed.imageList.images[i];
+            images[i].squareSize = 0;
+        }
+        ExtractedList extracted = extract_list((ImageList) {images, IMAGE_LEN, false}, reserved);
+        for (uint64_t i = 0; i < IMAGE_LEN; ++i) {
+            const Data piece = dataPieces.pieces[i];
+            const Data rPiece = extracted.dataPieces.pieces[i];
+            Extracted single = extract(images[i], reserved);
+            if (extracted.codes[i] != OK || rPiece.len != piece.len || memcmp(rPiece.data, piece.data, piece.len) != 0 ||
+                single.code != OK || single.data.len != piece.len ||
+                memcmp(single.data.data, piece.data, piece.len) != 0) {
+                printf("Square size test failed: image %" PRIu64 " with size %" PRIu64 " extracts differently\n",
+                       i, sizes[s][i]);
+                failed = 1;
+            }
+            free_extracted(single);
+        }
+
+        free_extractedList(extracted);
+        free_dataPieces(&dataPieces);
+        free_precomputed(precomputed);
+    }
+
+    imageList.images[0].squareSize = 12;
+    Precomputed precomputed = precompute(imageList, data.len, reserved);
+    Extracted extracted = extract(imageList.images[0], reserved);
+    if (precomputed.code != BadSquareSize || extracted.code != BadSquareSize) {
+        printf("Square size test failed: a size of 12 was accepted\n");
+        failed = 1;
+    }
+
+    free_imageList(&imageList);
+    if (!failed) printf("Square Size Test Succeeded\n");
+    return failed;
+}
+
+int testStats(void) {
+    ImageList imageList = createRandomImageList();
+    const Data data = randData(20000);
+    const uint64_t reserved = 64;
+    Stats stats = {0};
+    int failed = 0;
+
+    Precomputed precomputed = precompute_stats(imageList, data.len, reserved, false, &stats);
+    Precomputed expected = precompute_stats(imageList, data.len, reserved, false, NULL);
+    if (precomputed.code != OK || expected.code != OK) return 1;
+    uint64_t squares = 0, used = 0;
+    for (uint64_t i = 0; i < IMAGE_LEN; ++i) {
+        const Image *const image = imageList.images + i;
+        squares += (image->w / SquareSize) * (image->h / SquareSize);
+        used += precomputed.imageList.images[i].usage + 1;
+        if (precomputed.imageList.images[i].usage != expected.imageList.images[i].usage) failed = 1;
+    }
+    if (failed || stats.squaresEvaluated != squares || stats.squaresUsed != used || stats.allocations == 0 ||
+        stats.peakBytes == 0 || stats.bytesTouched == 0) {
+        printf("Stats test failed: precomputation counted wrong\n");
+        failed = 1;
+    }
+
+    DataPieces dataPieces = splitData(precomputed, data, reserved);
+    stats = (Stats) {0};
+    embed_stats(precomputed, dataPieces, &stats);
+    if (stats.squaresUsed == 0 || stats.squaresUsed > used || stats.squaresEvaluated != 0) {
+        printf("Stats test failed: embedding counted wrong\n");
+        failed = 1;
+    }
+
+    for (uint64_t i = 0; i < IMAGE_LEN; ++i) {
+        stats = (Stats) {0};
+        // the pixels belong to the precomputation, a borrowed view makes extraction copy them
+        Image image = precomputed.imageList.images[i];
+        image.copied = false;
+        Extracted extracted = extract_stats(image, reserved, false, &stats);
+        const uint64_t pixels = image.w * image.h * image.c;
+        // the copy is the biggest allocation, then come the squares
+        if (extracted.code != OK || extracted.data.len != dataPieces.pieces[i].len || stats.peakBytes < pixels ||
+            stats.squaresEvaluated != (image.w / SquareSize) * (image.h / SquareSize) || stats.bytesTouched < pixels) {
+            printf("Stats test failed: image %" PRIu64 " extraction counted wrong\n", i);
+            failed = 1;
+        }
+        free_extracted(extracted);
+    }
+
+    free_dataPieces(&dataPieces);
+    free_precomputed(precomputed);
+    free_precomputed(expected);
+    if (!failed) printf("Stats Test Succeeded\n");
+    return failed;
+}
+
+int testContext(void) {
+    ImageList imageList = createRandomImageList();
+    const Data data = randData(20000);
+    const uint64_t reserved = 64;
+    Context *const context = context_new();
+    uint64_t capacity = 0;
+    int failed = 0;
+
+    Precomputed expected = precompute(imageList, data.len, reserved);
+    if (context == NULL || expected.code != OK) return 1;
+    srand(1);
+    DataPieces dataPieces = splitData(expected, data, reserved);
+    embed(expected, dataPieces);
+
+    for (uint64_t round = 0; round < 3; ++round) {
+        context_reset(context);
+        Precomputed precomputed = precompute_context(context, imageList, data.len, reserved, false);
+        if (precomputed.code != OK) {
+            printf("Context test failed: precomputation failed in round %" PRIu64 "\n", round);
+            failed = 1;
+            break;
+        }
+        srand(1);
+        DataPieces pieces = splitData(precomputed, data, reserved);
+        embed_context(context, precomputed, pieces);
+
+        for (uint64_t i = 0; i < IMAGE_LEN; ++i) {
+            const Image *const image = precomputed.imageList.images + i;
+            Extracted extracted = extract_context(context, *image, reserved, true);
+            if (memcmp(image->pixels, expected.imageList.images[i].pixels, image->w * image->h * image->c) != 0 ||
+                extracted.code != OK || extracted.data.padded || extracted.data.len != dataPieces.pieces[i].len ||
+                memcmp(extracted.data.data, dataPieces.pieces[i].data, extracted.data.len) != 0) {
+                printf("Context test failed: image %" PRIu64 " differs in round %" PRIu64 "\n", i, round);
+                failed = 1;
+            }
+        }
+        // the caller's pieces were never padded by the context
+        for (uint64_t i = 0; i < IMAGE_LEN; ++i) free(pieces.pieces[i].data);
+        free(pieces.pieces);
+
+        // the first round sizes the arena, the ones after it don't allocate
+        if (round == 1) capacity = context_capacity(context);
+        if (round == 2 && context_capacity(context) != capacity) {
+            printf("Context test failed: the arena grew after it was sized\n");
+            failed = 1;
+        }
+    }
+
+    context_free(context);
+    free_dataPieces(&dataPieces);
+    free_precomputed(expected);
+    free_imageList(&imageList);
+    if (!failed) printf("Context Test Succeeded\n");
+    return failed;
+}
+
+// a directory of its own for every run, so no run finds what an earlier one cached
+bool makeTempDirectory(char *const path, const uint64_t len) {
+#ifdef _WIN32
+    const char *const base = getenv("TEMP");
+    snprintf(path, len, "%s\\stegano_cache_XXXXXX", base != NULL ? base : ".");
+    return _mktemp_s(path, strlen(path) + 1) == 0 && _mkdir(path) == 0;
+#else
+    const char *const base = getenv("TMPDIR");
+    snprintf(path, len, "%s/stegano_cache_XXXXXX", base != NULL && base[0] != '\0' ? base : "/tmp");
+    return mkdtemp(path) != NULL;
+#endif
+}
+
+// the cache writes no subdirectories, so the files and then the directory go
+void removeDirectory(const char *const path) {
+    char file[4096];
+#ifdef _WIN32
+    struct _finddata_t entry;
+    snprintf(file, sizeof(file), "%s\\*", path);
+    const intptr_t handle = _findfirst(file, &entry);
+    if (handle != -1) {
+        do {
+            snprintf(file, sizeof(file), "%s\\%s", path, entry.name);
+            if (!(entry.attrib & _A_SUBDIR)) remove(file);
+        } while (_findnext(handle, &entry) == 0);
+        _findclose(handle);
+    }
+    _rmdir(path);
+#else
+    DIR *const directory = opendir(path);
+    if (directory != NULL) {
+        for (const struct dirent *entry; (entry = readdir(directory)) != NULL;) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+            snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+            remove(file);
+        }
+        closedir(directory);
+    }
+    rmdir(path);
+#endif
+}
+
+int testCache(void) {
+    ImageList imageList = createRandomImageList();
+    const Data data = randData(20000);
+    const uint64_t reserved = 64;
+    int failed = 0;
+
+    char directory[1024];
+    if (!makeTempDirectory(directory, sizeof(directory))) return 1;
+    Precomputed expected = precompute(imageList, data.len, reserved);
+    if (expected.code != OK || set_cache(directory) != OK) {
+        removeDirectory(directory);
+        return 1;
+    }
+    srand(1);
+    DataPieces dataPieces = splitData(expected, data, reserved);
+    embed(expected, dataPieces);
+
+    // the first round may fill the cache, the second one has to find every cover in it
+    for (uint64_t round = 0; round < 2; ++round) {
+        Stats stats = {0};
+        Precomputed precomputed = precompute_stats(imageList, data.len, reserved, false, &stats);
+        if (precomputed.code != OK || (round == 1 && stats.cacheHits != IMAGE_LEN)) {
+            printf("Cache test failed: %" PRIu64 " covers were cached in round %" PRIu64 "\n", stats.cacheHits, round);
+            failed = 1;
+        }
+        for (uint64_t i = 0; precomputed.code == OK && i < IMAGE_LEN; ++i) {
+            const SquareList list = precomputed.imageList.images[i].squareList;
+            const SquareList expectedList = expected.imageList.images[i].squareList;
+            if (precomputed.imageList.images[i].usage != expected.imageList.images[i].usage ||
+                memcmp(list.squares, expectedList.squares, expectedList.len * sizeof(Square)) != 0) {
+                printf("Cache test failed: image %" PRIu64 " is ordered differently in round %" PRIu64 "\n",
+                       i, round);
+                failed = 1;
+            }
+        }
+        free_precomputed(precomputed);
+    }
+
+    // the stego images share the hash of their covers
+    for (uint64_t i = 0; i < IMAGE_LEN; ++i) {
+        Stats stats = {0};
+        Extracted extracted = extract_stats(expected.imageList.images[i], reserved, true, &stats);
+        if (stats.cacheHits != 1 || extracted.code != OK || extracted.data.len != dataPieces.pieces[i].len ||
+            memcmp(extracted.data.data, dataPieces.pieces[i].data, extracted.data.len) != 0) {
+            printf("Cache test failed: image %" PRIu64 " extracts differently from the cache\n", i);
+            failed = 1;
+        }
+        free_extracted(extracted);
+    }
+
+    // a cover that changed beyond its lowest bits misses
+    Stats stats = {0};
+    imageList.images[0].pixels[0] ^= 0x80;
+    Precomputed changed = precompute_stats(imageList, data.len, reserved, false, &stats);
+    if (changed.code != OK || stats.cacheHits != IMAGE_LEN - 1) {
+        printf("Cache test failed: a changed cover was found in the cache\n");
+        failed = 1;
+    }
+
+    set_cache(NULL);
+    removeDirectory(directory);
+    free_precomputed(changed);
+    free_dataPieces(&dataPieces);
+    free_precomputed(expected);
+    free_imageList(&imageList);
+    if (!failed) printf("Cache Test Succeeded\n");
+    return failed;
+}
+
+int testBits(void) {
+    ImageList imageList = createRandomImageList();
+    const Data data = randData(20000);
+    const uint64_t reserved = 64;
+    uint64_t squares[4] = {0};
+    int failed = 0;
+
+    // every depth on its own and mixed with square sizes, extraction has to find both in the header
+    for (uint64_t bits = 1; bits <= 5; ++bits) {
+        for (uint64_t i = 0; i < IMAGE_LEN; ++i) {
+            imageList.images[i].bits = bits == 5 ? i % 4 + 1 : bits;
+            imageList.images[i].squareSize = bits == 5 ? (uint64_t[]) {8, 16, 32}[i % 3] : 0;
+        }
+        Precomputed precomputed = precompute(imageList, data.len, reserved);
+        if (precomputed.code != OK) {
+            printf("Bits test failed: precomputation failed with %" PRIu64 " bits\n", bits);
+            failed = 1;
+            continue;
+        }
+        DataPieces dataPieces = splitData(precomputed, data, reserved);
+        embed(precomputed, dataPieces);
+
+        Image images[IMAGE_LEN];
+        for (uint64_t i = 0; i < IMAGE_LEN; ++i) {
+            images[i] = precomputed.imageList.images[i];
+            images[i].squareSize = images[i].bits = 0;
+            if (bits < 5) squares[bits - 1] += precomputed.imageList.images[i].usage;
+        }
+        ExtractedList extracted = extract_list((ImageList) {images, IMAGE_LEN, false}, reserved);
+        for (uint64_t i = 0; i < IMAGE_LEN; ++i) {
+            const Data piece = dataPieces.pieces[i];
+            const Data rPiece = extracted.dataPieces.pieces[i];
+            Extracted single = extract(images[i], reserved);
+            if (extracted.codes[i] != OK || rPiece.len != piece.len || memcmp(rPiece.data, piece.data, piece.len) != 0 ||
+                single.code != OK || single.data.len != piece.len ||
+                memcmp(single.data.data, piece.data, piece.len) != 0) {
+                printf("Bits test failed: image %" PRIu64 " with %" PRIu64 " bits extracts differently\n", i, bits);
+                failed = 1;
+            }
+            free_extracted(single);
+        }
+
+        free_extractedList(extracted);
+        free_dataPieces(&dataPieces);
+        free_precomputed(precomputed);
+    }
+
+    // more bits per byte take fewer squares for the same payload
+    for (uint64_t bits = 1; bits < 4; ++bits) {
+        if (squares[bits] >= squares[bits - 1]) {
+            printf("Bits test failed: %" PRIu64 " bits don't take fewer squares\n", bits + 1);
+            failed = 1;
+        }
+    }
+
+    imageList.images[0].squareSize = 0;
+    imageList.images[0].bits = 5;
+    Precomputed precomputed = precompute(imageList, data.len, reserved);
+    Extracted extracted = extract(imageList.images[0], reserved);
+    if (precomputed.code != BadBits || extracted.code != BadBits) {
+        printf("Bits test failed: 5 bits were accepted\n");
+        failed = 1;
+    }
+
+    free_imageList(&imageList);
+    if (!failed) printf("Bits Test Succeeded\n");
+    return failed;
+}
+
+int testSegments(void) {
+    ImageList imageList = createRandomImageList();
+    const Data data = randData(30000);
+    const uint64_t reserved = 64;
+    int failed = 0;
+
+    for (uint64_t i = 0; i < IMAGE_LEN; ++i) {
+        imageList.images[i].bits = i % 4 + 1;
+        imageList.images[i].squareSize = (uint64_t[]) {8, 16, 32}[i % 3];
+    }
+    Precomputed expected = precompute(imageList, data.len, reserved);
+    Precomputed precomputed = precompute(imageList, data.len, reserved);
+    if (expected.code != OK || precomputed.code != OK) return 1;
+    DataPieces dataPieces = splitData(expected, data, reserved);
+
+    // every piece cut into a header, an empty segment and two uneven halves
+    const uint64_t len = expected.imageList.len;
+    Segment *const segments = (Segment *) calloc(len * 4, sizeof(Segment));
+    Segments *const pieces = (Segments *) calloc(len, sizeof(Segments));
+    for (uint64_t i = 0; i < len; ++i) {
+        const Data piece = dataPieces.pieces[i];
+        const uint64_t half = reserved + (piece.len - reserved) / 3;
+        segments[i * 4] = (Segment) {piece.data, 32};
+        segments[i * 4 + 1] = (Segment) {piece.data + 32, 0};
+        segments[i * 4 + 2] = (Segment) {piece.data + 32, half - 32};
+        segments[i * 4 + 3] = (Segment) {piece.data + half, piece.len - half};
+        pieces[i] = (Segments) {segments + i * 4, 4};
+    }
+    Embedded embedded = embed_segments(precomputed, (SegmentPieces) {pieces, len});
+    embed(expected, dataPieces);
+
+    for (uint64_t i = 0; embedded.code == OK && i < len; ++i) {
+        const Image *const image = precomputed.imageList.images + i;
+        const Image *const expectedImage = expected.imageList.images + i;
+        Extracted extracted = extract(*image, reserved);
+        if (memcmp(image->pixels, expectedImage->pixels, image->w * image->h * image->c) != 0 ||
+            extracted.code != OK || extracted.data.len != dataPieces.pieces[i].len ||
+            memcmp(extracted.data.data, dataPieces.pieces[i].data, extracted.data.len) != 0) {
+            printf("Segments test failed: image %" PRIu64 " was embedded differently\n", i);
+            failed = 1;
+        }
+        free_extracted(extracted);
+    }
+    if (embedded.code != OK || embed_segments(precomputed, (SegmentPieces) {pieces, len - 1}).code != BadDataPiecesLen) {
+        printf("Segments test failed: embedding returned the wrong code\n");
+        failed = 1;
+    }
+
+    free(pieces);
+    free(segments);
+    free_dataPieces(&dataPieces);
+    free_precomputed(precomputed);
+    free_precomputed(expected);
+    free_imageList(&imageList);
+    if (!failed) printf("Segments Test Succeeded\n");
+    return failed;
+}
+
+int testProbe(void) {
+    ImageList imageList = createRandomImageList();
+    const uint64_t reserved = 64;
+    int failed = 0;
+
+    for (uint64_t i = 0; i < IMAGE_LEN; ++i) {
+        Image *const image = imageList.images + i;
+        const uint64_t sizes[] = {16, 8, 32};
+        const uint64_t size = image->w * image->h * image->c;
+        uint8_t *const original = (uint8_t *) malloc(size);
+        memcpy(original, image->pixels, size);
+
+        // nothing in a cover yet, whatever its lowest bits happen to spell
+        Probed probed = probe(*image, reserved);
+        if (probed.code != OK || probed.present || extract_inplace(*image, reserved).code != InvalidLen) {
+            printf("Probe test failed: image %" PRIu64 " was found to carry a payload\n", i);
+            failed = 1;
+        }
+
+        image->squareSize = sizes[i % 3];
+        image->bits = i % 4 + 1;
+        Data piece = randData(reserved + 1000 * (i + 1));
+        const uint64_t len = piece.len;
+        Precomputed precomputed = precompute_inplace((ImageList) {image, 1, false}, len - reserved, reserved);
+        embed(precomputed, (DataPieces) {&piece, 1});
+        free_precomputed(precomputed);
+        free_data(&piece);
+
+        // found without being told the square size and bits
+        Image unknown = *image;
+        unknown.squareSize = unknown.bits = 0;
+        probed = probe(unknown, reserved);
+        if (probed.code != OK || !probed.present || probed.len != len || probed.squareSize != image->squareSize ||
+            probed.bits != image->bits) {
+            printf("Probe test failed: image %" PRIu64 " wasn't found to carry its payload\n", i);
+            failed = 1;
+        }
+        memcpy(image->pixels, original, size);
+        free(original);
+    }
+
+    // flat pixels spell a header of zeros
+    Image flat = imageList.images[0];
+    memset(flat.pixels, 0, flat.w * flat.h * flat.c);
+    if (probe(flat, reserved).present || probe((Image) {.squareSize = 12}, reserved).code != BadSquareSize) {
+        printf("Probe test failed: a flat image was found to carry a payload\n");
+        failed = 1;
+    }
+
+    free_imageList(&imageList);
+    if (!failed) printf("Probe Test Succeeded\n");
+    return failed;
+}
+
+// an image in memory read and written through the strip callbacks, writes have to come in order
+typedef struct StripBuffer {
+    const uint8_t *src;
+    uint8_t *dst;
+    uint64_t rowLen, written, reads;
+} StripBuffer;
+
+bool readStrip(void *context, uint64_t row, uint64_t rows, uint8_t *pixels) {
+    StripBuffer *const buffer = (StripBuffer *) context;
+    memcpy(pixels, buffer->src + row * buffer->rowLen, rows * buffer->rowLen);
+    ++buffer->reads;
+    return true;
+}
+
+bool writeStrip(void *context, uint64_t row, uint64_t rows, const uint8_t *pixels) {
+    StripBuffer *const buffer = (StripBuffer *) context;
+    if (row != buffer->written) return false;
+    memcpy(buffer->dst + row * buffer->rowLen, pixels, rows * buffer->rowLen);
+    buffer->written += rows;
+    return true;
+}
+
+bool failStrip(void *context, uint64_t row, uint64_t rows, uint8_t *pixels) {
+    (void) context, (void) row, (void) rows, (void) pixels;
+    return false;
+}
+
+int testStrips(void) {
+    ImageList imageList = createRandomImageList();
+    const uint64_t reserved = 64;
+    int failed = 0;
+
+    for (uint64_t i = 0; i < IMAGE_LEN; ++i) {
+        Image *const image = imageList.images + i;
+        image->bits = i % 4;
+        image->squareSize = (uint64_t[]) {0, 8, 32}[i % 3];
+        // a flat band whose squares tie, broken by their index
+        memset(image->pixels, 0, image->w * image->c * (image->h / 3));
+        const uint64_t size = image->w * image->h * image->c;
+        const uint64_t squares = (image->w / square_size(image)) * (image->h / 3 / square_size(image));
+        const Data data = randData(square_len(image) * squares);
+
+        Precomputed expected = precompute((ImageList) {image, 1, false}, data.len - reserved, reserved);
+        Data piece = data;
+        embed(expected, (DataPieces) {&piece, 1});
+
+        // the piece in two segments
+        const Segment segments[] = {{data.data, data.len / 2}, {data.data + data.len / 2, data.len - data.len / 2}};
+        StripBuffer buffer = {image->pixels, (uint8_t *) calloc(size, sizeof(uint8_t)), image->w * image->c, 0, 0};
+        const StripImage stripImage = {image->w, image->h, image->c, image->squareSize, image->bits,
+                                       readStrip, writeStrip, &buffer};
+        const uint64_t code = embed_strips(stripImage, (Segments) {segments, 2}, reserved);
+        if (expected.code != OK || code != OK || buffer.written != image->h ||
+            memcmp(buffer.dst, expected.imageList.images[0].pixels, size) != 0) {
+            printf("Strips test failed: image %" PRIu64 " was embedded differently\n", i);
+            failed = 1;
+        }
+
+        // extraction reads the embedded image and finds the square size and bits on its own
+        StripBuffer embedded = {buffer.dst, NULL, image->w * image->c, 0, 0};
+        const StripImage embeddedImage = {image->w, image->h, image->c, 0, 0, readStrip, NULL, &embedded};
+        Extracted extracted = extract_strips(embeddedImage, reserved);
+        Extracted expectedExtracted = extract(expected.imageList.images[0], reserved);
+        if (extracted.code != OK || expectedExtracted.code != OK || extracted.data.len != data.len ||
+            memcmp(extracted.data.data, expectedExtracted.data.data, data.len) != 0) {
+            printf("Strips test failed: image %" PRIu64 " was extracted differently\n", i);
+            failed = 1;
+        }
+
+        free_extracted(extracted);
+        free_extracted(expectedExtracted);
+        free(buffer.dst);
+        free_data(&piece);
+        free(data.data);
+        free_precomputed(expected);
+    }
+
+    // a payload that doesn't fit, a reader that fails, an image without a payload
+    Image *const image = imageList.images;
+    const Data data = randData(image->w * image->h * image->c);
+    StripBuffer buffer = {image->pixels, (uint8_t *) calloc(data.len, sizeof(uint8_t)), image->w * image->c, 0, 0};
+    StripImage stripImage = {image->w, image->h, image->c, 0, 0, readStrip, writeStrip, &buffer};
+    const Segment segment = {data.data, data.len};
+    if (embed_strips(stripImage, (Segments) {&segment, 1}, reserved) != OversizedData ||
+        extract_strips(stripImage, reserved).code != InvalidLen) {
+        printf("Strips test failed: a bad payload was taken\n");
+        failed = 1;
+    }
+    stripImage.read = failStrip;
+    if (embed_strips(stripImage, (Segments) {&segment, 0}, reserved) != StripFailure) {
+        printf("Strips test failed: a failing reader wasn't noticed\n");
+        failed = 1;
+    }
+
+    free(buffer.dst);
+    free(data.data);
+    free_imageList(&imageList);
+    if (!failed) printf("Strips Test Succeeded\n");
+    return failed;
+}
+
+// whether an allocation took the same squares as a precomputation from scratch
+int sameSquares(Precomputed actual, Precomputed expected) {
+    if (actual.code != OK || expected.code != OK || actual.imageList.len != expected.imageList.len) return 0;
+    for (uint64_t i = 0; i < actual.imageList.len; ++i) {
+        const Image *const image = actual.imageList.images + i, *const expectedImage = expected.imageList.images + i;
+        if (image->usage != expectedImage->usage || image->squareList.len != expectedImage->squareList.len ||
+            memcmp(image->squareList.squares, expectedImage->squareList.squares,
+                   image->squareList.len * sizeof(Square)) != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int testCovers(void) {
+    ImageList imageList = createRandomImageList();
+    const Data data = randData(30000);
+    const uint64_t reserved = 64;
+    int failed = 0;
+
+    // the pixels of the covers added in place, which the covers have to give back unchanged
+    uint8_t *originals[IMAGE_LEN];
+    for (uint64_t i = 3; i < IMAGE_LEN; ++i) {
+        const Image *const image = imageList.images + i;
+        originals[i] = (uint8_t *) malloc(image->w * image->h * image->c);
+        memcpy(originals[i], image->pixels, image->w * image->h * image->c);
+    }
+
+    // added in two batches, the second one in place
+    Covers *const covers = covers_new(reserved);
+    Stats stats = {0};
+    if (covers_add(covers, (ImageList) {imageList.images, 3, false}, false, &stats) != OK ||
+        covers_add(covers, (ImageList) {imageList.images + 3, IMAGE_LEN - 3, false}, true, NULL) != OK ||
+        covers_len(covers) != IMAGE_LEN || stats.squaresEvaluated == 0) {
+        printf("Covers test failed: the covers couldn't be added\n");
+        return 1;
+    }
+
+    // growing the payload again after shrinking it needs the squares a destructive prune would have dropped
+    const uint64_t lens[] = {data.len, 100, data.len * 2, data.len};
+    for (uint64_t i = 0; i < 4; ++i) {
+        Stats allocateStats = {0};
+        Precomputed allocated = covers_allocate(covers, lens[i], &allocateStats);
+        Precomputed expected = precompute(imageList, lens[i], reserved);
+        if (!sameSquares(allocated, expected) || allocateStats.squaresEvaluated != 0) {
+            printf("Covers test failed: %" PRIu64 " bytes were allocated differently\n", lens[i]);
+            failed = 1;
+        }
+        free_precomputed(expected);
+    }
+
+    // the last cover moves down when the middle one goes
+    Image remaining[IMAGE_LEN - 1];
+    for (uint64_t i = 0, j = 0; i < IMAGE_LEN; ++i) if (i != 2) remaining[j++] = imageList.images[i];
+    Precomputed expected = precompute((ImageList) {remaining, IMAGE_LEN - 1, false}, data.len, reserved);
+    if (covers_remove(covers, 2) != OK || covers_remove(covers, IMAGE_LEN) != BadCoverIndex ||
+        !sameSquares(covers_allocate(covers, data.len, NULL), expected)) {
+        printf("Covers test failed: a cover wasn't removed\n");
+        failed = 1;
+    }
+
+    // an allocation embeds like any precomputation
+    Precomputed allocated = covers_allocate(covers, data.len, NULL);
+    DataPieces dataPieces = splitData(allocated, data, reserved);
+    embed(allocated, dataPieces);
+    for (uint64_t i = 0; allocated.code == OK && i < allocated.imageList.len; ++i) {
+        Extracted extracted = extract(allocated.imageList.images[i], reserved);
+        if (extracted.code != OK || extracted.data.len != dataPieces.pieces[i].len ||
+            memcmp(extracted.data.data, dataPieces.pieces[i].data, extracted.data.len) != 0) {
+            printf("Covers test failed: image %" PRIu64 " extracts differently\n", i);
+            failed = 1;
+        }
+        free_extracted(extracted);
+    }
+
+    // a shorter payload embedded afterwards leaves the cover as it was outside its own squares
+    Precomputed shorter = covers_allocate(covers, 100, NULL);
+    const Data shorterData = randData(100);
+    DataPieces shorterPieces = splitData(shorter, shorterData, reserved);
+    embed(shorter, shorterPieces);
+    for (uint64_t i = 0; shorter.code == OK && i < shorter.imageList.len; ++i) {
+        const Image *const image = shorter.imageList.images + i;
+        const uint64_t size = square_size(image), squareW = image->w / size, len = image->w * image->h * image->c;
+        uint8_t *const used = (uint8_t *) calloc(len, sizeof(uint8_t));
+        for (uint64_t j = 0; image->squareList.squares != NULL && j < image->squareList.len; ++j) {
+            const uint64_t index = square_index(image->squareList.squares[j]);
+            const uint64_t offset = ((index / squareW) * image->w + index % squareW) * size * image->c;
+            for (uint64_t y = 0; y < size; ++y) memset(used + offset + y * image->w * image->c, 1, size * image->c);
+        }
+        for (uint64_t j = 0; j < len; ++j) {
+            if (!used[j] && image->pixels[j] != remaining[i].pixels[j]) {
+                printf("Covers test failed: image %" PRIu64 " keeps an earlier payload\n", i);
+                failed = 1;
+                break;
+            }
+        }
+        free(used);
+    }
+
+    free_dataPieces(&shorterPieces);
+    free(shorterData.data);
+    free_dataPieces(&dataPieces);
+    free_precomputed(expected);
+    covers_free(covers);
+    for (uint64_t i = 3; i < IMAGE_LEN; ++i) {
+        const Image *const image = imageList.images + i;
+        if (memcmp(image->pixels, originals[i], image->w * image->h * image->c) != 0) {
+            printf("Covers test failed: image %" PRIu64 " added in place keeps a payload\n", i);
+            failed = 1;
+        }
+        free(originals[i]);
+    }
+    free_imageList(&imageList);
+    if (!failed) printf("Covers Test Succeeded\n");
+    return failed;
+}
+
+// the payload an image carries in squares at the floor, the way selection counts it
+uint64_t floorCapacity(Image *image, uint64_t reserved, uint64_t floor) {
+    if (generate_squares(image, reserved) != OK) return 0;
+    uint64_t usable = 0;
+    while (usable < image->squareList.len && square_entropy(image->squareList.squares[usable]) >= floor) ++usable;
+    free(image->squareList.squares);
+    image->squareList = (SquareList) {NULL, 0};
+    const uint64_t squareLen = square_len(image);
+    const uint64_t count = (reserved + squareLen - 1) / squareLen;
+    return usable <= count + 1 ? 0 : (usable - 1) * squareLen - reserved;
+}
+
+int compareCapacities(const void *a, const void *b) {
+    const uint64_t first = *(const uint64_t *) a, second = *(const uint64_t *) b;
+    return (first < second) - (first > second);
+}
+
+int testPool(void) {
+    const uint64_t len = 24, reserved = 64;
+    int failed = 0;
+
+    // gradients with more or less noise on them, from nearly flat to all noise
+    Image pool[24];
+    for (uint64_t i = 0; i < len; ++i) {
+        const uint64_t w = 64 + i % 5 * 48, h = 80 + i % 3 * 64, c = 1 + i % 3;
+        const int amplitude = 1 << (i % 9);
+        pool[i] = createRandomImage(w, h, c);
+        for (uint64_t j = 0; j < w * h * c; ++j) pool[i].pixels[j] = (uint8_t) (j / c % w + rand() % amplitude);
+    }
+    // the median square of a middling cover
+    Image middle = pool[4];
+    generate_squares(&middle, reserved);
+    const uint64_t floor = square_entropy(middle.squareList.squares[middle.squareList.len / 2]);
+    free(middle.squareList.squares);
+
+    uint64_t capacities[24], sorted[24], total = 0;
+    for (uint64_t i = 0; i < len; ++i) {
+        capacities[i] = sorted[i] = floorCapacity(pool + i, reserved, floor);
+        total += capacities[i];
+    }
+    qsort(sorted, len, sizeof(uint64_t), compareCapacities);
+    const uint64_t dataLen = total / 3;
+    uint64_t fewest = 0;
+    for (uint64_t sum = 0; sum < dataLen; sum += sorted[fewest++]);
+
+    const ImageList imageList = {pool, len, false};
+    const uint64_t goals[] = {SelectFewest, SelectPixels};
+    for (uint64_t g = 0; g < 2; ++g) {
+        Selection selection = select_covers(imageList, dataLen, reserved, floor, goals[g]);
+        uint64_t capacity = 0;
+        for (uint64_t i = 0; selection.code == OK && i < selection.len; ++i) capacity += capacities[selection.indices[i]];
+        if (selection.code != OK || capacity != selection.capacity || capacity < dataLen ||
+            (goals[g] == SelectFewest && selection.len != fewest)) {
+            printf("Pool test failed: goal %" PRIu64 " selected badly\n", goals[g]);
+            failed = 1;
+        }
+        // none of the covers for the fewest pixels could be left out
+        for (uint64_t i = 0; goals[g] == SelectPixels && i < selection.len; ++i) {
+            if (capacity - capacities[selection.indices[i]] >= dataLen) {
+                printf("Pool test failed: cover %" PRIu64 " wasn't needed\n", selection.indices[i]);
+                failed = 1;
+            }
+        }
+
+        // the chosen covers hold the payload without going under the floor
+        Image chosen[24];
+        for (uint64_t i = 0; i < selection.len; ++i) chosen[i] = pool[selection.indices[i]];
+        Precomputed precomputed = precompute_inplace((ImageList) {chosen, selection.len, false}, dataLen, reserved);
+        for (uint64_t i = 0; precomputed.code == OK && i < precomputed.imageList.len; ++i) {
+            const Image *const image = precomputed.imageList.images + i;
+            if (image->usage > 0 && square_entropy(image->squareList.squares[image->usage - 1]) < floor) {
+                printf("Pool test failed: cover %" PRIu64 " went under the floor\n", i);
+                failed = 1;
+            }
+        }
+        if (precomputed.code != OK) {
+            printf("Pool test failed: the selection couldn't be precomputed\n");
+            failed = 1;
+        }
+        free_precomputed(precomputed);
+        free_selection(selection);
+    }
+
+    if (select_covers(imageList, total + 1, reserved, floor, SelectFewest).code != OversizedData) {
+        printf("Pool test failed: an oversized payload was selected for\n");
+        failed = 1;
+    }
+
+    for (uint64_t i = 0; i < len; ++i) free(pool[i].pixels);
+    if (!failed) printf("Pool Test Succeeded\n");
+    return failed;
+}
+
+void writeFile(const char *path, const uint8_t *data, uint64_t len) {
+    FILE *const file = fopen(path, "wb");
+    fwrite(data, 1, len, file);
+    fclose(file);
+}
+
+uint8_t *readFile(const char *path, uint64_t len) {
+    uint8_t *const data = (uint8_t *) calloc(len, sizeof(uint8_t));
+    FILE *const file = fopen(path, "rb");
+    if (file == NULL || fread(data, 1, len, file) != len) memset(data, 0, len);
+    if (file != NULL) fclose(file);
+    return data;
+}
+
+void putLe(uint8_t *data, uint64_t value, uint64_t len) {
+    for (uint64_t i = 0; i < len; ++i) data[i] = (uint8_t) (value >> i * 8);
+}
+
+// a chunk like distribution.split makes it
+uint8_t *makeChunk(uint64_t id, uint64_t total, uint64_t index, uint64_t time, const uint8_t *data, uint64_t len) {
+    uint8_t *const chunk = (uint8_t *) malloc(32 + len);
+    const uint64_t words[] = {id, total, index, time};
+    for (uint64_t i = 0; i < 4; ++i) putLe(chunk + i * 8, words[i], 8);
+    memcpy(chunk + 32, data, len);
+    return chunk;
+}
+
+int testReassembly(void) {
+    const uint64_t messages = 300, total = 7, now = 1000;
+    const Data data = randData(messages * 700);
+    int failed = 0;
+
+    // every message cut into uneven chunks, one of them empty, all of them interleaved, sent twice and shuffled
+    uint64_t *const order = (uint64_t *) malloc(messages * total * 2 * sizeof(uint64_t));
+    for (uint64_t i = 0; i < messages * total * 2; ++i) order[i] = i % (messages * total);
+    for (uint64_t i = messages * total * 2; i-- > 1;) {
+        const uint64_t j = (uint64_t) rand() % (i + 1), swap = order[i];
+        order[i] = order[j];
+        order[j] = swap;
+    }
+    const uint64_t cuts[] = {0, 100, 100, 250, 400, 401, 600, 700};
+    Reassembly *const reassembly = reassembly_new(1 << 24, 3600);
+    for (uint64_t i = 0; i < messages * total * 2; ++i) {
+        const uint64_t message = order[i] / total, index = order[i] % total;
+        const uint64_t len = cuts[index + 1] - cuts[index];
+        uint8_t *const chunk = makeChunk(message, total, index, now - message % 10,
+                                         data.data + message * 700 + cuts[index], len);
+        if (reassembly_add(reassembly, chunk, 32 + len, now) != OK) failed = 1;
+        free(chunk);
+    }
+
+    uint64_t complete = 0;
+    for (Reassembled reassembled = reassembly_next(reassembly); reassembled.message != NULL;
+         reassembled = reassembly_next(reassembly)) {
+        const uint64_t message = reassembled.id[0] | (uint64_t) reassembled.id[1] << 8;
+        uint64_t offset = 0;
+        for (uint64_t i = 0; i < reassembled.data.len; ++i) {
+            const Segment segment = reassembled.data.segments[i];
+            if (memcmp(segment.data, data.data + message * 700 + offset, segment.len) != 0) failed = 1;
+            offset += segment.len;
+        }
+        if (offset != 700 || reassembled.len != 700 || reassembled.time != now - message % 10) failed = 1;
+        reassembly_release(reassembly, reassembled);
+        ++complete;
+    }
+    if (failed || complete != messages || reassembly_pending(reassembly) != 0) {
+        printf("Reassembly test failed: the messages weren't put back together\n");
+        failed = 1;
+    }
+
+    // too short, past the chunk count, from the future, too old
+    const uint8_t *const bytes = data.data;
+    uint8_t *const bad[] = {makeChunk(1, 2, 0, now, bytes, 0), makeChunk(1, 2, 2, now, bytes, 8),
+                            makeChunk(1, 2, 0, now + 1, bytes, 8), makeChunk(1, 2, 0, now - 3601, bytes, 8)};
+    for (uint64_t i = 0; i < 4; ++i) {
+        if (reassembly_add(reassembly, bad[i], i == 0 ? 31 : 40, now) != BadChunk) {
+            printf("Reassembly test failed: bad chunk %" PRIu64 " was taken\n", i);
+            failed = 1;
+        }
+        free(bad[i]);
+    }
+
+    // an incomplete message expires an hour after its first chunk came in
+    uint8_t *const chunk = makeChunk(2, 2, 0, now, bytes, 8);
+    reassembly_add(reassembly, chunk, 40, now);
+    if (reassembly_pending(reassembly) != 1 || reassembly_expire(reassembly, now + 3600) != 0 ||
+        reassembly_expire(reassembly, now + 3601) != 1 || reassembly_pending(reassembly) != 0) {
+        printf("Reassembly test failed: a message didn't expire\n");
+        failed = 1;
+    }
+    reassembly_free(reassembly);
+
+    // the oldest incomplete message makes room for a new one, a chunk that can't fit at all is refused
+    Reassembly *const small = reassembly_new(4096, 0);
+    for (uint64_t i = 0; i < 20; ++i) {
+        uint8_t *const part = makeChunk(i, 2, 0, now, bytes, 500);
+        if (reassembly_add(small, part, 532, now) != OK || reassembly_memory(small) > 4096) failed = 1;
+        free(part);
+    }
+    uint8_t *const huge = makeChunk(99, 1, 0, now, bytes, 5000);
+    if (failed || reassembly_pending(small) >= 20 || reassembly_add(small, huge, 5032, now) != ReassemblyFull ||
+        reassembly_add(small, chunk, 40, now) != OK) {
+        printf("Reassembly test failed: the memory limit wasn't kept\n");
+        failed = 1;
+    }
+    free(huge);
+    free(chunk);
+    reassembly_free(small);
+
+    free(order);
+    free(data.data);
+    if (!failed) printf("Reassembly Test Succeeded\n");
+    return failed;
+}
+
+int testFiles(void) {
+    const char *const srcs[] = {"test_cover.ppm", "test_cover.pam", "test_cover.bmp"};
+    const char *const dsts[] = {"test_stego.ppm", "test_stego.pam", "test_stego.bmp"};
+    const char *const headers[] = {
+            "P6\n# a comment\n160 120\n255\n",
+            "P7\nWIDTH 160\nHEIGHT 120\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n"
+    };
+    const uint64_t bmpW = 201, bmpH = 150, stride = 604, bmpOffset = 54;
+    const uint64_t lens[] = {
+            strlen(headers[0]) + 160 * 120 * 3, strlen(headers[1]) + 160 * 120 * 4, bmpOffset + stride * bmpH
+    };
+    const Data data = randData(24000);
+    const uint64_t reserved = 64;
+    int failed = 0;
+
+    // a PPM with a comment, a PAM with alpha, and a bottom-up BMP whose rows end in a padding byte
+    for (uint64_t i = 0; i < 3; ++i) {
+        uint8_t *const file = (uint8_t *) calloc(lens[i], sizeof(uint8_t));
+        randFill(file, lens[i]);
+        if (i < 2) {
+            memcpy(file, headers[i], strlen(headers[i]));
+        } else {
+            memset(file, 0, bmpOffset);
+            memcpy(file, "BM", 2);
+            putLe(file + 2, lens[i], 4);
+            putLe(file + 10, bmpOffset, 4);
+            putLe(file + 14, 40, 4);
+            putLe(file + 18, bmpW, 4);
+            putLe(file + 22, bmpH, 4);
+            putLe(file + 26, 1, 2);
+            putLe(file + 28, 24, 2);
+            for (uint64_t row = 0; row < bmpH; ++row) file[bmpOffset + row * stride + stride - 1] = 0xAB;
+        }
+        writeFile(srcs[i], file, lens[i]);
+        free(file);
+    }
+
+    ImageFile files[3];
+    Image images[3];
+    for (uint64_t i = 0; i < 3; ++i) {
+        files[i] = map_image_copy(srcs[i], dsts[i]);
+        images[i] = files[i].image;
+        if (files[i].code != OK) {
+            printf("Files test failed: %s couldn't be mapped\n", srcs[i]);
+            failed = 1;
+        }
+    }
+    Precomputed precomputed = precompute_inplace((ImageList) {images, 3, false}, data.len, reserved);
+    if (failed || precomputed.code != OK || precomputed.imageList.len != 3) {
+        printf("Files test failed: the files couldn't be precomputed\n");
+        return 1;
+    }
+    DataPieces dataPieces = splitData(precomputed, data, reserved);
+    embed(precomputed, dataPieces);
+    // the precomputed images come in their own order
+    uint64_t order[3] = {0};
+    for (uint64_t i = 0; i < 3; ++i) {
+        while (precomputed.imageList.images[order[i]].pixels != files[i].image.pixels) ++order[i];
+        if (sync_image(files + i) != OK) {
+            printf("Files test failed: %s couldn't be written\n", dsts[i]);
+            failed = 1;
+        }
+        unmap_image(files + i);
+    }
+
+    for (uint64_t i = 0; i < 3; ++i) {
+        const Data piece = dataPieces.pieces[order[i]];
+        Extracted extracted = extract_file(dsts[i], reserved);
+        if (extracted.code != OK || extracted.data.len != piece.len ||
+            memcmp(extracted.data.data, piece.data, piece.len) != 0) {
+            printf("Files test failed: %s extracts differently\n", dsts[i]);
+            failed = 1;
+        }
+        free_extracted(extracted);
+    }
+
+    // the BMP decoded by hand to top-down RGB holds the same payload, and its padding wasn't touched
+    uint8_t *const bmp = readFile(dsts[2], lens[2]);
+    Image decoded = createRandomImage(bmpW, bmpH, 3);
+    for (uint64_t row = 0; row < bmpH; ++row) {
+        const uint8_t *const stored = bmp + bmpOffset + (bmpH - 1 - row) * stride;
+        for (uint64_t x = 0; x < bmpW * 3; ++x) decoded.pixels[row * bmpW * 3 + x] = stored[x - x % 3 + 2 - x % 3];
+        if (stored[stride - 1] != 0xAB) failed = 1;
+    }
+    Extracted extracted = extract(decoded, reserved);
+    if (failed || extracted.code != OK || extracted.data.len == 0 ||
+        memcmp(extracted.data.data, dataPieces.pieces[order[2]].data, extracted.data.len) != 0) {
+        printf("Files test failed: the BMP isn't stored as RGB rows\n");
+        failed = 1;
+    }
+
+    // 16-bit samples and a file that isn't there
+    writeFile(srcs[0], (const uint8_t *) "P6\n1 1\n65535\n\0\0\0\0\0\0", 20);
+    if (map_image(srcs[0]).code != BadImageFile || extract_file("missing.ppm", reserved).code != BadImageFile) {
+        printf("Files test failed: a bad file was mapped\n");
+        failed = 1;
+    }
+
+    for (uint64_t i = 0; i < 3; ++i) {
+        remove(srcs[i]);
+        remove(dsts[i]);
+    }
+    free_extracted(extracted);
+    free(decoded.pixels);
+    free(bmp);
+    free_dataPieces(&dataPieces);
+    free_precomputed(precomputed);
+    if (!failed) printf("Files Test Succeeded\n");
+    return failed;
+}
+
+int main(void) {
+    int failed = 0;
+    failed |= testKernels();
+    failed |= testEntropy();
+    failed |= testSelection();
+    failed |= testThreads();
+    failed |= testAllocation();
+    failed |= testInplace();
+    failed |= testStream();
+    failed |= testList();
+    failed |= testSquareSizes();
+    failed |= testStats();
+    failed |= testContext();
+    failed |= testCache();
+    failed |= testBits();
+    failed |= testFiles();
+    failed |= testSegments();
+    failed |= testStrips();
+    failed |= testProbe();
+    failed |= testReassembly();
+    failed |= testCovers();
+    failed |= testPool();
+    failed |= testRoundTrip();
+    return failed;
+}
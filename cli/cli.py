@@ -94,9 +94,8 @@ def compose(contacts: str, key: str, images: any, filename: str | None, user_id:
     lengths = embed_obj.precomputed.get_lengths(config.RESERVED_SIZE)
 
     plain_pieces = distribution.split(content, lengths)
-    encrypted_pieces = []
-    for piece in plain_pieces:
-        encrypted_pieces.append(encryption_obj.send(piece, user_id))
+    # one key exchange for the whole message, the sections are embedded one after another instead of being joined
+    encrypted_pieces = encryption_obj.send_message(plain_pieces, user_id)
 
     embed_obj.embed(encrypted_pieces, image_format)
 
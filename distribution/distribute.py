@@ -1,6 +1,6 @@
 import os
 import time
-from typing import Sequence
+from typing import Iterable, Sequence
 
 
 def split(data: bytes, chunks: Sequence[int]) -> tuple[bytes, ...]:
@@ -11,6 +11,18 @@ def split(data: bytes, chunks: Sequence[int]) -> tuple[bytes, ...]:
     :return: the split chunks
     """
 
+    return tuple(b"".join(chunk) for chunk in split_segments(data, chunks))
+
+
+def split_segments(data: bytes, chunks: Sequence[int]) -> tuple[tuple[bytes, memoryview], ...]:
+    """Splits data into chunks like **split** without joining them, each chunk being its structure and a view of data
+
+    :param data: the data that need to be split
+    :param chunks: the lengths of chunks that need to be split into
+    :return: the split chunks, each one the 32-byte structure followed by its part of data
+    """
+
+    view = memoryview(data)
     # the id of the message
     # it should be unique each time, but since the id used is not recorded,
     # it should be fine to randomly generate an 8-byte id
@@ -32,13 +44,15 @@ def split(data: bytes, chunks: Sequence[int]) -> tuple[bytes, ...]:
         #   index - 8 bytes, the index in the data, for the receiver to putting the pieces together
         #   time - 8 bytes, the time the message is generated
         #   data - the chunk of data
-        result.append(b"".join((
-            id_,
-            total.to_bytes(8, "little", signed=False),
-            i.to_bytes(8, "little", signed=False),
-            timestamp.to_bytes(8, "little", signed=False),
-            data[data_index:data_index + chunk]
-        )))
+        result.append((
+            b"".join((
+                id_,
+                total.to_bytes(8, "little", signed=False),
+                i.to_bytes(8, "little", signed=False),
+                timestamp.to_bytes(8, "little", signed=False),
+            )),
+            view[data_index:data_index + chunk]
+        ))
         data_index += chunk
 
     return tuple(result)
@@ -110,3 +124,81 @@ def merge(chunks: Sequence[bytes]) -> bytes:
         result.append(piece[32:])
 
     return b"".join(result)
+
+
+# what the native reassembly index holds besides the data: an upper bound of a message's own bytes, what it adds
+# per chunk of the message, and the slots and slack of its table per message and in all
+MESSAGE_BYTES = 136
+MESSAGE_CHUNK_BYTES = 17
+TABLE_MESSAGE_BYTES = 64
+TABLE_BYTES = 2048
+
+
+def completable(chunks: Sequence[bytes], now: int) -> tuple[list[bytes], int]:
+    """Leaves out the chunks of messages with fewer chunks than they claim, which can't complete, so their claimed
+    count sizes nothing. The ones left out are still checked like in **check**
+
+    :param chunks: the chunks
+    :param now: the current time
+    :return: the chunks kept and the memory the native reassembly index needs to hold all of them at once
+    """
+
+    headers = []
+    counts = {}
+    for chunk in chunks:
+        if len(chunk) < 32:
+            # the index refuses it
+            headers.append(None)
+            continue
+        signature = (bytes(chunk[:8]), int.from_bytes(chunk[8:16], "little", signed=False),
+                     int.from_bytes(chunk[24:32], "little", signed=False))
+        headers.append((signature, int.from_bytes(chunk[16:24], "little", signed=False)))
+        counts[signature] = counts.get(signature, 0) + 1
+
+    memory = TABLE_BYTES
+    for (_, total, _), count in counts.items():
+        if count >= total:
+            memory += TABLE_MESSAGE_BYTES + MESSAGE_BYTES + total * MESSAGE_CHUNK_BYTES
+
+    kept = []
+    for chunk, header in zip(chunks, headers):
+        if header is not None:
+            (_, total, timestamp), index = header
+            if counts[header[0]] < total:
+                if timestamp > now:
+                    raise ValueError(f"invalid timestamp in the message ({timestamp} > {now})")
+                if index >= total:
+                    raise ValueError(f"the index of a chunk can't be greater the the total length ({index} >= {total})")
+                continue
+            memory += len(chunk) - 32
+        kept.append(chunk)
+    return kept, memory
+
+
+def merge_all(chunks: Iterable[bytes], now: int | None = None, reassembler=None) -> list[bytes]:
+    """Merges the chunks of any number of interleaved messages. Unlike **merge** they go through the native
+    reassembly index one by one, a message missing chunks is left out and invalid chunks raise like in **check**
+
+    :param chunks: the chunks, in any order
+    :param now: the current time, time.time() by default
+    :param reassembler: a **steganography.Reassembler** taking the chunks, its limit and max_age applying and the
+                        messages it completed before coming out too, by default one that keeps every chunk however
+                        old, like **merge** does
+    :return: the merged data of every complete message, in the order they were completed
+    """
+
+    # the native library comes with the steganography package
+    from steganography import Reassembler
+
+    now = int(time.time()) if now is None else now
+    if reassembler is None:
+        chunks, memory_limit = completable(list(chunks), now)
+        reassembler = Reassembler(memory_limit=memory_limit, max_age=0)
+
+    for chunk in chunks:
+        reassembler.add(chunk, now)
+    result = []
+    for message in reassembler.messages():
+        with message:
+            result.append(bytes(message))
+    return result
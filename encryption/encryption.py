@@ -4,7 +4,7 @@ import secrets
 from dataclasses import dataclass
 from enum import Enum
 from io import BytesIO
-from typing import Self, BinaryIO, Sequence
+from typing import Self, BinaryIO, Iterable, Sequence
 
 from cryptography.fernet import Fernet
 from cryptography.hazmat.primitives import hashes
@@ -21,6 +21,9 @@ SHA_SIZE = 32  # the size of SHA hash value
 ID_SIZE = 8  # the size of user IDs
 DYNAMIC_ID_SIZE = 8  # the size of dynamic IDs
 DYNAMIC_ID_NUM = 32  # the number of dynamic IDs exchanged in each communication
+CONTACTS_MAGIC = b"\x00SCC1"  # starts a contacts log, which a whole Fernet token never does
+COMPACT_MIN = 64  # the number of records a contacts log grows to at least before it is compacted
+INDEX_SIZE = 4  # the size of piece indices and counts in a message sent by **send_message**
 
 
 @dataclass
@@ -149,87 +152,143 @@ class User:
 
 @dataclass
 class Contacts:
+    """The users, indexed by id, name and the dynamic IDs they are found by. On disk they are an append-only log
+    of records each encrypted on its own, so saving writes only the users changed since the last save, and the log
+    is compacted to a record per user once most of it is stale. Users must be changed through **update_user**, or
+    the indices go stale."""
+
     users: list[User]
     key: str
 
-    def __bytes__(self) -> bytes:
+    def __post_init__(self):
         h = hashes.Hash(hashes.SHA256())
         h.update(self.key.encode())
-        f = Fernet(base64.urlsafe_b64encode(h.finalize()))
+        self.__fernet = Fernet(base64.urlsafe_b64encode(h.finalize()))
 
-        bytes_list = [len(self.users).to_bytes(2, "little", signed=False)]
+        self.__by_id: dict[int, User] = {}
+        self.__by_name: dict[str, User] = {}
+        self.__by_dynamic_id: dict[bytes, tuple[User, bool]] = {}
+        # what each user is indexed under, so it can be taken out after the user changed in place
+        self.__entries: dict[int, tuple[str, tuple[bytes, ...]]] = {}
         for user in self.users:
-            user_bytes = bytes(user)
-            bytes_list.append(len(user_bytes).to_bytes(2, "little", signed=False))
-            bytes_list.append(user_bytes)
+            self.__index(user)
 
-        plain = b"".join(bytes_list)
-        cipher = f.encrypt(plain)
+        # the users to append on the next save, and where the log ends, None until it is written whole
+        self.__dirty: dict[int, None] = {}
+        self.__end: int | None = None
+        self.__records = 0
 
-        return cipher
+    def __index(self, user: User) -> None:
+        self.__unindex(user.id)
+        # new and past IDs never overlap, a past one still resolves as not updated
+        dynamic_ids = []
+        if user.keys.new is not None:
+            for dynamic_id in user.keys.new.dynamic_ids:
+                self.__by_dynamic_id[dynamic_id] = (user, True)
+                dynamic_ids.append(dynamic_id)
+        if user.keys.pst is not None:
+            for dynamic_id in user.keys.pst.dynamic_ids:
+                self.__by_dynamic_id[dynamic_id] = (user, False)
+                dynamic_ids.append(dynamic_id)
+        self.__by_id[user.id] = user
+        self.__by_name[user.name] = user
+        self.__entries[user.id] = (user.name, tuple(dynamic_ids))
+
+    def __unindex(self, id_: int) -> None:
+        entry = self.__entries.pop(id_, None)
+        if entry is None:
+            return
+        name, dynamic_ids = entry
+        del self.__by_id[id_]
+        del self.__by_name[name]
+        for dynamic_id in dynamic_ids:
+            del self.__by_dynamic_id[dynamic_id]
+
+    def __record(self, user: User) -> bytes:
+        cipher = self.__fernet.encrypt(bytes(user))
+        return len(cipher).to_bytes(4, "little", signed=False) + cipher
+
+    def __bytes__(self) -> bytes:
+        return CONTACTS_MAGIC + b"".join(self.__record(user) for user in self.users)
 
     def __eq__(self, other: Self) -> bool:
         return self.users == other.users and self.key == other.key
 
     @classmethod
     def load(cls, data: bytes, key: str) -> Self:
-        h = hashes.Hash(hashes.SHA256())
-        h.update(key.encode())
-        f = Fernet(base64.urlsafe_b64encode(h.finalize()))
-
-        users = []
-        plain = f.decrypt(data)
-        reader = BytesIO(plain)
-
-        users_len = int.from_bytes(reader.read(2), "little", signed=False)
-        for _ in range(users_len):
-            user_len = int.from_bytes(reader.read(2), "little", signed=False)
-            users.append(User.load(reader.read(user_len)))
-
-        return Contacts(users, key)
+        contacts = cls([], key)
+        if not data.startswith(CONTACTS_MAGIC):
+            # a file written whole by an older version, rewritten as a log on the next save
+            plain = contacts.__fernet.decrypt(data)
+            reader = BytesIO(plain)
+
+            users_len = int.from_bytes(reader.read(2), "little", signed=False)
+            for _ in range(users_len):
+                user_len = int.from_bytes(reader.read(2), "little", signed=False)
+                contacts.__add(User.load(reader.read(user_len)))
+            contacts.__dirty.clear()
+            return contacts
+
+        # the last record of a user wins, and a record cut short by a failed append is dropped
+        users: dict[int, User] = {}
+        position = len(CONTACTS_MAGIC)
+        records = 0
+        while position + 4 <= len(data):
+            record_len = int.from_bytes(data[position:position + 4], "little", signed=False)
+            if position + 4 + record_len > len(data):
+                break
+            user = User.load(contacts.__fernet.decrypt(data[position + 4:position + 4 + record_len]))
+            users[user.id] = user
+            position += 4 + record_len
+            records += 1
+
+        for user in users.values():
+            contacts.__add(user)
+        contacts.__dirty.clear()
+        contacts.__end = position
+        contacts.__records = records
+        return contacts
 
     def find_by_id(self, id_: int) -> User | None:
-        for user in self.users:
-            if user.id == id_:
-                return user
-        return None
+        return self.__by_id.get(id_)
 
     def find_by_dynamic_id(self, dynamic_id: bytes) -> tuple[User | None, bool]:
-        for user in self.users:
-            if user.keys.pst is not None and dynamic_id in user.keys.pst.dynamic_ids:
-                return user, False
-            if dynamic_id in user.keys.new.dynamic_ids:
-                return user, True
-        return None, False
+        return self.__by_dynamic_id.get(dynamic_id, (None, False))
 
     def find_by_name(self, name: str) -> User | None:
-        for user in self.users:
-            if user.name == name:
-                return user
-        return None
+        return self.__by_name.get(name)
+
+    def __add(self, user: User) -> None:
+        self.users.append(user)
+        self.__index(user)
+        self.__dirty[user.id] = None
 
     def update_user(self, updated_user: User) -> None:
-        for i, user in enumerate(self.users):
-            if user.id == updated_user.id:
-                if user.name != updated_user.name:
-                    if self.find_by_name(updated_user.name) is not None:
-                        raise ValueError(f"duplicate user with name {updated_user.name}")
-                self.users[i] = updated_user
-                return
-        raise ValueError(f"user with id {updated_user.id} not found")
+        """Replaces the user with the same id, or takes a user changed in place, like by a key rotation"""
+
+        entry = self.__entries.get(updated_user.id)
+        if entry is None:
+            raise ValueError(f"user with id {updated_user.id} not found")
+        if entry[0] != updated_user.name and self.find_by_name(updated_user.name) is not None:
+            raise ValueError(f"duplicate user with name {updated_user.name}")
+        user = self.__by_id[updated_user.id]
+        if user is not updated_user:
+            self.users[self.users.index(user)] = updated_user
+        self.__index(updated_user)
+        self.__dirty[updated_user.id] = None
 
     def invite(self, name: str) -> User:
         if self.find_by_name(name) is not None:
             raise ValueError(f"duplicate user with name {name}")
         user = User.create(name, self.generate_id(), self.generate_dynamic_ids())
-        self.users.append(user)
+        self.__add(user)
         return user
 
     def receive_invitation(self, name: str, crt: KeySet) -> User:
         if self.find_by_name(name) is not None:
             raise ValueError(f"duplicate user with name {name}")
         user = User.create(name, self.generate_id(), self.generate_dynamic_ids(), crt)
-        self.users.append(user)
+        self.__add(user)
         return user
 
     @classmethod
@@ -239,31 +298,36 @@ class Contacts:
 
     @classmethod
     def create(cls, file: BinaryIO, key: str) -> Self:
-        file.seek(0)
-        file.truncate()
         contacts = cls([], key)
-        file.write(bytes(contacts))
+        contacts.save(file)
         return contacts
 
     def save(self, file: BinaryIO) -> None:
-        file.seek(0)
-        file.truncate()
-        file.write(bytes(self))
+        """Appends the users changed since the last save, or writes the log whole if it hasn't been yet or most of
+        it is stale"""
+
+        if self.__end is None or self.__records + len(self.__dirty) > max(COMPACT_MIN, 2 * len(self.users)):
+            file.seek(0)
+            file.truncate()
+            data = bytes(self)
+            file.write(data)
+            self.__end = len(data)
+            self.__records = len(self.users)
+        else:
+            records = b"".join(self.__record(self.__by_id[id_]) for id_ in self.__dirty)
+            file.seek(self.__end)
+            file.write(records)
+            file.truncate()
+            self.__end += len(records)
+            self.__records += len(self.__dirty)
+        self.__dirty.clear()
 
     def generate_dynamic_ids(self) -> tuple[bytes, ...]:
         dynamic_ids = []
         for _ in range(DYNAMIC_ID_NUM):
             while True:
                 id_ = os.urandom(DYNAMIC_ID_SIZE)
-                found = True
-                if id_ in dynamic_ids:
-                    continue
-                for user in self.users:
-                    if (id_ in user.keys.new.dynamic_ids or
-                            (user.keys.pst is not None and id_ in user.keys.pst.dynamic_ids)):
-                        found = False
-                        break
-                if found:
+                if id_ not in dynamic_ids and id_ not in self.__by_dynamic_id:
                     dynamic_ids.append(id_)
                     break
         return tuple(dynamic_ids)
@@ -271,12 +335,7 @@ class Contacts:
     def generate_id(self) -> int:
         while True:
             id_ = secrets.randbits(ID_SIZE * 8)
-            found = True
-            for user in self.users:
-                if id_ == user.id:
-                    found = False
-                    break
-            if found:
+            if id_ not in self.__by_id:
                 return id_
 
 
@@ -347,16 +406,16 @@ class Encryption:
             raise ValueError(f"user {id_} not found")
         match user.status:
             case UserStatus.Normal:
-                return self.__encrypt(data, user)
+                return b"".join(self.__encrypt(data, user))
             case UserStatus.InvitationSent:
                 raise PermissionError(f"the invitation of user {id_} is not confirmed")
             case UserStatus.InvitationReceived:
-                return self.__encrypt(data, user)
+                return b"".join(self.__encrypt(data, user))
             case UserStatus.Invalid:
                 raise ValueError(f"invalid user {id_} since its key sets are invalid")
 
     @classmethod
-    def __encrypt(cls, data: bytes, user: User) -> bytes:
+    def __encrypt(cls, data: bytes, user: User) -> tuple[bytes, ...]:
         dynamic_id = secrets.choice(user.keys.crt.dynamic_ids)
         nonce = os.urandom(NONCE_SIZE)
 
@@ -367,26 +426,233 @@ class Encryption:
         exchange_section_hash.update(exchange_section_plain)
         exchange_section_ccm = AESCCM(exchange_section_key)
         exchange_section_cipher = exchange_section_ccm.encrypt(nonce, exchange_section_plain, None)
-        exchange_section_cipher = exchange_section_cipher + exchange_section_hash.finalize()
+        exchange_section_digest = exchange_section_hash.finalize()
         del exchange_section_plain, exchange_section_hash, exchange_section_ccm
 
         public_key = serialization.load_der_public_key(user.keys.crt.rsa_key)
-        exchange_section_len = (len(exchange_section_cipher) - SHA_SIZE).to_bytes(2, "little", signed=False)
+        exchange_section_len = len(exchange_section_cipher).to_bytes(2, "little", signed=False)
         exchange_section_key_cipher = public_key.encrypt(exchange_section_key + exchange_section_len, padding.OAEP(
             mgf=padding.MGF1(algorithm=hashes.SHA256()),
             algorithm=hashes.SHA256(),
             label=None
         ))
-        exchange_section_cipher = exchange_section_key_cipher + exchange_section_cipher
-        del public_key, exchange_section_len, exchange_section_key, exchange_section_key_cipher
+        del public_key, exchange_section_len, exchange_section_key
 
         body_hash = hashes.Hash(hashes.SHA256())
         body_hash.update(data)
         body_ccm = AESCCM(user.keys.crt.aes_key)
-        body = body_ccm.encrypt(nonce, data, None) + body_hash.finalize()
-        del body_ccm, body_hash
+        body = body_ccm.encrypt(nonce, data, None)
+        del body_ccm
+
+        # the sections in the order they are sent
+        return (dynamic_id, nonce, exchange_section_key_cipher, exchange_section_cipher, exchange_section_digest, body,
+                body_hash.finalize())
+
+    def send_message(self, pieces: Sequence[bytes], id_: int) -> tuple[tuple[bytes, ...], ...]:
+        """Encrypts the pieces of one message with a single RSA key exchange. The session key is wrapped only in
+        the first piece, along with the exchange section, and every piece is sealed with a key derived from it and
+        the current AES key, under a nonce derived from the message nonce and the index of the piece. Only
+        **receive_message** takes the pieces back, all at once.
+
+        :param pieces: the pieces of the message, as **distribution.split** gives them
+        :param id_: the id of the user to send to
+        :return: the sections of every piece, in the order of the pieces
+        """
+
+        if self.__closed:
+            raise ValueError("contacts has been closed")
+        if len(pieces) == 0 or len(pieces) >= 1 << INDEX_SIZE * 8:
+            raise ValueError(f"invalid number of pieces {len(pieces)}")
+
+        user = self.contacts.find_by_id(id_)
+        if user is None:
+            raise ValueError(f"user {id_} not found")
+        match user.status:
+            case UserStatus.Normal | UserStatus.InvitationReceived:
+                return self.__encrypt_message(pieces, user)
+            case UserStatus.InvitationSent:
+                raise PermissionError(f"the invitation of user {id_} is not confirmed")
+            case UserStatus.Invalid:
+                raise ValueError(f"invalid user {id_} since its key sets are invalid")
+
+    @staticmethod
+    def __piece_key(aes_key: bytes, session_key: bytes) -> bytes:
+        # both keys go in, the session key alone could be wrapped by anyone holding the public key
+        piece_key_hash = hashes.Hash(hashes.SHA256())
+        piece_key_hash.update(aes_key + session_key)
+        return piece_key_hash.finalize()
+
+    @staticmethod
+    def __piece_nonce(nonce: bytes, index: int) -> bytes:
+        return nonce + index.to_bytes(INDEX_SIZE, "little", signed=False)
+
+    @classmethod
+    def __encrypt_message(cls, pieces: Sequence[bytes], user: User) -> tuple[tuple[bytes, ...], ...]:
+        nonce = os.urandom(NONCE_SIZE)
+        session_key = os.urandom(AES_SIZE)
+
+        exchange_section_plain = user.keys.new.aes_key + b"".join(user.keys.new.dynamic_ids) + user.keys.new.public_key
+        exchange_section_hash = hashes.Hash(hashes.SHA256())
+        exchange_section_hash.update(exchange_section_plain)
+        exchange_section_ccm = AESCCM(session_key)
+        exchange_section_cipher = exchange_section_ccm.encrypt(nonce, exchange_section_plain, None)
+        exchange_section_digest = exchange_section_hash.finalize()
+        del exchange_section_plain, exchange_section_hash, exchange_section_ccm
+
+        public_key = serialization.load_der_public_key(user.keys.crt.rsa_key)
+        exchange_section_len = len(exchange_section_cipher).to_bytes(2, "little", signed=False)
+        session_key_cipher = public_key.encrypt(session_key + exchange_section_len, padding.OAEP(
+            mgf=padding.MGF1(algorithm=hashes.SHA256()),
+            algorithm=hashes.SHA256(),
+            label=None
+        ))
+        del public_key, exchange_section_len
+
+        # the CCM tag of every piece authenticates it, so no hash follows the bodies
+        piece_ccm = AESCCM(cls.__piece_key(user.keys.crt.aes_key, session_key))
+        del session_key
+
+        result = []
+        for index, piece in enumerate(pieces):
+            dynamic_id = secrets.choice(user.keys.crt.dynamic_ids)
+            # the count is authenticated with every piece, so a message missing its last pieces is noticed
+            header = (nonce + index.to_bytes(INDEX_SIZE, "little", signed=False) +
+                      len(pieces).to_bytes(INDEX_SIZE, "little", signed=False))
+            body = piece_ccm.encrypt(cls.__piece_nonce(nonce, index), piece, dynamic_id + header)
+            if index == 0:
+                result.append((dynamic_id, header, session_key_cipher, exchange_section_cipher, exchange_section_digest,
+                               body))
+            else:
+                result.append((dynamic_id, header, body))
+        return tuple(result)
+
+    @staticmethod
+    def message_piece(cipher: bytes) -> tuple[bytes, int, int]:
+        """Reads which message a piece from **send_message** belongs to, without any key, for grouping pieces
+        received interleaved before **receive_message**
+
+        :param cipher: the piece
+        :return: the key of its message (the message nonce), its index and the number of pieces in the message
+        """
+
+        index_offset = DYNAMIC_ID_SIZE + NONCE_SIZE
+        if len(cipher) < index_offset + 2 * INDEX_SIZE:
+            raise ValueError("piece too short")
+        index = int.from_bytes(cipher[index_offset:index_offset + INDEX_SIZE], "little", signed=False)
+        count = int.from_bytes(cipher[index_offset + INDEX_SIZE:index_offset + 2 * INDEX_SIZE], "little",
+                               signed=False)
+        return cipher[DYNAMIC_ID_SIZE:index_offset], index, count
+
+    @classmethod
+    def group_pieces(cls, ciphers: Iterable[bytes]) -> tuple[list[list[bytes]], list[list[bytes]]]:
+        """Sorts pieces of any number of messages from **send_message** into their messages
+
+        :param ciphers: the pieces, in any order, a piece received twice is kept once
+        :return: the messages whose pieces are all there, each ready for **receive_message**, and the incomplete
+                 ones
+        """
+
+        messages: dict[bytes, dict[int, bytes]] = {}
+        counts: dict[bytes, int] = {}
+        for cipher in ciphers:
+            key, index, count = cls.message_piece(cipher)
+            messages.setdefault(key, {}).setdefault(index, cipher)
+            counts.setdefault(key, count)
+        complete, incomplete = [], []
+        for key, pieces in messages.items():
+            (complete if len(pieces) == counts[key] else incomplete).append(list(pieces.values()))
+        return complete, incomplete
+
+    def receive_message(self, ciphers: Sequence[bytes]) -> tuple[list[bytes], User]:
+        """Decrypts all the pieces of a message sent by **send_message**, unwrapping its session key once
+
+        :param ciphers: the pieces, in any order
+        :return: the plain pieces in the order they were sent, and the user who sent them
+        """
+
+        if self.__closed:
+            raise ValueError("contacts has been closed")
+
+        header_size = DYNAMIC_ID_SIZE + NONCE_SIZE + 2 * INDEX_SIZE
+        pieces: dict[int, bytes] = {}
+        for cipher in ciphers:
+            _, index, count = self.message_piece(cipher)
+            if count != len(ciphers):
+                raise ValueError(f"{len(ciphers)} pieces received out of {count}")
+            if index >= count or index in pieces:
+                raise ValueError(f"invalid piece index {index}")
+            pieces[index] = cipher
+        if len(pieces) == 0:
+            raise ValueError("no pieces")
+        del ciphers
+
+        reader = BytesIO(pieces[0])
+        dynamic_id = reader.read(DYNAMIC_ID_SIZE)
+        user, updated = self.contacts.find_by_dynamic_id(dynamic_id)
+        if user is None:
+            raise ValueError(f"user not found: dynamic_id {dynamic_id.hex()} is not found")
+        nonce = reader.read(NONCE_SIZE)
+        reader.read(2 * INDEX_SIZE)
+        del dynamic_id
+
+        # a message sent before the sender saw the last rotation is wrapped for the keys that are past now
+        key_set = user.keys.new if updated else user.keys.pst
+        private_key = serialization.load_der_private_key(key_set.rsa_key, None)
+        session_key_cipher = reader.read(RSA_SIZE)
+        session_key_plain = private_key.decrypt(session_key_cipher, padding.OAEP(
+            mgf=padding.MGF1(algorithm=hashes.SHA256()),
+            algorithm=hashes.SHA256(),
+            label=None
+        ))
+        del private_key, session_key_cipher
+
+        session_key = session_key_plain[:AES_SIZE]
+        exchange_section_len = int.from_bytes(session_key_plain[AES_SIZE:], "little", signed=False)
+        del session_key_plain
+
+        exchange_section_ccm = AESCCM(session_key)
+        exchange_section_cipher = reader.read(exchange_section_len)
+        exchange_section_plain = exchange_section_ccm.decrypt(nonce, exchange_section_cipher, None)
+        del exchange_section_ccm, exchange_section_cipher
+
+        expected_exchange_section_hash = hashes.Hash(hashes.SHA256())
+        expected_exchange_section_hash.update(exchange_section_plain)
+        received_exchange_section_hash = reader.read(SHA_SIZE)
+        if expected_exchange_section_hash.finalize() != received_exchange_section_hash:
+            raise ValueError("exchange section hash not matched")
+        del expected_exchange_section_hash, received_exchange_section_hash
+
+        # every piece is decrypted before the keys rotate, a message that doesn't check out changes nothing
+        piece_ccm = AESCCM(self.__piece_key(key_set.aes_key, session_key))
+        del key_set, session_key
+
+        plains = []
+        for index in range(len(pieces)):
+            piece = pieces[index]
+            dynamic_id = piece[:DYNAMIC_ID_SIZE]
+            if self.contacts.find_by_dynamic_id(dynamic_id)[0] is not user:
+                raise ValueError(f"piece {index} is from another user")
+            if piece[DYNAMIC_ID_SIZE:DYNAMIC_ID_SIZE + NONCE_SIZE] != nonce:
+                raise ValueError(f"piece {index} is from another message")
+            body = reader.read() if index == 0 else piece[header_size:]
+            plains.append(piece_ccm.decrypt(self.__piece_nonce(nonce, index), body, piece[:header_size]))
+        del piece_ccm, pieces
+
+        if updated:
+            exchange_section_reader = BytesIO(exchange_section_plain)
+            new_aes_key = exchange_section_reader.read(AES_SIZE)
+            new_dynamic_ids = tuple([exchange_section_reader.read(DYNAMIC_ID_SIZE) for _ in range(DYNAMIC_ID_NUM)])
+            new_public_key = exchange_section_reader.read()
+            del exchange_section_reader
+
+            user.keys.pst = user.keys.new
+            user.keys.crt = KeySet(new_aes_key, new_public_key, new_dynamic_ids)
+            user.keys.new = KeySet.generate(self.contacts.generate_dynamic_ids())
+            self.contacts.update_user(user)
+            del new_aes_key, new_dynamic_ids, new_public_key
+        del exchange_section_plain
 
-        return b"".join((dynamic_id, nonce, exchange_section_cipher, body))
+        return plains, user
 
     def receive(self, cipher: bytes) -> tuple[bytes, User]:
         if self.__closed:
@@ -437,6 +703,7 @@ class Encryption:
             user.keys.pst = user.keys.new
             user.keys.crt = KeySet(new_aes_key, new_public_key, new_dynamic_ids)
             user.keys.new = KeySet.generate(self.contacts.generate_dynamic_ids())
+            self.contacts.update_user(user)
             del new_aes_key, new_dynamic_ids, new_public_key
         del exchange_section_plain
 
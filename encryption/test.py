@@ -1,9 +1,14 @@
+import base64
 import copy
 import io
 import os
 import secrets
 import unittest
 
+from cryptography.fernet import Fernet
+from cryptography.hazmat.primitives import hashes
+
+import distribution
 import encryption
 
 
@@ -99,6 +104,62 @@ class ContactsTest(unittest.TestCase):
         recovered = encryption.Contacts.open(file, key)
         self.assertEqual(recovered, contacts)
 
+    def test_log(self):
+        file = io.BytesIO()
+        key = "Hello, World"
+
+        contacts = encryption.Contacts.create(file, key)
+        users = [contacts.invite(f"TestUser{i}") for i in range(3)]
+        contacts.save(file)
+        before = file.getvalue()
+        size = len(before)
+
+        # a change appends a record of its user alone
+        renamed = copy.deepcopy(users[1])
+        renamed.name = "Renamed"
+        contacts.update_user(renamed)
+        self.assertRaises(ValueError, contacts.update_user, encryption.User(users[0].id, "Renamed", users[0].keys))
+        self.assertEqual(contacts.find_by_name("Renamed"), renamed)
+        self.assertEqual(contacts.find_by_name("TestUser1"), None)
+        contacts.save(file)
+        self.assertTrue(file.getvalue().startswith(before))
+        self.assertLess(len(file.getvalue()) - size, size // 2)
+
+        file.seek(0)
+        recovered = encryption.Contacts.open(file, key)
+        self.assertEqual(recovered, contacts)
+        self.assertEqual(recovered.find_by_dynamic_id(renamed.keys.new.dynamic_ids[-1]), (renamed, True))
+
+        # an append cut short is dropped and written over
+        file.truncate(len(file.getvalue()) - 10)
+        file.seek(0)
+        recovered = encryption.Contacts.open(file, key)
+        self.assertEqual(recovered.find_by_name("TestUser1"), users[1])
+        recovered.save(file)
+        file.seek(0)
+        self.assertEqual(encryption.Contacts.open(file, key).users, [users[0], users[1], users[2]])
+
+        # enough changes compact the log to a record per user
+        for _ in range(encryption.COMPACT_MIN):
+            contacts.update_user(renamed)
+            contacts.save(file)
+        self.assertLess(len(file.getvalue()), 2 * size)
+        file.seek(0)
+        self.assertEqual(encryption.Contacts.open(file, key), contacts)
+
+    def test_whole(self):
+        # the format written before the log is still read
+        users = [encryption.User.create(f"TestUser{i}", i, tuple(os.urandom(8) for _ in range(
+            encryption.DYNAMIC_ID_NUM))) for i in range(2)]
+        h = hashes.Hash(hashes.SHA256())
+        h.update(b"Hello, World")
+        f = Fernet(base64.urlsafe_b64encode(h.finalize()))
+        plain = len(users).to_bytes(2, "little") + b"".join(
+            len(bytes(user)).to_bytes(2, "little") + bytes(user) for user in users)
+        contacts = encryption.Contacts.load(f.encrypt(plain), "Hello, World")
+        self.assertEqual(contacts.users, users)
+        self.assertEqual(contacts.find_by_id(1), users[1])
+
 
 class EncryptionTest(unittest.TestCase):
     def test(self):
@@ -124,6 +185,66 @@ class EncryptionTest(unittest.TestCase):
                 self.assertEqual(received_word, word)
                 self.assertEqual(received_user.id, user1.id)
 
+    def test_message(self):
+        file1 = io.BytesIO()
+        file2 = io.BytesIO()
+        key = "Hello, World"
+        pieces = [os.urandom(100), b"", os.urandom(3000)]
+
+        with encryption.Encryption(file1, key, True) as e1:
+            with encryption.Encryption(file2, key, True) as e2:
+                invitation, user2 = e1.invite("TestUser2", key)
+                user1 = e2.receive_invitation(invitation, "TestUser1", key)
+
+                self.assertRaises(PermissionError, e1.send_message, pieces, user2.id)
+
+                # the pieces come back in the order they were sent whatever order they are received in
+                msg = [b"".join(sections) for sections in e2.send_message(pieces, user1.id)]
+                received_pieces, received_user = e1.receive_message(msg[::-1])
+                self.assertEqual(received_pieces, pieces)
+                self.assertEqual(received_user.id, user2.id)
+
+                msg = [b"".join(sections) for sections in e1.send_message(pieces, user2.id)]
+                self.assertRaises(ValueError, e2.receive_message, msg[:2])
+                tampered = msg[:2] + [msg[2][:-1] + bytes([msg[2][-1] ^ 1])]
+                self.assertRaises(Exception, e2.receive_message, tampered)
+                received_pieces, received_user = e2.receive_message(msg)
+                self.assertEqual(received_pieces, pieces)
+                self.assertEqual(received_user.id, user1.id)
+
+                # a message following the rotation of the keys
+                msg = [b"".join(sections) for sections in e2.send_message(pieces[:1], user1.id)]
+                self.assertEqual(e1.receive_message(msg)[0], pieces[:1])
+
+    def test_interleaved(self):
+        file1 = io.BytesIO()
+        file2 = io.BytesIO()
+        key = "Hello, World"
+        contents = [os.urandom(5000), os.urandom(3000)]
+
+        with encryption.Encryption(file1, key, True) as e1:
+            with encryption.Encryption(file2, key, True) as e2:
+                invitation, user2 = e1.invite("TestUser2", key)
+                user1 = e2.receive_invitation(invitation, "TestUser1", key)
+
+                # split and encrypted like compose does, the pieces of both messages then arrive mixed up
+                sent = [[b"".join(sections) for sections in e2.send_message(
+                    distribution.split(content, [len(content) // 3 + 1] * 3), user1.id)] for content in contents]
+                received = sent[0][2:] + sent[1][::-1] + sent[0][:2] + sent[1][:1]
+
+                complete, incomplete = encryption.Encryption.group_pieces(received)
+                self.assertEqual(incomplete, [])
+                merged = []
+                for pieces in complete:
+                    plains, user = e1.receive_message(pieces)
+                    self.assertEqual(user.id, user2.id)
+                    merged.append(distribution.merge(plains))
+                self.assertCountEqual(merged, contents)
+
+                # a message missing a piece is held back, its pieces telling where they belong
+                self.assertEqual(encryption.Encryption.message_piece(sent[1][2])[1:], (2, 3))
+                self.assertEqual(encryption.Encryption.group_pieces(sent[1][1:]), ([], [sent[1][1:]]))
+
 
 if __name__ == '__main__':
     unittest.main()
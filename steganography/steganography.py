@@ -1,25 +1,106 @@
+import contextlib
 import ctypes
 from enum import Enum
-from typing import BinaryIO, Sequence
+from typing import BinaryIO, Iterator, Sequence
 import pathlib
 import os.path
+import time
 
 from PIL import Image
 
-# C data structure definitions
-SQUARE_SIZE = 16
-
-
-class CSquare(ctypes.Structure):
-    """An internal C struct representing the data structure of a square"""
+# buffer protocol access, so pixels and payloads reach the C library without being copied
+class CPyBuffer(ctypes.Structure):
+    """The C struct **Py_buffer** of the CPython API"""
 
     _fields_ = (
-        ('x', ctypes.c_uint64),
-        ('y', ctypes.c_uint64),
-        ('entropy', ctypes.c_double),
+        ('buf', ctypes.c_void_p),
+        ('obj', ctypes.c_void_p),  # not a py_object, the reference belongs to PyBuffer_Release
+        ('len', ctypes.c_ssize_t),
+        ('itemsize', ctypes.c_ssize_t),
+        ('readonly', ctypes.c_int),
+        ('ndim', ctypes.c_int),
+        ('format', ctypes.c_char_p),
+        ('shape', ctypes.POINTER(ctypes.c_ssize_t)),
+        ('strides', ctypes.POINTER(ctypes.c_ssize_t)),
+        ('suboffsets', ctypes.POINTER(ctypes.c_ssize_t)),
+        ('internal', ctypes.c_void_p),
     )
 
 
+PyBUF_SIMPLE = 0  # contiguous bytes, an exporter that can't provide them raises BufferError
+PyBUF_WRITABLE = 1
+
+# int PyObject_GetBuffer(PyObject *exporter, Py_buffer *view, int flags);
+PyObject_GetBuffer = ctypes.pythonapi.PyObject_GetBuffer
+PyObject_GetBuffer.argtypes = (ctypes.py_object, ctypes.POINTER(CPyBuffer), ctypes.c_int)
+PyObject_GetBuffer.restype = ctypes.c_int
+
+# void PyBuffer_Release(Py_buffer *view);
+PyBuffer_Release = ctypes.pythonapi.PyBuffer_Release
+PyBuffer_Release.argtypes = (ctypes.POINTER(CPyBuffer),)
+PyBuffer_Release.restype = None
+
+
+class PixelBuffer:
+    """
+    Any object with the buffer protocol (bytes, bytearray, memoryview, numpy arrays, ...) held in place for the C
+    library until **release**. Nothing is copied, the object can't be resized while it is held.
+    """
+
+    def __init__(self, obj, writable: bool = False):
+        """
+        :param obj: the exporter, it has to be contiguous
+        :param writable: whether the library writes into it, read-only exporters are refused then
+        """
+
+        # nothing is held yet if the exporter refuses, releasing has to know
+        self.held = False
+        self.view = CPyBuffer()
+        PyObject_GetBuffer(obj, ctypes.byref(self.view), PyBUF_WRITABLE if writable else PyBUF_SIMPLE)
+        self.held = True
+
+    @property
+    def pointer(self):
+        return ctypes.cast(self.view.buf, ctypes.POINTER(ctypes.c_uint8))
+
+    def __len__(self) -> int:
+        return self.view.len
+
+    def release(self) -> None:
+        if self.held:
+            PyBuffer_Release(ctypes.byref(self.view))
+            self.held = False
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *_):
+        self.release()
+
+    def __del__(self):
+        self.release()
+
+
+def library_view(pointer, length: int) -> memoryview:
+    """A read-only view of memory the C library owns, valid only as long as the library keeps it"""
+
+    if length == 0:
+        return memoryview(b"")
+    address = ctypes.cast(pointer, ctypes.c_void_p).value
+    return memoryview((ctypes.c_uint8 * length).from_address(address)).cast("B").toreadonly()
+
+
+# C data structure definitions
+SQUARE_SIZE = 16  # the default, squares may also be 8 or 32 pixels wide
+SQUARE_SIZES = (8, 16, 32)
+SAMPLE_BITS = (1, 2, 3, 4)  # payload bits per pixel byte, more of them carry more data per square
+
+
+# typedef uint64_t Square;
+# a square packs its inverted entropy key (high 32 bits) and its block index (low 32 bits)
+CSquare = ctypes.c_uint64
+
+
 class CSquareList(ctypes.Structure):
     """An internal C struct representing the data structure of **list[CSquare]**"""
 
@@ -40,6 +121,8 @@ class CImage(ctypes.Structure):
         ('squareList', CSquareList),
         ('usage', ctypes.c_uint64),
         ('copied', ctypes.c_bool),
+        ('squareSize', ctypes.c_uint64),
+        ('bits', ctypes.c_uint64),
     )
 
     def __bytes__(self) -> bytes:
@@ -48,12 +131,27 @@ class CImage(ctypes.Structure):
     def get_pixels(self) -> bytes:
         return bytes(ctypes.cast(self.pixels, ctypes.POINTER(ctypes.c_uint8 * self.w * self.h * self.c)).contents)
 
+    def view_pixels(self) -> memoryview:
+        """The pixels without a copy, valid as long as whoever owns them keeps them"""
+
+        return library_view(self.pixels, self.w * self.h * self.c)
+
     @classmethod
-    def new_image(cls, image: Image.Image):
+    def new_image(cls, image: Image.Image, square_size: int = 0, bits: int = 0):
+        # a square size or bits of 0 mean the default when embedding and whatever the header says when extracting
         channels = len(image.getbands())
         pixels = image.tobytes()
         buffer = (ctypes.c_uint8 * len(pixels)).from_buffer(bytearray(pixels))
-        return cls(image.width, image.height, channels, buffer, CSquareList(None, 0), 0, False)
+        return cls(image.width, image.height, channels, buffer, CSquareList(None, 0), 0, False, square_size, bits)
+
+    @classmethod
+    def from_pixels(cls, pixels: PixelBuffer, width: int, height: int, channels: int, square_size: int = 0,
+                    bits: int = 0):
+        """An image over the pixels of a held buffer, the buffer has to stay held while the image is used"""
+
+        if len(pixels) != width * height * channels:
+            raise ValueError(f"{len(pixels)} bytes can't be {width}x{height} pixels of {channels} channels")
+        return cls(width, height, channels, pixels.pointer, CSquareList(None, 0), 0, False, square_size, bits)
 
 
 class CImageList(ctypes.Structure):
@@ -62,6 +160,7 @@ class CImageList(ctypes.Structure):
     _fields_ = (
         ('images', ctypes.POINTER(CImage)),
         ('len', ctypes.c_uint64),
+        ('copied', ctypes.c_bool),
     )
 
     def get_images(self) -> list[CImage]:
@@ -83,6 +182,17 @@ class CData(ctypes.Structure):
     def get_data(self) -> bytes:
         return bytes(ctypes.cast(self.data, ctypes.POINTER(ctypes.c_uint8 * self.len)).contents)
 
+    def view_data(self) -> memoryview:
+        """The data without a copy, valid as long as whoever owns them keeps them"""
+
+        return library_view(self.data, self.len)
+
+    @classmethod
+    def from_buffer(cls, data: PixelBuffer):
+        """A piece over a held buffer, the library only reads it"""
+
+        return cls(data.pointer, len(data), False)
+
 
 class CDataPieces(ctypes.Structure):
     """A C struct representing the data structure of **list[bytes]**"""
@@ -96,6 +206,33 @@ class CDataPieces(ctypes.Structure):
         return [bytes(i) for i in list(ctypes.cast(self.pieces, ctypes.POINTER(CData * self.len)).contents)]
 
 
+class CSegment(ctypes.Structure):
+    """A C struct representing a stretch of a piece"""
+
+    _fields_ = (
+        ('data', ctypes.POINTER(ctypes.c_uint8)),
+        ('len', ctypes.c_uint64),
+    )
+
+
+class CSegments(ctypes.Structure):
+    """A C struct representing a piece given as **list[bytes]** that are read one after another"""
+
+    _fields_ = (
+        ('segments', ctypes.POINTER(CSegment)),
+        ('len', ctypes.c_uint64),
+    )
+
+
+class CSegmentPieces(ctypes.Structure):
+    """A C struct representing the data structure of **list[list[bytes]]**"""
+
+    _fields_ = (
+        ('pieces', ctypes.POINTER(CSegments)),
+        ('len', ctypes.c_uint64),
+    )
+
+
 class CPrecomputed(ctypes.Structure):
     """A C struct representing the result of function **precompute**"""
 
@@ -113,7 +250,7 @@ class CPrecomputed(ctypes.Structure):
 
         result: list[int] = []
         for c_image in self.imageList.get_images():
-            result.append(c_image.usage * (SQUARE_SIZE * SQUARE_SIZE * c_image.c) - reserved)
+            result.append(c_image.usage * square_len(ctypes.byref(c_image)) - reserved)
         return tuple(result)
 
 
@@ -126,10 +263,135 @@ class CExtracted(ctypes.Structure):
     )
 
 
+class CProbed(ctypes.Structure):
+    """A C struct representing the result of function **probe**"""
+
+    _fields_ = (
+        ('present', ctypes.c_bool),
+        ('len', ctypes.c_uint64),
+        ('squareSize', ctypes.c_uint64),
+        ('bits', ctypes.c_uint64),
+        ('code', ctypes.c_uint64),
+    )
+
+
+class CStats(ctypes.Structure):
+    """A C struct holding what a call spent its time and memory on, the fields add up over calls"""
+
+    _fields_ = (
+        ('copyNs', ctypes.c_uint64),
+        ('entropyNs', ctypes.c_uint64),
+        ('sortNs', ctypes.c_uint64),
+        ('allocateNs', ctypes.c_uint64),
+        ('bitsNs', ctypes.c_uint64),
+        ('bytesTouched', ctypes.c_uint64),
+        ('squaresEvaluated', ctypes.c_uint64),
+        ('squaresUsed', ctypes.c_uint64),
+        ('allocations', ctypes.c_uint64),
+        ('peakBytes', ctypes.c_uint64),
+        ('cacheNs', ctypes.c_uint64),
+        ('cacheHits', ctypes.c_uint64),
+    )
+
+    def as_dict(self) -> dict[str, int]:
+        return {name: getattr(self, name) for name, _ in self._fields_}
+
+
+class CExtractedList(ctypes.Structure):
+    """A C struct representing the result of function **extract_list**"""
+
+    _fields_ = (
+        ('dataPieces', CDataPieces),
+        ('codes', ctypes.POINTER(ctypes.c_uint64)),
+        ('code', ctypes.c_uint64),
+    )
+
+
+class CExtractCursor(ctypes.Structure):
+    """A C struct representing a payload that is being read square by square"""
+
+    _fields_ = (
+        ('image', CImage),
+        ('remaining', ctypes.c_uint64),
+        ('len', ctypes.c_uint64),
+        ('offset', ctypes.c_uint64),
+        ('buffer', ctypes.POINTER(ctypes.c_uint8)),
+        ('position', ctypes.c_uint64),
+        ('buffered', ctypes.c_uint64),
+        ('code', ctypes.c_uint64),
+    )
+
+
+class CImageFile(ctypes.Structure):
+    """A C struct representing a PNM, PAM or BMP file mapped into memory"""
+
+    _fields_ = (
+        ('image', CImage),
+        ('map', ctypes.POINTER(ctypes.c_uint8)),
+        ('mapLen', ctypes.c_uint64),
+        ('offset', ctypes.c_uint64),
+        ('stride', ctypes.c_uint64),
+        ('depth', ctypes.c_uint64),
+        ('bmp', ctypes.c_bool),
+        ('bottomUp', ctypes.c_bool),
+        ('writable', ctypes.c_bool),
+        ('handle', ctypes.c_void_p),
+        ('code', ctypes.c_uint64),
+    )
+
+
+# bool read(void *context, uint64_t row, uint64_t rows, uint8_t *pixels);
+StripReader = ctypes.CFUNCTYPE(ctypes.c_bool, ctypes.c_void_p, ctypes.c_uint64, ctypes.c_uint64,
+                               ctypes.POINTER(ctypes.c_uint8))
+
+# bool write(void *context, uint64_t row, uint64_t rows, const uint8_t *pixels);
+StripWriter = ctypes.CFUNCTYPE(ctypes.c_bool, ctypes.c_void_p, ctypes.c_uint64, ctypes.c_uint64,
+                               ctypes.POINTER(ctypes.c_uint8))
+
+
+class CStripImage(ctypes.Structure):
+    """A C struct representing an image read and written a strip of rows at a time"""
+
+    _fields_ = (
+        ('w', ctypes.c_uint64),
+        ('h', ctypes.c_uint64),
+        ('c', ctypes.c_uint64),
+        ('squareSize', ctypes.c_uint64),
+        ('bits', ctypes.c_uint64),
+        ('read', StripReader),
+        ('write', StripWriter),
+        ('context', ctypes.c_void_p),
+    )
+
+
+class CReassembled(ctypes.Structure):
+    """A C struct representing a message function **reassembly_next** put back together"""
+
+    _fields_ = (
+        ('id', ctypes.c_uint8 * 8),
+        ('time', ctypes.c_uint64),
+        ('data', CSegments),
+        ('len', ctypes.c_uint64),
+        ('message', ctypes.c_void_p),
+    )
+
+
+class CSelection(ctypes.Structure):
+    """A C struct representing the result of function **select_covers**"""
+
+    _fields_ = (
+        ('indices', ctypes.POINTER(ctypes.c_uint64)),
+        ('len', ctypes.c_uint64),
+        ('capacity', ctypes.c_uint64),
+        ('code', ctypes.c_uint64),
+    )
+
+
 # typedef CPrecomputed CEmbedded;
 CEmbedded = CPrecomputed
 
 # C function definitions
+# CDLL releases the GIL for every call, so other Python threads keep running while the library works
 DLL = ctypes.CDLL(os.path.join(pathlib.Path(__file__).parent.resolve(), "libstegano.dll"))
 
 # Precomputed precompute(ImageList imageList, uint64_t dataLen, uint64_t reserved);
@@ -137,26 +399,261 @@ precompute: ctypes.CFUNCTYPE = DLL.precompute
 precompute.argtypes = (CImageList, ctypes.c_uint64, ctypes.c_uint64)
 precompute.restype = CPrecomputed
 
+# Precomputed precompute_inplace(ImageList imageList, uint64_t dataLen, uint64_t reserved);
+precompute_inplace: ctypes.CFUNCTYPE = DLL.precompute_inplace
+precompute_inplace.argtypes = (CImageList, ctypes.c_uint64, ctypes.c_uint64)
+precompute_inplace.restype = CPrecomputed
+
 # Embedded embed(Precomputed precomputed, DataPieces dataPieces);
 embed: ctypes.CFUNCTYPE = DLL.embed
 embed.argtypes = (CPrecomputed, CDataPieces)
 embed.restype = CEmbedded
 
+# Precomputed precompute_stats(ImageList imageList, uint64_t dataLen, uint64_t reserved, bool inplace, Stats *stats);
+precompute_stats: ctypes.CFUNCTYPE = DLL.precompute_stats
+precompute_stats.argtypes = (CImageList, ctypes.c_uint64, ctypes.c_uint64, ctypes.c_bool, ctypes.POINTER(CStats))
+precompute_stats.restype = CPrecomputed
+
+# Embedded embed_stats(Precomputed precomputed, DataPieces dataPieces, Stats *stats);
+embed_stats: ctypes.CFUNCTYPE = DLL.embed_stats
+embed_stats.argtypes = (CPrecomputed, CDataPieces, ctypes.POINTER(CStats))
+embed_stats.restype = CEmbedded
+
+# Embedded embed_segments(Precomputed precomputed, SegmentPieces segmentPieces);
+embed_segments: ctypes.CFUNCTYPE = DLL.embed_segments
+embed_segments.argtypes = (CPrecomputed, CSegmentPieces)
+embed_segments.restype = CEmbedded
+
+# Embedded embed_segments_stats(Precomputed precomputed, SegmentPieces segmentPieces, Stats *stats);
+embed_segments_stats: ctypes.CFUNCTYPE = DLL.embed_segments_stats
+embed_segments_stats.argtypes = (CPrecomputed, CSegmentPieces, ctypes.POINTER(CStats))
+embed_segments_stats.restype = CEmbedded
+
 # Extracted extract(Image image, uint64_t reserved);
 extract: ctypes.CFUNCTYPE = DLL.extract
 extract.argtypes = (CImage, ctypes.c_uint64)
 extract.restype = CExtracted
 
+# Extracted extract_inplace(Image image, uint64_t reserved);
+extract_inplace: ctypes.CFUNCTYPE = DLL.extract_inplace
+extract_inplace.argtypes = (CImage, ctypes.c_uint64)
+extract_inplace.restype = CExtracted
+
+# Extracted extract_stats(Image image, uint64_t reserved, bool inplace, Stats *stats);
+extract_stats: ctypes.CFUNCTYPE = DLL.extract_stats
+extract_stats.argtypes = (CImage, ctypes.c_uint64, ctypes.c_bool, ctypes.POINTER(CStats))
+extract_stats.restype = CExtracted
+
+# Probed probe(Image image, uint64_t reserved);
+probe: ctypes.CFUNCTYPE = DLL.probe
+probe.argtypes = (CImage, ctypes.c_uint64)
+probe.restype = CProbed
+
+# ExtractedList extract_list(ImageList imageList, uint64_t reserved);
+extract_list: ctypes.CFUNCTYPE = DLL.extract_list
+extract_list.argtypes = (CImageList, ctypes.c_uint64)
+extract_list.restype = CExtractedList
+
+# ExtractCursor extract_begin(Image image, uint64_t reserved);
+extract_begin: ctypes.CFUNCTYPE = DLL.extract_begin
+extract_begin.argtypes = (CImage, ctypes.c_uint64)
+extract_begin.restype = CExtractCursor
+
+# uint64_t extract_read(ExtractCursor *cursor, uint8_t *data, uint64_t len);
+extract_read: ctypes.CFUNCTYPE = DLL.extract_read
+extract_read.argtypes = (ctypes.POINTER(CExtractCursor), ctypes.POINTER(ctypes.c_uint8), ctypes.c_uint64)
+extract_read.restype = ctypes.c_uint64
+
+# void extract_end(ExtractCursor *cursor);
+extract_end: ctypes.CFUNCTYPE = DLL.extract_end
+extract_end.argtypes = (ctypes.POINTER(CExtractCursor),)
+extract_end.restype = None
+
+# Context *context_new(void);
+context_new: ctypes.CFUNCTYPE = DLL.context_new
+context_new.argtypes = ()
+context_new.restype = ctypes.c_void_p
+
+# void context_reset(Context *context);
+context_reset: ctypes.CFUNCTYPE = DLL.context_reset
+context_reset.argtypes = (ctypes.c_void_p,)
+context_reset.restype = None
+
+# void context_free(Context *context);
+context_free: ctypes.CFUNCTYPE = DLL.context_free
+context_free.argtypes = (ctypes.c_void_p,)
+context_free.restype = None
+
+# Precomputed precompute_context(Context *context, ImageList imageList, uint64_t dataLen, uint64_t reserved,
+#                                bool inplace);
+precompute_context: ctypes.CFUNCTYPE = DLL.precompute_context
+precompute_context.argtypes = (ctypes.c_void_p, CImageList, ctypes.c_uint64, ctypes.c_uint64, ctypes.c_bool)
+precompute_context.restype = CPrecomputed
+
+# uint64_t context_capacity(const Context *context);
+context_capacity: ctypes.CFUNCTYPE = DLL.context_capacity
+context_capacity.argtypes = (ctypes.c_void_p,)
+context_capacity.restype = ctypes.c_uint64
+
+# Embedded embed_segments_context(Context *context, Precomputed precomputed, SegmentPieces segmentPieces);
+embed_segments_context: ctypes.CFUNCTYPE = DLL.embed_segments_context
+embed_segments_context.argtypes = (ctypes.c_void_p, CPrecomputed, CSegmentPieces)
+embed_segments_context.restype = CEmbedded
+
+# Extracted extract_context(Context *context, Image image, uint64_t reserved, bool inplace);
+extract_context: ctypes.CFUNCTYPE = DLL.extract_context
+extract_context.argtypes = (ctypes.c_void_p, CImage, ctypes.c_uint64, ctypes.c_bool)
+extract_context.restype = CExtracted
+
+# Covers *covers_new(uint64_t reserved);
+covers_new: ctypes.CFUNCTYPE = DLL.covers_new
+covers_new.argtypes = (ctypes.c_uint64,)
+covers_new.restype = ctypes.c_void_p
+
+# uint64_t covers_add(Covers *covers, ImageList imageList, bool inplace, Stats *stats);
+covers_add: ctypes.CFUNCTYPE = DLL.covers_add
+covers_add.argtypes = (ctypes.c_void_p, CImageList, ctypes.c_bool, ctypes.POINTER(CStats))
+covers_add.restype = ctypes.c_uint64
+
+# uint64_t covers_remove(Covers *covers, uint64_t index);
+covers_remove: ctypes.CFUNCTYPE = DLL.covers_remove
+covers_remove.argtypes = (ctypes.c_void_p, ctypes.c_uint64)
+covers_remove.restype = ctypes.c_uint64
+
+# Precomputed covers_allocate(Covers *covers, uint64_t dataLen, Stats *stats);
+covers_allocate: ctypes.CFUNCTYPE = DLL.covers_allocate
+covers_allocate.argtypes = (ctypes.c_void_p, ctypes.c_uint64, ctypes.POINTER(CStats))
+covers_allocate.restype = CPrecomputed
+
+# void covers_free(Covers *covers);
+covers_free: ctypes.CFUNCTYPE = DLL.covers_free
+covers_free.argtypes = (ctypes.c_void_p,)
+covers_free.restype = None
+
+# the strip functions are called through DLL, the module-level embed_strips and extract_strips wrap them
+# uint64_t embed_strips(StripImage image, Segments piece, uint64_t reserved);
+DLL.embed_strips.argtypes = (CStripImage, CSegments, ctypes.c_uint64)
+DLL.embed_strips.restype = ctypes.c_uint64
+
+# Extracted extract_strips(StripImage image, uint64_t reserved);
+DLL.extract_strips.argtypes = (CStripImage, ctypes.c_uint64)
+DLL.extract_strips.restype = CExtracted
+
+# Reassembly *reassembly_new(uint64_t memoryLimit, uint64_t maxAge);
+reassembly_new: ctypes.CFUNCTYPE = DLL.reassembly_new
+reassembly_new.argtypes = (ctypes.c_uint64, ctypes.c_uint64)
+reassembly_new.restype = ctypes.c_void_p
+
+# uint64_t reassembly_add(Reassembly *reassembly, const uint8_t *chunk, uint64_t len, uint64_t now);
+reassembly_add: ctypes.CFUNCTYPE = DLL.reassembly_add
+reassembly_add.argtypes = (ctypes.c_void_p, ctypes.POINTER(ctypes.c_uint8), ctypes.c_uint64, ctypes.c_uint64)
+reassembly_add.restype = ctypes.c_uint64
+
+# uint64_t reassembly_expire(Reassembly *reassembly, uint64_t now);
+reassembly_expire: ctypes.CFUNCTYPE = DLL.reassembly_expire
+reassembly_expire.argtypes = (ctypes.c_void_p, ctypes.c_uint64)
+reassembly_expire.restype = ctypes.c_uint64
+
+# Reassembled reassembly_next(Reassembly *reassembly);
+reassembly_next: ctypes.CFUNCTYPE = DLL.reassembly_next
+reassembly_next.argtypes = (ctypes.c_void_p,)
+reassembly_next.restype = CReassembled
+
+# void reassembly_release(Reassembly *reassembly, Reassembled reassembled);
+reassembly_release: ctypes.CFUNCTYPE = DLL.reassembly_release
+reassembly_release.argtypes = (ctypes.c_void_p, CReassembled)
+reassembly_release.restype = None
+
+# uint64_t reassembly_pending(const Reassembly *reassembly);
+reassembly_pending: ctypes.CFUNCTYPE = DLL.reassembly_pending
+reassembly_pending.argtypes = (ctypes.c_void_p,)
+reassembly_pending.restype = ctypes.c_uint64
+
+# uint64_t reassembly_memory(const Reassembly *reassembly);
+reassembly_memory: ctypes.CFUNCTYPE = DLL.reassembly_memory
+reassembly_memory.argtypes = (ctypes.c_void_p,)
+reassembly_memory.restype = ctypes.c_uint64
+
+# void reassembly_free(Reassembly *reassembly);
+reassembly_free: ctypes.CFUNCTYPE = DLL.reassembly_free
+reassembly_free.argtypes = (ctypes.c_void_p,)
+reassembly_free.restype = None
+
+# Selection select_covers(ImageList pool, uint64_t dataLen, uint64_t reserved, uint64_t floor, uint64_t goal);
+select_covers: ctypes.CFUNCTYPE = DLL.select_covers
+select_covers.argtypes = (CImageList, ctypes.c_uint64, ctypes.c_uint64, ctypes.c_uint64, ctypes.c_uint64)
+select_covers.restype = CSelection
+
+# void free_selection(Selection selection);
+free_selection: ctypes.CFUNCTYPE = DLL.free_selection
+free_selection.argtypes = (CSelection,)
+free_selection.restype = None
+
+# ImageFile map_image(const char *path);
+map_image: ctypes.CFUNCTYPE = DLL.map_image
+map_image.argtypes = (ctypes.c_char_p,)
+map_image.restype = CImageFile
+
+# ImageFile map_image_copy(const char *src, const char *dst);
+map_image_copy: ctypes.CFUNCTYPE = DLL.map_image_copy
+map_image_copy.argtypes = (ctypes.c_char_p, ctypes.c_char_p)
+map_image_copy.restype = CImageFile
+
+# uint64_t sync_image(ImageFile *file);
+sync_image: ctypes.CFUNCTYPE = DLL.sync_image
+sync_image.argtypes = (ctypes.POINTER(CImageFile),)
+sync_image.restype = ctypes.c_uint64
+
+# void unmap_image(ImageFile *file);
+unmap_image: ctypes.CFUNCTYPE = DLL.unmap_image
+unmap_image.argtypes = (ctypes.POINTER(CImageFile),)
+unmap_image.restype = None
+
+# Extracted extract_file(const char *path, uint64_t reserved);
+extract_file: ctypes.CFUNCTYPE = DLL.extract_file
+extract_file.argtypes = (ctypes.c_char_p, ctypes.c_uint64)
+extract_file.restype = CExtracted
+
+# uint64_t set_cache(const char *directory);
+set_cache: ctypes.CFUNCTYPE = DLL.set_cache
+set_cache.argtypes = (ctypes.c_char_p,)
+set_cache.restype = ctypes.c_uint64
+
+# void free_dataPieces(DataPieces *dataPieces);
+free_dataPieces: ctypes.CFUNCTYPE = DLL.free_dataPieces
+free_dataPieces.argtypes = (ctypes.POINTER(CDataPieces),)
+free_dataPieces.restype = None
+
 # void free_precomputed(Precomputed precomputed);
 free_precomputed: ctypes.CFUNCTYPE = DLL.free_precomputed
 free_precomputed.argtypes = (CPrecomputed,)
 free_precomputed.restype = None
 
+# uint64_t square_len(const Image *image);
+square_len: ctypes.CFUNCTYPE = DLL.square_len
+square_len.argtypes = (ctypes.POINTER(CImage),)
+square_len.restype = ctypes.c_uint64
+
+# uint64_t set_threads(uint64_t threads);
+set_threads: ctypes.CFUNCTYPE = DLL.set_threads
+set_threads.argtypes = (ctypes.c_uint64,)
+set_threads.restype = ctypes.c_uint64
+
+# uint64_t get_threads(void);
+get_threads: ctypes.CFUNCTYPE = DLL.get_threads
+get_threads.argtypes = ()
+get_threads.restype = ctypes.c_uint64
+
 # void free_extracted(Extracted extracted);
 free_extracted: ctypes.CFUNCTYPE = DLL.free_extracted
 free_extracted.argtypes = (CExtracted,)
 free_extracted.restype = None
 
+# void free_extractedList(ExtractedList extractedList);
+free_extractedList: ctypes.CFUNCTYPE = DLL.free_extractedList
+free_extractedList.argtypes = (CExtractedList,)
+free_extractedList.restype = None
+
 
 class CStatus(Enum):
     """The error code of the C functions"""
@@ -167,6 +664,140 @@ class CStatus(Enum):
     BadDataPiecesLen = 3  # DataPieces.len != Precomputed.imageList.len
     BadPrecomputed = 4  # a Precomputed with an error code is passed to embed
     InvalidLen = 5  # invalid length of data in the extracted image
+    UnsupportedKernel = 6  # the requested bit-plane kernel isn't supported by the CPU
+    BadSquareSize = 7  # a square size other than 8, 16 or 32
+    BadCachePath = 8  # the cache directory path is too long
+    BadBits = 9  # bits per pixel byte other than 1 to 4
+    BadImageFile = 10  # a file that can't be mapped or isn't binary PNM, PAM or uncompressed BMP
+    BadCoverIndex = 11  # removing a cover that was never added
+    StripFailure = 12  # the reader or writer of a strip image failed
+    BadChunk = 13  # a chunk that is too short, past its message's chunk count, from the future or too old
+    ReassemblyFull = 14  # a chunk that doesn't fit into the reassembly's memory limit
+
+
+class ReassemblyFullError(MemoryError):
+    """The memory limit of a reassembler is reached, unlike a plain MemoryError nothing failed to allocate"""
+
+
+def use_cache(directory: str | None) -> None:
+    """Keeps the square order of every cover in **directory**, so covers met again skip scoring and sorting
+
+    :param directory: the cache directory, created when missing, None turns the cache off
+    """
+
+    path = os.fsencode(directory) if directory is not None else None
+    if set_cache(path) != CStatus.OK.value:
+        raise ValueError("invalid cache directory")
+
+
+def handle_error_code(code: int) -> None:
+    """Raises the exception matching an error code of the C functions"""
+
+    match code:
+        case CStatus.AllocationFailure.value:
+            raise MemoryError("memory allocation failure in CDLL")
+        case CStatus.OversizeData.value:
+            raise ValueError("oversize data")
+        case CStatus.BadDataPiecesLen.value:
+            raise ValueError("precomputed data is invalid: invalid len")
+        case CStatus.BadPrecomputed.value:
+            raise ValueError("precomputed data have an error code")
+        case CStatus.InvalidLen.value:
+            raise ValueError("invalid image: invalid data length")
+        case CStatus.BadSquareSize.value:
+            raise ValueError("invalid square size")
+        case CStatus.BadBits.value:
+            raise ValueError("invalid bits per pixel byte")
+        case CStatus.BadImageFile.value:
+            raise ValueError("invalid image file: binary PNM, PAM or uncompressed BMP expected")
+        case CStatus.BadCoverIndex.value:
+            raise IndexError("image index out of range")
+        case CStatus.StripFailure.value:
+            raise OSError("a strip of the image couldn't be read or written")
+        case CStatus.BadChunk.value:
+            raise ValueError("invalid chunk")
+        case CStatus.ReassemblyFull.value:
+            raise ReassemblyFullError("the chunk doesn't fit into the reassembly memory limit")
+
+
+class SegmentedPieces:
+    """
+    Pieces held for the C library to embed from in place, each one a buffer or a sequence of buffers that is read
+    one after another instead of being joined. Nothing is copied, so the buffers are held until **release**.
+    """
+
+    def __init__(self, pieces: Sequence):
+        self.buffers: list[PixelBuffer] = []
+        self.arrays = []  # the ctypes arrays the struct points into
+        segments_list = (CSegments * len(pieces))()
+        try:
+            for i, piece in enumerate(pieces):
+                parts = piece if isinstance(piece, (list, tuple)) else (piece,)
+                segments = (CSegment * len(parts))()
+                for j, part in enumerate(parts):
+                    buffer = PixelBuffer(part)
+                    self.buffers.append(buffer)
+                    segments[j] = CSegment(buffer.pointer, len(buffer))
+                self.arrays.append(segments)
+                segments_list[i] = CSegments(segments, len(parts))
+        except BaseException:
+            self.release()
+            raise
+        self.arrays.append(segments_list)
+        self.pieces = CSegmentPieces(segments_list, len(pieces))
+
+    def release(self) -> None:
+        for buffer in self.buffers:
+            buffer.release()
+        self.buffers.clear()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *_):
+        self.release()
+
+
+class Context:
+    """
+    Memory the C library reuses across calls, so a long-running sender or receiver stops allocating per message.
+    Whatever a call made with it returned is valid until **reset**.
+    """
+
+    def __init__(self):
+        self.handle = context_new()
+        if not self.handle:
+            raise MemoryError("memory allocation failure in CDLL")
+
+    def reset(self) -> None:
+        """Releases the results of every call made with the context, keeping its memory"""
+
+        context_reset(self.handle)
+
+    @property
+    def capacity(self) -> int:
+        """The bytes the context holds, it stops growing once a round between resets fits in it"""
+
+        return context_capacity(self.handle)
+
+    def close(self) -> None:
+        if self.handle:
+            context_free(self.handle)
+            self.handle = None
+
+    def __del__(self):
+        self.close()
+
+
+def decode_image(src: BinaryIO) -> tuple[bytes, int, int, int, str]:
+    """Decodes the image in **src** without closing it, which Image.close would do
+
+    :return: the pixels, width, height, channel count and mode
+    """
+
+    # leaving the block only closes files Pillow opened itself
+    with Image.open(src) as image:
+        return image.tobytes(), image.width, image.height, len(image.getbands()), image.mode
 
 
 class Steganography:
@@ -181,31 +812,58 @@ class Steganography:
     precomputed: CPrecomputed
     is_precomputed: bool
     reserved: int  # the reserved size for data structure
+    square_size: int  # the square size of every image, recorded in the message
+    bits: int  # the payload bits per pixel byte of every image, recorded in the message
+    stats: CStats | None  # what precompute and embed spent, None when not collected
+    context: Context | None  # the memory precompute reuses, None for the heap
+    covers: int | None  # the images scored as they are added, so precompute only allocates, None with a context
     data_len: int
 
-    def __init__(self, reserved: int):
+    def __init__(self, reserved: int, square_size: int = SQUARE_SIZE, collect_stats: bool = False,
+                 context: Context | None = None, bits: int = 1):
         """
         :param reserved: the reserved size for data structure
+        :param square_size: 8, 16 or 32, bigger squares suit bigger covers
+        :param bits: 1 to 4 payload bits per pixel byte, more of them need fewer covers but show more
+        :param collect_stats: whether **stats** adds up what add_image, precompute and embed spend, not with a
+                              context
+        :param context: reused by precompute and embed, it is reset whenever the images are, without one every image
+                        is scored once when it is added and precompute only reruns the allocation
         """
 
+        if square_size not in SQUARE_SIZES:
+            raise ValueError(f"square size must be one of {SQUARE_SIZES}")
+        if bits not in SAMPLE_BITS:
+            raise ValueError(f"bits must be one of {SAMPLE_BITS}")
+        self.square_size = square_size
+        self.bits = bits
+        self.stats = CStats() if collect_stats else None
+        self.context = context
+        self.covers = None
         self.images = []
         self.modes = []
         self.is_precomputed = False
         self.reserved = reserved
+        if context is None:
+            self.covers = covers_new(reserved)
+            if not self.covers:
+                raise MemoryError("memory allocation failure in CDLL")
 
     @staticmethod
     def __handle_error_code(code: int):
-        match code:
-            case CStatus.AllocationFailure:
-                raise MemoryError("memory allocation failure in CDLL")
-            case CStatus.OversizeData.value:
-                raise ValueError("oversize data")
-            case CStatus.BadDataPiecesLen.value:
-                raise ValueError("precomputed data is invalid: invalid len")
-            case CStatus.BadPrecomputed:
-                raise ValueError("precomputed data have an error code")
-            case CStatus.InvalidLen.value:
-                raise ValueError("invalid image: invalid data length")
+        handle_error_code(code)
+
+    def __stats_pointer(self):
+        return ctypes.byref(self.stats) if self.stats is not None else None
+
+    def __free_precomputed(self) -> None:
+        # an allocation of the covers only borrows them
+        if not self.is_precomputed or self.covers is not None:
+            return
+        if self.context is not None:
+            self.context.reset()
+        else:
+            free_precomputed(self.precomputed)
 
     def add_image(self, file_src: BinaryIO, file_dst: BinaryIO) -> None:
         """Adds an image to the image list. For embedding only.
@@ -216,9 +874,33 @@ class Steganography:
         *file_src* and *file_dst* will not be closed until **clear** is called.
         """
 
+        if self.covers is not None:
+            # decoded and scored right away, the library keeps its own copy of the pixels
+            decoded, width, height, channels, mode = decode_image(file_src)
+            with PixelBuffer(decoded) as pixels:
+                c_image = CImage.from_pixels(pixels, width, height, channels, self.square_size, self.bits)
+                code = covers_add(self.covers, CImageList((CImage * 1)(c_image), 1, False), False,
+                                  self.__stats_pointer())
+            self.__handle_error_code(code)
+            self.modes.append(mode)
+
         self.images.append((file_src, file_dst))
-        if self.is_precomputed:
-            free_precomputed(self.precomputed)
+        self.__free_precomputed()
+        self.is_precomputed = False
+
+    def remove_image(self, index: int) -> None:
+        """Removes an image from the image list without closing its files. For embedding only.
+
+        :param index: the index of the image in the order they were added
+        """
+
+        if not 0 <= index < len(self.images):
+            raise IndexError("image index out of range")
+        if self.covers is not None:
+            self.__handle_error_code(covers_remove(self.covers, index))
+            del self.modes[index]
+        del self.images[index]
+        self.__free_precomputed()
         self.is_precomputed = False
 
     def clear(self) -> None:
@@ -231,16 +913,33 @@ class Steganography:
                 dst.close()
         self.images.clear()
         self.modes.clear()
-        if self.is_precomputed:
-            free_precomputed(self.precomputed)
+        self.__free_precomputed()
         self.is_precomputed = False
+        if self.covers is not None:
+            covers_free(self.covers)
+            self.covers = covers_new(self.reserved)
+            if not self.covers:
+                raise MemoryError("memory allocation failure in CDLL")
+
+    def __del__(self):
+        if getattr(self, "covers", None):
+            covers_free(self.covers)
+            self.covers = None
 
     def precompute(self, data_length: int) -> None:
         """Precomputes the images. This method has to be called before embedding.
 
+        Without a context, only the allocation of squares runs again, so it can be called for every new length.
         :param data_length: The length of the data being embedded (without structure size)
         """
 
+        if self.covers is not None:
+            self.data_len = data_length
+            self.precomputed = covers_allocate(self.covers, data_length, self.__stats_pointer())
+            self.is_precomputed = self.precomputed.code == CStatus.OK.value
+            self.__handle_error_code(self.precomputed.code)
+            return
+
         if self.is_precomputed:
             return
 
@@ -248,69 +947,562 @@ class Steganography:
         self.data_len = data_length
 
         image_list = CImageList((CImage * len(self.images))(), len(self.images))
+        buffers: list[PixelBuffer] = []
 
         for i, (reader, _) in enumerate(self.images):
-            image = Image.open(reader)
-            self.modes.append(image.mode)
-
-            c_image = CImage.new_image(image)
-            image_list.images[i] = c_image
-            image.close()
-
-        self.precomputed = precompute(image_list, data_length, self.reserved)
+            decoded, width, height, channels, mode = decode_image(reader)
+            self.modes.append(mode)
+
+            # the decoded pixels are read in place, the library makes the one copy it embeds into
+            buffers.append(PixelBuffer(decoded))
+            image_list.images[i] = CImage.from_pixels(buffers[i], width, height, channels, self.square_size,
+                                                      self.bits)
+
+        try:
+            if self.context is not None:
+                self.precomputed = precompute_context(self.context.handle, image_list, data_length, self.reserved,
+                                                      False)
+            else:
+                self.precomputed = precompute_stats(image_list, data_length, self.reserved, False,
+                                                    self.__stats_pointer())
+        finally:
+            for buffer in buffers:
+                buffer.release()
 
         self.__handle_error_code(self.precomputed.code)
         self.is_precomputed = True
 
-    def embed(self, pieces: Sequence[bytes], format_: str = "PNG") -> None:
+    def embed(self, pieces: Sequence, format_: str = "PNG") -> None:
         """Embeds pieces of data into the images. Call this method after calling **precompute**.
 
-        :param pieces: the pieces of data being embedded, including the structures
+        :param pieces: the pieces of data being embedded, including the structures, each one anything with the buffer
+                       protocol or a sequence of those that is embedded as if joined
         :param format_: the format for the embedded images
         """
 
         if not self.precomputed:
             raise RuntimeError("precomputation has not been done. Call the precompute method first.")
 
-        # build CDataPieces struct
-        data_pieces = CDataPieces((CData * len(pieces))(), len(pieces))
-        for i in range(len(pieces)):
-            piece = pieces[i]
-            buffer = (ctypes.c_uint8 * len(piece)).from_buffer(bytearray(piece))
-            data_pieces.pieces[i] = CData(buffer, len(piece))
-
-        # call embedded
-        embedded: CEmbedded = embed(self.precomputed, data_pieces)
+        # the pieces are read in place, the library zero-fills the last square instead of padding a copy
+        with SegmentedPieces(pieces) as segmented:
+            if self.context is not None:
+                embedded: CEmbedded = embed_segments_context(self.context.handle, self.precomputed, segmented.pieces)
+            else:
+                embedded: CEmbedded = embed_segments_stats(self.precomputed, segmented.pieces,
+                                                           self.__stats_pointer())
 
         # handle errors
         self.__handle_error_code(embedded.code)
 
-        # save results
+        # save results straight from the library's pixels
         for i, c_image in enumerate(embedded.imageList.get_images()):
             c_image: CImage
-            image = Image.frombuffer(self.modes[i], (c_image.w, c_image.h), c_image.get_pixels())
+            image = Image.frombuffer(self.modes[i], (c_image.w, c_image.h), c_image.view_pixels())
             writer = self.images[i][1]
-            writer.truncate(0)
+            # embedding again after a new precompute rewrites the file from its start
+            writer.seek(0)
+            writer.truncate()
             image.save(writer, format_)
             image.close()
 
     @classmethod
-    def extract(cls, src: BinaryIO, reserved: int) -> bytes:
+    def extract(cls, src: BinaryIO, reserved: int, stats: CStats | None = None,
+                context: Context | None = None) -> bytes:
         """Extracts the data from **src**
 
         **src** will not be closed, you have to close it somewhere
         :param src: the source image
         :param reserved: the reserved size for structure
+        :param stats: adds up what the extraction spent when given, not with a context
+        :param context: reused for the extraction and reset once the data is copied out
         :return: the extracted data
         """
 
-        image = Image.open(src)
-        c_image = CImage.new_image(image)
-        extracted: CExtracted = extract(c_image, ctypes.c_uint64(reserved))
-        image.close()
+        decoded, width, height, channels, _ = decode_image(src)
+        with PixelBuffer(decoded) as pixels:
+            c_image = CImage.from_pixels(pixels, width, height, channels)
+            if context is not None:
+                extracted: CExtracted = extract_context(context.handle, c_image, ctypes.c_uint64(reserved), True)
+            else:
+                stats_pointer = ctypes.byref(stats) if stats is not None else None
+                extracted: CExtracted = extract_stats(c_image, ctypes.c_uint64(reserved), True, stats_pointer)
+
+        try:
+            cls.__handle_error_code(extracted.code)
+            return bytes(extracted.data)
+        finally:
+            if context is not None:
+                context.reset()
+            else:
+                free_extracted(extracted)
+
+    @classmethod
+    def probe(cls, src: BinaryIO, reserved: int) -> int | None:
+        """Tells whether **src** carries a payload without extracting it, for scanning incoming images
+
+        **src** will not be closed, you have to close it somewhere
+        :param src: the source image
+        :param reserved: the reserved size for structure
+        :return: the length extract would give, or None when there is nothing to extract
+        """
+
+        pixels, width, height, channels, _ = decode_image(src)
+        return probe_pixels(pixels, width, height, channels, reserved)
+
+    @classmethod
+    def extract_list(cls, srcs: Sequence[BinaryIO], reserved: int) -> list[bytes | None]:
+        """Extracts the data from every image in **srcs** in one call
 
+        **srcs** will not be closed, you have to close them somewhere
+        :param srcs: the source images
+        :param reserved: the reserved size for structure
+        :return: the extracted data of each image, None for an image without a valid payload
+        """
+
+        image_list = CImageList((CImage * len(srcs))(), len(srcs))
+        buffers: list[PixelBuffer] = []
+        for i, src in enumerate(srcs):
+            decoded, width, height, channels, _ = decode_image(src)
+            buffers.append(PixelBuffer(decoded))
+            image_list.images[i] = CImage.from_pixels(buffers[i], width, height, channels)
+
+        try:
+            extracted: CExtractedList = extract_list(image_list, ctypes.c_uint64(reserved))
+        finally:
+            for buffer in buffers:
+                buffer.release()
         cls.__handle_error_code(extracted.code)
 
-        result = bytes(extracted.data)
-        free_extracted(extracted)
+        result: list[bytes | None] = []
+        for i in range(len(srcs)):
+            piece: CData = extracted.dataPieces.pieces[i]
+            result.append(bytes(piece) if extracted.codes[i] == CStatus.OK.value else None)
+        free_extractedList(extracted)
         return result
+
+    @classmethod
+    def extract_stream(cls, src: BinaryIO, reserved: int, chunk_size: int = 1 << 16) -> Iterator[bytes]:
+        """Extracts the data from **src** chunk by chunk, only ordering as many squares as have been read
+
+        **src** will not be closed, you have to close it somewhere
+        :param src: the source image
+        :param reserved: the reserved size for structure
+        :param chunk_size: the maximum size of each chunk
+        :return: an iterator over the chunks of the extracted data
+        """
+
+        decoded, width, height, channels, _ = decode_image(src)
+        pixels = PixelBuffer(decoded)  # the cursor reads these pixels until it ends
+        c_image = CImage.from_pixels(pixels, width, height, channels)
+
+        cursor: CExtractCursor = extract_begin(c_image, ctypes.c_uint64(reserved))
+        try:
+            cls.__handle_error_code(cursor.code)
+            buffer = (ctypes.c_uint8 * chunk_size)()
+            while (read := extract_read(ctypes.byref(cursor), buffer, chunk_size)) != 0:
+                yield ctypes.string_at(buffer, read)
+        finally:
+            extract_end(ctypes.byref(cursor))
+            pixels.release()
+
+
+class PixelEmbedder:
+    """
+    Embeds into decoded pixels the caller owns (numpy arrays, bytearrays, writable memoryviews, ...) in place.
+    Nothing is copied on the way in or out, the buffers are held from **add_pixels** until **clear**.
+    """
+
+    buffers: list[PixelBuffer]
+    images: list[CImage]
+    image_list: CImageList | None  # the array the precomputed squares are kept in
+    precomputed: CPrecomputed | None
+    reserved: int
+    square_size: int
+    bits: int
+
+    def __init__(self, reserved: int, square_size: int = SQUARE_SIZE, bits: int = 1):
+        """
+        :param reserved: the reserved size for data structure
+        :param square_size: 8, 16 or 32, bigger squares suit bigger covers
+        :param bits: 1 to 4 payload bits per pixel byte
+        """
+
+        if square_size not in SQUARE_SIZES:
+            raise ValueError(f"square size must be one of {SQUARE_SIZES}")
+        if bits not in SAMPLE_BITS:
+            raise ValueError(f"bits must be one of {SAMPLE_BITS}")
+        self.reserved = reserved
+        self.square_size = square_size
+        self.bits = bits
+        self.buffers = []
+        self.images = []
+        self.image_list = None
+        self.precomputed = None
+
+    def _free_precomputed(self) -> None:
+        if self.precomputed is not None:
+            free_precomputed(self.precomputed)
+            self.precomputed = None
+        self.image_list = None
+
+    def add_pixels(self, pixels, width: int, height: int, channels: int) -> None:
+        """Adds a cover, its pixels row by row with interleaved channels
+
+        :param pixels: a writable, contiguous buffer of width * height * channels bytes
+        """
+
+        buffer = PixelBuffer(pixels, True)
+        try:
+            self.images.append(CImage.from_pixels(buffer, width, height, channels, self.square_size, self.bits))
+        except ValueError:
+            buffer.release()
+            raise
+        self.buffers.append(buffer)
+        self._free_precomputed()
+
+    def clear(self) -> None:
+        """Releases the covers, their buffers can be resized again afterwards"""
+
+        self._free_precomputed()
+        for buffer in self.buffers:
+            buffer.release()
+        self.buffers.clear()
+        self.images.clear()
+
+    def precompute(self, data_length: int) -> tuple[int, ...]:
+        """Precomputes the covers for a payload
+
+        :param data_length: the length of the data being embedded (without structure size)
+        :return: the lengths of the pieces each cover takes (without structure size)
+        """
+
+        self._free_precomputed()
+        image_list = CImageList((CImage * len(self.images))(*self.images), len(self.images), False)
+        precomputed: CPrecomputed = precompute_inplace(image_list, data_length, self.reserved)
+        handle_error_code(precomputed.code)
+        self.image_list = image_list
+        self.precomputed = precomputed
+        return precomputed.get_lengths(self.reserved)
+
+    def embed(self, pieces: Sequence) -> None:
+        """Embeds the pieces into the covers' own pixels
+
+        :param pieces: the pieces of data being embedded, including the structures, each one anything with the buffer
+                       protocol or a sequence of those that is embedded as if joined
+        """
+
+        if self.precomputed is None:
+            raise RuntimeError("precomputation has not been done. Call the precompute method first.")
+        with SegmentedPieces(pieces) as segmented:
+            embedded: CEmbedded = embed_segments(self.precomputed, segmented.pieces)
+        handle_error_code(embedded.code)
+
+    def __del__(self):
+        self.clear()
+
+
+class FileEmbedder(PixelEmbedder):
+    """
+    Embeds into binary PNM, PAM or uncompressed BMP files through the C library's mappings, skipping decoding and
+    encoding. Each destination is written as a copy of its source and embedded into in place.
+    """
+
+    files: list[CImageFile]
+
+    def __init__(self, reserved: int, square_size: int = SQUARE_SIZE, bits: int = 1):
+        super().__init__(reserved, square_size, bits)
+        self.files = []
+
+    def add_file(self, src: str, dst: str) -> None:
+        """Adds a cover file and the file its embedded copy is written to"""
+
+        file: CImageFile = map_image_copy(os.fsencode(src), os.fsencode(dst))
+        handle_error_code(file.code)
+        file.image.squareSize = self.square_size
+        file.image.bits = self.bits
+        self.files.append(file)
+        self.images.append(file.image)
+        self._free_precomputed()
+
+    def embed(self, pieces: Sequence) -> None:
+        """Embeds the pieces and writes the files, call **clear** afterwards to unmap them"""
+
+        super().embed(pieces)
+        for file in self.files:
+            handle_error_code(sync_image(ctypes.byref(file)))
+
+    def clear(self) -> None:
+        """Unmaps the files"""
+
+        super().clear()
+        for file in self.files:
+            unmap_image(ctypes.byref(file))
+        self.files.clear()
+
+
+def strip_reader(read, row_len: int) -> StripReader:
+    """Wraps **read(row, rows)**, which returns a buffer of those rows, row_len bytes each, for the C library"""
+
+    def reader(_, row: int, rows: int, pixels) -> bool:
+        try:
+            with PixelBuffer(read(row, rows)) as buffer:
+                if len(buffer) != rows * row_len:
+                    return False
+                ctypes.memmove(pixels, buffer.pointer, len(buffer))
+            return True
+        except Exception:
+            return False
+
+    return StripReader(reader)
+
+
+def embed_strips(read, write, width: int, height: int, channels: int, piece, reserved: int,
+                 square_size: int = 0, bits: int = 0) -> None:
+    """Embeds a piece into an image too large to decode at once, going over it twice a strip of rows at a time
+
+    :param read: read(row, rows) returning the bytes of those rows of the cover, width * channels each
+    :param write: write(row, pixels) taking the embedded rows in order, pixels is only valid during the call
+    :param piece: a buffer or a sequence of buffers holding the reserved area and the data, like a piece of embed
+    :param reserved: the reserved size for structure
+    """
+
+    def writer(_, row: int, rows: int, pixels) -> bool:
+        try:
+            write(row, library_view(pixels, rows * width * channels))
+            return True
+        except Exception:
+            return False
+
+    with SegmentedPieces([piece]) as pieces:
+        image = CStripImage(width, height, channels, square_size, bits, strip_reader(read, width * channels),
+                            StripWriter(writer), None)
+        handle_error_code(DLL.embed_strips(image, pieces.pieces.pieces[0], reserved))
+
+
+def extract_strips(read, width: int, height: int, channels: int, reserved: int) -> bytes:
+    """Extracts the data from an image too large to decode at once, going over it twice a strip of rows at a time
+
+    :param read: read(row, rows) returning the bytes of those rows, width * channels each
+    :param reserved: the reserved size for structure
+    :return: the extracted data
+    """
+
+    image = CStripImage(width, height, channels, 0, 0, strip_reader(read, width * channels), StripWriter(), None)
+    extracted: CExtracted = DLL.extract_strips(image, reserved)
+    handle_error_code(extracted.code)
+    data = extracted.data.get_data()
+    free_extracted(extracted)
+    return data
+
+
+def choose_covers(covers: Sequence[tuple[object, int, int, int]], data_length: int, reserved: int, floor: int = 0,
+                  fewest_pixels: bool = False) -> list[int]:
+    """Picks the covers of a pool to embed a payload in, scoring only the most promising ones in full
+
+    :param covers: (pixels, width, height, channels) of every cover, the pixels being any contiguous buffer
+    :param data_length: the length of the payload
+    :param reserved: the reserved size for structure
+    :param floor: the least entropy a square needs to be used, in the units of the library's entropy
+    :param fewest_pixels: fewest pixels rather than fewest covers
+    :return: the positions of the chosen covers in ascending order, they carry the payload above the floor
+    """
+
+    with contextlib.ExitStack() as stack:
+        c_images = (CImage * len(covers))()
+        for i, (pixels, width, height, channels) in enumerate(covers):
+            c_images[i] = CImage.from_pixels(stack.enter_context(PixelBuffer(pixels)), width, height, channels)
+        selection: CSelection = select_covers(CImageList(c_images, len(covers), False), data_length, reserved,
+                                              floor, 1 if fewest_pixels else 0)
+    handle_error_code(selection.code)
+    indices = selection.indices[:selection.len]
+    free_selection(selection)
+    return indices
+
+
+def extract_path(path: str, reserved: int) -> bytes:
+    """Extracts the data from a binary PNM, PAM or uncompressed BMP file without decoding it
+
+    :param path: the path of the file
+    :param reserved: the reserved size for structure
+    :return: the extracted data
+    """
+
+    extracted: CExtracted = extract_file(os.fsencode(path), ctypes.c_uint64(reserved))
+    handle_error_code(extracted.code)
+    data = extracted.data.get_data()
+    free_extracted(extracted)
+    return data
+
+
+def probe_pixels(pixels, width: int, height: int, channels: int, reserved: int) -> int | None:
+    """Tells whether decoded pixels carry a payload for a fraction of what extracting costs
+
+    :param pixels: a contiguous buffer of width * height * channels bytes, only read
+    :param reserved: the reserved size for structure
+    :return: the length extraction would give, the reserved area included, or None without a payload
+    """
+
+    with PixelBuffer(pixels) as buffer:
+        probed: CProbed = probe(CImage.from_pixels(buffer, width, height, channels), ctypes.c_uint64(reserved))
+    handle_error_code(probed.code)
+    return probed.len if probed.present else None
+
+
+class ExtractedData:
+    """
+    A payload the C library extracted, read through **data** without a copy until **close**.
+    Closing it frees the library's memory, every view of **data** has to be gone by then.
+    """
+
+    def __init__(self, extracted: CExtracted):
+        self.extracted = extracted
+        self.closed = False
+
+    @property
+    def data(self) -> memoryview:
+        if self.closed:
+            raise ValueError("the extracted data has been closed")
+        return self.extracted.data.view_data()
+
+    def __len__(self) -> int:
+        return self.extracted.data.len
+
+    def __bytes__(self) -> bytes:
+        return bytes(self.data)
+
+    def close(self) -> None:
+        if not self.closed:
+            free_extracted(self.extracted)
+            self.closed = True
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *_):
+        self.close()
+
+    def __del__(self):
+        self.close()
+
+
+def extract_pixels(pixels, width: int, height: int, channels: int, reserved: int) -> ExtractedData:
+    """Extracts the data from decoded pixels in place
+
+    :param pixels: a contiguous buffer of width * height * channels bytes, only read
+    :param reserved: the reserved size for structure
+    :return: the extracted data, owned by the library until it is closed
+    """
+
+    with PixelBuffer(pixels) as buffer:
+        c_image = CImage.from_pixels(buffer, width, height, channels)
+        extracted: CExtracted = extract_inplace(c_image, ctypes.c_uint64(reserved))
+    handle_error_code(extracted.code)
+    return ExtractedData(extracted)
+
+
+class ReassembledMessage:
+    """
+    A message the reassembler put back together, its chunks read through **segments** without a copy until
+    **close**, which frees them, every view of them has to be gone by then.
+    """
+
+    def __init__(self, reassembler: "Reassembler", reassembled: CReassembled):
+        self.reassembler = reassembler
+        self.reassembled = reassembled
+        self.closed = False
+
+    @property
+    def id(self) -> bytes:
+        return bytes(self.reassembled.id)
+
+    @property
+    def time(self) -> int:
+        return self.reassembled.time
+
+    @property
+    def segments(self) -> tuple[memoryview, ...]:
+        if self.closed:
+            raise ValueError("the message has been closed")
+        data = self.reassembled.data
+        return tuple(library_view(data.segments[i].data, data.segments[i].len) for i in range(data.len))
+
+    def __len__(self) -> int:
+        return self.reassembled.len
+
+    def __bytes__(self) -> bytes:
+        return b"".join(self.segments)
+
+    def close(self) -> None:
+        if not self.closed:
+            reassembly_release(self.reassembler.handle, self.reassembled)
+            self.closed = True
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *_):
+        self.close()
+
+    def __del__(self):
+        self.close()
+
+
+class Reassembler:
+    """
+    Chunks from **distribution.split** put back together natively, one at a time, in any order and from any number
+    of messages at once. Each chunk costs the same however many messages are in flight, the memory held stays
+    within the limit by dropping the oldest incomplete messages, and messages missing chunks for longer than
+    max_age seconds are dropped.
+    """
+
+    def __init__(self, memory_limit: int = 256 << 20, max_age: int = 7 * 24 * 3600):
+        """
+        :param memory_limit: the most bytes of chunks and bookkeeping held at once
+        :param max_age: how long an incomplete message is kept after its first chunk came in, 0 for ever
+        """
+
+        self.handle = reassembly_new(memory_limit, max_age)
+        if self.handle is None:
+            raise MemoryError("memory allocation failure in CDLL")
+
+    def add(self, chunk, now: int | None = None) -> None:
+        """Takes a chunk, copying it, one that came before is ignored
+
+        :param chunk: any contiguous buffer
+        :param now: the current time, that of the clock **distribution.split** stamps chunks with by default
+        """
+
+        now = int(time.time()) if now is None else now
+        with PixelBuffer(chunk) as buffer:
+            handle_error_code(reassembly_add(self.handle, buffer.pointer, len(buffer), now))
+
+    def expire(self, now: int | None = None) -> int:
+        """Drops the incomplete messages that are too old, adding does it as well
+
+        :return: the number of messages dropped
+        """
+
+        return reassembly_expire(self.handle, int(time.time()) if now is None else now)
+
+    def messages(self) -> Iterator[ReassembledMessage]:
+        """The complete messages not taken yet, in the order they were completed"""
+
+        while True:
+            reassembled: CReassembled = reassembly_next(self.handle)
+            if not reassembled.message:
+                return
+            yield ReassembledMessage(self, reassembled)
+
+    @property
+    def pending(self) -> int:
+        return reassembly_pending(self.handle)
+
+    @property
+    def memory(self) -> int:
+        return reassembly_memory(self.handle)
+
+    def __del__(self):
+        # the messages handed out keep the reassembler alive until they are gone
+        if getattr(self, "handle", None) is not None:
+            reassembly_free(self.handle)
+            self.handle = None
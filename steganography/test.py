@@ -1,6 +1,10 @@
 import os
+import time
 import unittest
 
+from PIL import Image
+
+import distribution
 import steganography
 
 
@@ -19,8 +23,63 @@ class SteganographyTest(unittest.TestCase):
 
         with open("embedded.png", "rb") as src:
             extracted = steganography.Steganography.extract(src, reserved)
+            src.seek(0)
+            probed = steganography.Steganography.probe(src, reserved)
+
+            self.assertFalse(src.closed)
 
         self.assertEqual(extracted, msg)
+        self.assertEqual(probed, len(msg))
+
+    def test_reembed(self):
+        reserved = 130
+        cover = os.urandom(512 * 512 * 3)
+        Image.frombytes("RGB", (512, 512), cover).save("cover.png")
+
+        # a shorter message after a longer one, the second output shows nothing of the first
+        with open("cover.png", "rb") as src, open("embedded.png", "w+b") as dst:
+            obj = steganography.Steganography(reserved, square_size=8)
+            obj.add_image(src, dst)
+            lengths = []
+            for data_len in (6000, 10):
+                msg = os.urandom(data_len + reserved)
+                obj.precompute(data_len)
+                obj.embed([msg])
+                dst.flush()
+                lengths.append(obj.precomputed.imageList.images[0].usage)
+            obj.clear()
+
+        with open("embedded.png", "rb") as src:
+            self.assertEqual(steganography.Steganography.extract(src, reserved), msg)
+        with Image.open("embedded.png") as embedded:
+            changed = sum(a != b for a, b in zip(embedded.tobytes(), cover))
+        square_bytes = 8 * 8 * 3
+        self.assertLessEqual(changed, (lengths[1] + 1) * square_bytes)
+        self.assertLess(lengths[1], lengths[0])
+
+    def test_context(self):
+        reserved = 130
+        data_len = 23576
+        context = steganography.Context()
+
+        # the second round of the same size is served from what the first one left in the context
+        with open("test_image.png", "rb") as src, open("embedded.png", "w+b") as dst:
+            obj = steganography.Steganography(reserved, context=context)
+            obj.add_image(src, dst)
+            capacities = []
+            for _ in range(2):
+                msg = os.urandom(data_len + reserved)
+                obj.precompute(data_len)
+                obj.embed([msg])
+                dst.flush()
+                capacities.append(context.capacity)
+            obj.clear()
+
+        with open("embedded.png", "rb") as src:
+            self.assertEqual(steganography.Steganography.extract(src, reserved), msg)
+        self.assertGreater(capacities[0], 0)
+        self.assertEqual(capacities[1], capacities[0])
+        context.close()
 
     def test_oversize(self):
         reserved = 130
@@ -52,6 +111,97 @@ class SteganographyTest(unittest.TestCase):
 
         self.fail("no error raised on invalid image")
 
+    def test_pixels(self):
+        reserved = 130
+        data_len = 23576
+        msg = os.urandom(data_len + reserved)
+        pixels = bytearray(os.urandom(512 * 512 * 3))
+
+        embedder = steganography.PixelEmbedder(reserved)
+        embedder.add_pixels(pixels, 512, 512, 3)
+        embedder.precompute(data_len)
+        embedder.embed([msg])
+        embedder.clear()
+
+        with steganography.extract_pixels(pixels, 512, 512, 3, reserved) as extracted:
+            self.assertEqual(bytes(extracted), msg)
+        self.assertEqual(steganography.probe_pixels(pixels, 512, 512, 3, reserved), len(msg))
+        self.assertIsNone(steganography.probe_pixels(os.urandom(512 * 512 * 3), 512, 512, 3, reserved))
+
+        # read-only pixels are refused, and the buffer that never held them releases nothing
+        with self.assertRaises(BufferError):
+            steganography.PixelBuffer(bytes(pixels), writable=True)
+
+    def test_files(self):
+        reserved = 130
+        data_len = 23576
+        msg = os.urandom(data_len + reserved)
+        with open("cover.ppm", "wb") as cover:
+            cover.write(b"P6\n512 512\n255\n" + os.urandom(512 * 512 * 3))
+
+        embedder = steganography.FileEmbedder(reserved)
+        embedder.add_file("cover.ppm", "embedded.ppm")
+        embedder.precompute(data_len)
+        embedder.embed([msg])
+        embedder.clear()
+
+        self.assertEqual(steganography.extract_path("embedded.ppm", reserved), msg)
+
+    def test_strips(self):
+        reserved = 130
+        msg = os.urandom(23576 + reserved)
+        row_len = 512 * 3
+        cover = os.urandom(512 * row_len)
+        embedded = bytearray(len(cover))
+
+        def write(row, pixels):
+            embedded[row * row_len:row * row_len + len(pixels)] = pixels
+
+        steganography.embed_strips(lambda row, rows: cover[row * row_len:(row + rows) * row_len], write,
+                                   512, 512, 3, [msg[:100], msg[100:]], reserved)
+        extracted = steganography.extract_strips(lambda row, rows: embedded[row * row_len:(row + rows) * row_len],
+                                                 512, 512, 3, reserved)
+        self.assertEqual(extracted, msg)
+        with steganography.extract_pixels(embedded, 512, 512, 3, reserved) as in_memory:
+            self.assertEqual(bytes(in_memory), msg)
+
+    def test_reassembler(self):
+        # two messages interleaved, the chunks of the second one sent twice
+        first = distribution.split(os.urandom(3000), [1000, 0, 2000])
+        second = distribution.split(os.urandom(500), [200, 300])
+        reassembler = steganography.Reassembler()
+        for chunk in (first[2], second[1], first[0], second[0], second[1], first[1]):
+            reassembler.add(chunk)
+        messages = [bytes(message) for message in reassembler.messages()]
+        self.assertEqual(messages, [distribution.merge(second), distribution.merge(first)])
+        self.assertEqual(reassembler.pending, 0)
+
+        self.assertEqual(distribution.merge_all(first[:2] + second), [distribution.merge(second)])
+
+        # sent more than a week ago, which check and merge accept as well
+        sent = (int(time.time()) - 8 * 24 * 3600).to_bytes(8, "little")
+        old = [chunk[:24] + sent + chunk[32:] for chunk in first]
+        self.assertEqual(distribution.merge_all(old), [distribution.merge(old)])
+        with self.assertRaises(ValueError):
+            reassembler.add(first[0][:20])
+
+        # a limit too small for any message is reported apart from a failed allocation
+        with self.assertRaises(steganography.ReassemblyFullError):
+            steganography.Reassembler(memory_limit=1024).add(first[0])
+
+    def test_choose_covers(self):
+        reserved = 130
+        data_len = 23576
+        # a flat cover carries nothing
+        covers = [(bytes(256 * 256 * 3), 256, 256, 3)]
+        covers += [(os.urandom(256 * 256 * 3), 256, 256, 3) for _ in range(3)]
+        covers.append((os.urandom(512 * 512 * 3), 512, 512, 3))
+
+        self.assertEqual(steganography.choose_covers(covers, data_len, reserved), [4])
+        self.assertNotIn(0, steganography.choose_covers(covers, data_len * 4, reserved, fewest_pixels=True))
+        with self.assertRaises(ValueError):
+            steganography.choose_covers(covers[:1], data_len, reserved)
+
 
 if __name__ == '__main__':
     unittest.main()